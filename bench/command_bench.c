@@ -0,0 +1,107 @@
+// Microbenchmark: the in-place tokenizer and switch-based verb lookup in src/command.c against the sscanf and strcmp
+// chain that process_line() used before. Both sides copy the line into a scratch buffer first, as the tokenizer
+// writes into it. Build and run with `make bench`.
+//
+//   ./command_bench [iterations]   (default: 5000000)
+
+#include "../src/command.h"
+#include "../src/frame.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// ---- The previous parser, kept as it was apart from the name; it only resolves the verb and its words ----
+
+static int sscanf_parse_line(const char* complete_message) {
+    char command[32] = {0};
+    char topic[64] = {0};
+    int payload_offset = 0;
+    int parsed_items = sscanf(complete_message, "%31s %63s %n", command, topic, &payload_offset);
+
+    const char* payload = "";
+    if (parsed_items == 2 && complete_message[payload_offset] != '\0') {
+        payload = &complete_message[payload_offset];
+        parsed_items = 3;
+    }
+    (void)payload;
+
+    if (parsed_items == 2 && strcmp(command, "HELLO") == 0) {
+        return VERB_HELLO;
+    } else if (parsed_items == 3 && strcmp(command, "SET") == 0) {
+        return OP_SET;
+    } else if (parsed_items == 2 && strcmp(command, "GET") == 0) {
+        return OP_GET;
+    } else if (parsed_items >= 1 && strcmp(command, "PING") == 0) {
+        return OP_PING;
+    } else if (parsed_items >= 1 && strcmp(command, "PONG") == 0) {
+        return OP_PONG;
+    } else if (parsed_items == 2 && strcmp(command, "ACK") == 0) {
+        return OP_ACK;
+    } else if (parsed_items == 2 && strcmp(command, "QOS") == 0) {
+        return OP_QOS;
+    } else if (parsed_items >= 2 && strcmp(command, "SUBSCRIBE") == 0) {
+        return OP_SUBSCRIBE;
+    } else if (parsed_items >= 2 && strcmp(command, "UNSUBSCRIBE") == 0) {
+        return OP_UNSUBSCRIBE;
+    } else if (parsed_items == 3 && strcmp(command, "PUBLISH") == 0) {
+        return OP_PUBLISH;
+    }
+    return -1;
+}
+
+// ---- Harness ----
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Keeps the compiler from dropping parses whose results are unused
+static volatile int sink;
+
+static const char* lines[] = {
+    "PING",
+    "PUBLISH sensors/desktop-000042/cpu load=0.42 temp=61 fan=1800",
+    "ACK 123456",
+    "UNSUBSCRIBE sensors/#",
+    "FETCH sensors/desktop-000042/cpu",
+};
+
+int main(int argc, char** argv) {
+    long iterations = (argc > 1) ? atol(argv[1]) : 5000000;
+    if (iterations <= 0) return 1;
+
+    char scratch[256];
+    printf("%-64s %12s %12s\n", "line", "sscanf ns", "table ns");
+    for (size_t k = 0; k < sizeof(lines) / sizeof(lines[0]); k++) {
+        const char* line = lines[k];
+        size_t len = strlen(line) + 1;
+
+        CommandLine parsed;
+        memcpy(scratch, line, len);
+        if (command_parse_line(scratch, &parsed) != sscanf_parse_line(line)) {
+            fprintf(stderr, "command_bench: the parsers disagree on \"%s\"\n", line);
+            return 1;
+        }
+
+        double start = now_ns();
+        for (long i = 0; i < iterations; i++) {
+            memcpy(scratch, line, len);
+            sink += sscanf_parse_line(scratch);
+        }
+        double old_ns = (now_ns() - start) / iterations;
+
+        start = now_ns();
+        for (long i = 0; i < iterations; i++) {
+            memcpy(scratch, line, len);
+            sink += command_parse_line(scratch, &parsed);
+        }
+        double new_ns = (now_ns() - start) / iterations;
+
+        printf("%-64s %12.1f %12.1f\n", line, old_ns, new_ns);
+    }
+    return 0;
+}
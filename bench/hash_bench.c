@@ -0,0 +1,214 @@
+// Microbenchmark: the open-addressing table in src/hash.c against the fixed 100-bucket chained table it replaced.
+// Keys look like the hostnames in clients_map. Build and run with `make bench`.
+//
+//   ./hash_bench [keys...]   (default: 1000 20000 100000)
+
+#include "../src/hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// ---- The previous implementation, kept verbatim apart from the names ----
+
+#define CHAINED_TABLE_SIZE 100
+
+typedef struct ChainedEntry {
+    char *key;
+    void *value;
+    struct ChainedEntry *next;
+} ChainedEntry;
+
+typedef struct {
+    ChainedEntry **buckets;
+} ChainedTable;
+
+static unsigned int chained_hash(const char *key) {
+    unsigned long int value = 0;
+    unsigned int i = 0;
+    unsigned int key_len = strlen(key);
+
+    for (; i < key_len; ++i) {
+        value = value * 37 + key[i];
+    }
+    return value % CHAINED_TABLE_SIZE;
+}
+
+static ChainedTable *chained_create() {
+    ChainedTable *table = malloc(sizeof(ChainedTable));
+    table->buckets = calloc(CHAINED_TABLE_SIZE, sizeof(ChainedEntry *));
+    return table;
+}
+
+static void chained_free(ChainedTable *table) {
+    for (int i = 0; i < CHAINED_TABLE_SIZE; i++) {
+        ChainedEntry *entry = table->buckets[i];
+        while (entry != NULL) {
+            ChainedEntry *next_entry = entry->next;
+            free(entry->key);
+            free(entry);
+            entry = next_entry;
+        }
+    }
+    free(table->buckets);
+    free(table);
+}
+
+static void chained_set(ChainedTable *table, const char *key, void *value) {
+    unsigned int slot = chained_hash(key);
+
+    ChainedEntry *entry = table->buckets[slot];
+    while (entry != NULL) {
+        if (strcmp(entry->key, key) == 0) {
+            entry->value = value;
+            return;
+        }
+        entry = entry->next;
+    }
+
+    ChainedEntry *new_entry = malloc(sizeof(ChainedEntry));
+    new_entry->key = strdup(key);
+    new_entry->value = value;
+    new_entry->next = table->buckets[slot];
+    table->buckets[slot] = new_entry;
+}
+
+static void *chained_get(ChainedTable *table, const char *key) {
+    ChainedEntry *entry = table->buckets[chained_hash(key)];
+    while (entry != NULL) {
+        if (strcmp(entry->key, key) == 0) return entry->value;
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+static bool chained_del(ChainedTable *table, const char *key) {
+    unsigned int slot = chained_hash(key);
+    ChainedEntry *current = table->buckets[slot];
+    ChainedEntry *previous = NULL;
+
+    while (current != NULL) {
+        if (strcmp(current->key, key) == 0) {
+            if (previous == NULL) table->buckets[slot] = current->next;
+            else previous->next = current->next;
+            free(current->key);
+            free(current);
+            return true;
+        }
+        previous = current;
+        current = current->next;
+    }
+    return false;
+}
+
+// ---- Harness ----
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Keeps the compiler from dropping lookups whose results are unused
+static volatile uintptr_t sink;
+
+typedef struct {
+    double insert, hit, miss, churn; // ns per operation
+} Result;
+
+static Result bench_open(char **keys, char **absent, int n) {
+    Result r;
+    HashTable *t = create_table();
+
+    double start = now_ns();
+    for (int i = 0; i < n; i++) set(t, keys[i], keys[i]);
+    r.insert = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (int i = 0; i < n; i++) sink += (uintptr_t)get(t, keys[(i * 7919) % n]);
+    r.hit = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (int i = 0; i < n; i++) sink += (uintptr_t)get(t, absent[i]);
+    r.miss = (now_ns() - start) / n;
+
+    // Connections coming and going: remove a host and add it back
+    start = now_ns();
+    for (int i = 0; i < n; i++) {
+        del(t, keys[i]);
+        set(t, keys[i], keys[i]);
+    }
+    r.churn = (now_ns() - start) / (2.0 * n);
+
+    for (int i = 0; i < n; i++) {
+        if (get(t, keys[i]) != keys[i] || get(t, absent[i]) != NULL) {
+            fprintf(stderr, "hash_bench: open-addressing table returned a wrong value for %s\n", keys[i]);
+            exit(1);
+        }
+    }
+    free_table(t);
+    return r;
+}
+
+static Result bench_chained(char **keys, char **absent, int n) {
+    Result r;
+    ChainedTable *t = chained_create();
+
+    double start = now_ns();
+    for (int i = 0; i < n; i++) chained_set(t, keys[i], keys[i]);
+    r.insert = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (int i = 0; i < n; i++) sink += (uintptr_t)chained_get(t, keys[(i * 7919) % n]);
+    r.hit = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (int i = 0; i < n; i++) sink += (uintptr_t)chained_get(t, absent[i]);
+    r.miss = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (int i = 0; i < n; i++) {
+        chained_del(t, keys[i]);
+        chained_set(t, keys[i], keys[i]);
+    }
+    r.churn = (now_ns() - start) / (2.0 * n);
+
+    chained_free(t);
+    return r;
+}
+
+int main(int argc, char **argv) {
+    int default_sizes[] = { 1000, 20000, 100000 };
+    int size_count = (argc > 1) ? argc - 1 : 3;
+
+    printf("%-8s %-10s %12s %12s %12s %12s\n", "keys", "table", "insert ns", "hit ns", "miss ns", "churn ns");
+    for (int k = 0; k < size_count; k++) {
+        int n = (argc > 1) ? atoi(argv[k + 1]) : default_sizes[k];
+        if (n <= 0) continue;
+
+        char **keys = malloc(sizeof(char *) * n);
+        char **absent = malloc(sizeof(char *) * n);
+        for (int i = 0; i < n; i++) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "desktop-%06d", i);
+            keys[i] = strdup(buf);
+            snprintf(buf, sizeof(buf), "laptop-%06d.lab.example.org", i); // Long enough to live outside the slot
+            absent[i] = strdup(buf);
+        }
+
+        Result open = bench_open(keys, absent, n);
+        Result chained = bench_chained(keys, absent, n);
+        printf("%-8d %-10s %12.1f %12.1f %12.1f %12.1f\n", n, "open", open.insert, open.hit, open.miss, open.churn);
+        printf("%-8d %-10s %12.1f %12.1f %12.1f %12.1f\n", n, "chained", chained.insert, chained.hit, chained.miss,
+               chained.churn);
+
+        for (int i = 0; i < n; i++) {
+            free(keys[i]);
+            free(absent[i]);
+        }
+        free(keys);
+        free(absent);
+    }
+    return 0;
+}
@@ -0,0 +1,257 @@
+// Microbenchmark: publish cost through the topic registry in src/pubsub.c with 10k topics and 50k subscribers,
+// then wildcard matching through the topic trie with 100k wildcard subscriptions, against the linear
+// topic_filter_covers() scan over every filter that the trie replaced.
+// The client layer is stubbed out below, so this measures the lookup, the snapshot and the fanout loop up to the
+// point where a message would be queued on a socket. Build and run with `make bench`.
+//
+//   ./pubsub_bench [publishes]   (default: 200000)
+
+#include "../src/pubsub.h"
+#include "../src/client_manager.h"
+#include "../src/topic.h"
+#include "../src/topiclog.h"
+#include "../src/retained.h"
+#include "../src/tracker.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TOPICS 10000
+#define SUBSCRIBERS 50000
+#define GROUPS_PER_SUBSCRIBER 4
+#define WILDCARD_SUBSCRIBERS 100000 // One distinct filter each, on fds after the plain subscribers
+#define MAX_FD (SUBSCRIBERS + WILDCARD_SUBSCRIBERS)
+
+// ---- Stubs for the parts of the broker pubsub.c calls into ----
+
+static Client* clients[MAX_FD + 1]; // Indexed by fd; fd 0 is never used
+static unsigned long deliveries;
+
+Client* client_get_and_lock(conn_handle_t handle) {
+    int fd = HANDLE_FD(handle);
+    if (fd <= 0 || fd > MAX_FD || clients[fd] == NULL || clients[fd]->handle != handle) return NULL;
+    pthread_mutex_lock(&clients[fd]->lock);
+    return clients[fd];
+}
+
+void client_unlock(Client* c) {
+    pthread_mutex_unlock(&c->lock);
+}
+
+int client_deliver(Client* c, Message* msg, const char* topic) {
+    (void)c;
+    (void)msg;
+    (void)topic;
+    deliveries++;
+    return 1;
+}
+
+Client* client_get_and_lock_by_hostname(const char* hostname) {
+    (void)hostname;
+    return NULL;
+}
+
+int client_match_hostnames(const char* pattern, conn_handle_t** handles) {
+    (void)pattern;
+    *handles = NULL;
+    return 0;
+}
+
+const char* client_state_get(Client* c, const char* key) {
+    (void)c;
+    (void)key;
+    return NULL;
+}
+
+int topiclog_is_durable(const char* topic) {
+    (void)topic;
+    return 0;
+}
+
+TopicLog* topiclog_get(const char* topic) {
+    (void)topic;
+    return NULL;
+}
+
+// Never reached: no topic has a log
+void topiclog_lock(TopicLog* log) { (void)log; }
+void topiclog_unlock(TopicLog* log) { (void)log; }
+Message* topiclog_append(TopicLog* log, const char* topic, const char* attrs, const char* payload,
+                         size_t payload_len) {
+    (void)log;
+    (void)topic;
+    (void)attrs;
+    (void)payload;
+    (void)payload_len;
+    return NULL;
+}
+long long topiclog_next_offset(TopicLog* log) {
+    (void)log;
+    return 0;
+}
+void topiclog_bounds(TopicLog* log, long long* first, long long* next) {
+    (void)log;
+    *first = *next = 0;
+}
+Message* topiclog_read(TopicLog* log, long long* offset, int max_records, size_t max_bytes) {
+    (void)log;
+    (void)offset;
+    (void)max_records;
+    (void)max_bytes;
+    return NULL;
+}
+
+void retained_foreach(const char* filter, void (*fn)(void* ctx, const char* topic, Message* msg), void* ctx) {
+    (void)filter;
+    (void)fn;
+    (void)ctx;
+}
+
+void tracker_expect(unsigned long long cid, char** hostnames, int count) {
+    (void)cid;
+    for (int i = 0; i < count; i++) free(hostnames[i]);
+}
+
+// ---- Harness ----
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static Client* stub_client(int fd) {
+    Client* c = calloc(1, sizeof(Client));
+    c->fd = fd;
+    c->handle = HANDLE_MAKE(fd, 1);
+    snprintf(c->hostname, sizeof(c->hostname), "desktop-%06d", fd);
+    pthread_mutex_init(&c->lock, NULL);
+    return c;
+}
+
+// Runs n publishes to the topics picked by name_of and prints ns per publish and per delivery
+static void run(const char* label, long n, void (*name_of)(long i, char* out, size_t size)) {
+    char name[64];
+    unsigned long before = deliveries;
+    double start = now_ns();
+    for (long i = 0; i < n; i++) {
+        name_of(i, name, sizeof(name));
+        pubsub_publish(name, "UPDATE pkg-1.2.3 now", 20);
+    }
+    double ns = now_ns() - start;
+    unsigned long delivered = deliveries - before;
+    printf("%-26s %10ld %14.1f %12.1f %14.1f\n", label, n, ns / n, (double)delivered / n,
+           delivered ? ns / delivered : 0.0);
+}
+
+static void group_topic(long i, char* out, size_t size) {
+    snprintf(out, size, "CMD-GRP-%ld", (i * 7919) % TOPICS);
+}
+
+static void missing_topic(long i, char* out, size_t size) {
+    snprintf(out, size, "CMD-GRP-X%ld", i % TOPICS);
+}
+
+static void broadcast_topic(long i, char* out, size_t size) {
+    (void)i;
+    snprintf(out, size, "BROADCAST");
+}
+
+// Telemetry topics "fleet/r<region>/h<host>/m<metric>"; some levels fall outside what the filters name
+static void fleet_topic(long i, char* out, size_t size) {
+    unsigned long x = (unsigned long)i * 2654435761u;
+    snprintf(out, size, "fleet/r%lu/h%lu/m%lu", x % 100, (x >> 8) % 300, (x >> 16) % 300);
+}
+
+// Four shapes of filter, 25k of each, all distinct
+static void fleet_filter(int i, char* out, size_t size) {
+    int a = i / 4;
+    switch (i % 4) {
+        case 0: snprintf(out, size, "fleet/r%d/h%d/+", a % 100, a / 100); break;
+        case 1: snprintf(out, size, "fleet/r%d/+/m%d", a % 100, a / 100); break;
+        case 2: snprintf(out, size, "fleet/+/h%d/m%d", a % 250, a / 250); break;
+        default: snprintf(out, size, "+/r%d/h%d/#", a % 100, a / 100); break;
+    }
+}
+
+// What publish matching cost before the trie: every wildcard subscription checked against the topic
+static long linear_matches(char** filters, int n, const char* topic) {
+    long matches = 0;
+    for (int j = 0; j < n; j++) matches += topic_filter_covers(filters[j], topic);
+    return matches;
+}
+
+static void bench_wildcards(long publishes) {
+    char name[64];
+    char** filters = malloc(sizeof(char*) * WILDCARD_SUBSCRIBERS);
+    for (int i = 0; i < WILDCARD_SUBSCRIBERS; i++) {
+        int fd = SUBSCRIBERS + 1 + i;
+        fleet_filter(i, name, sizeof(name));
+        filters[i] = strdup(name);
+        clients[fd] = stub_client(fd);
+        pubsub_subscribe(clients[fd]->handle, filters[i], NULL);
+    }
+
+    // Each filter has a subscriber of its own, so the trie must deliver exactly once per matching filter
+    for (long i = 0; i < 200; i++) {
+        fleet_topic(i, name, sizeof(name));
+        unsigned long before = deliveries;
+        pubsub_publish(name, "UPDATE", 6);
+        if ((long)(deliveries - before) != linear_matches(filters, WILDCARD_SUBSCRIBERS, name)) {
+            fprintf(stderr, "pubsub_bench: the trie and the linear scan disagree on %s\n", name);
+            exit(1);
+        }
+    }
+
+    printf("\n%d wildcard subscriptions\n", WILDCARD_SUBSCRIBERS);
+    printf("%-26s %10s %14s %12s %14s\n", "match by", "publishes", "ns/publish", "recipients", "ns/delivery");
+    run("trie (with fanout)", publishes, fleet_topic);
+
+    long scans = publishes / 1000 + 1;
+    long matched = 0;
+    double start = now_ns();
+    for (long i = 0; i < scans; i++) {
+        fleet_topic(i, name, sizeof(name));
+        matched += linear_matches(filters, WILDCARD_SUBSCRIBERS, name);
+    }
+    double ns = now_ns() - start;
+    printf("%-26s %10ld %14.1f %12.1f %14s\n", "linear scan (match only)", scans, ns / scans, (double)matched / scans,
+           "-");
+
+    for (int i = 0; i < WILDCARD_SUBSCRIBERS; i++) free(filters[i]);
+    free(filters);
+}
+
+int main(int argc, char** argv) {
+    long publishes = (argc > 1) ? atol(argv[1]) : 200000;
+    if (publishes <= 0) return 1;
+
+    pubsub_init();
+
+    // Every subscriber joins BROADCAST and a handful of the command groups, about 20 subscribers per group
+    char name[64];
+    srand(1);
+    double start = now_ns();
+    for (int fd = 1; fd <= SUBSCRIBERS; fd++) {
+        clients[fd] = stub_client(fd);
+        pubsub_subscribe(clients[fd]->handle, "BROADCAST", NULL);
+        for (int g = 0; g < GROUPS_PER_SUBSCRIBER; g++) {
+            snprintf(name, sizeof(name), "CMD-GRP-%d", rand() % TOPICS);
+            pubsub_subscribe(clients[fd]->handle, name, NULL);
+        }
+    }
+    double setup_ns = now_ns() - start;
+    printf("%d topics, %d subscribers: %.1f ns per subscribe\n\n", TOPICS, SUBSCRIBERS,
+           setup_ns / (SUBSCRIBERS * (GROUPS_PER_SUBSCRIBER + 1)));
+
+    printf("%-26s %10s %14s %12s %14s\n", "publish to", "publishes", "ns/publish", "recipients", "ns/delivery");
+    run("CMD-GRP-N (~20 subs)", publishes, group_topic);
+    run("unknown topic", publishes, missing_topic);
+    run("BROADCAST (50k subs)", publishes / 1000 + 1, broadcast_topic);
+
+    // Last, as the first wildcard subscription makes every publish walk the trie
+    bench_wildcards(publishes);
+    return 0;
+}
@@ -0,0 +1,204 @@
+// Microbenchmark: the lock-free ring in src/ts_queue.c against the mutex/condvar queue it replaced, with 1, 4 and 16
+// producers and as many consumers. Every item is checked to come out exactly once. Build and run with `make bench`.
+//
+//   ./queue_bench [items]   (default: 1000000, split across the producers)
+
+#include "../src/ts_queue.h"
+#include "../src/worker.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// ---- The previous implementation, kept verbatim apart from the names ----
+
+#define MUTEX_QUEUE_MAX_SIZE 100
+
+typedef struct {
+  void* buffer[MUTEX_QUEUE_MAX_SIZE];
+  int head;
+  int tail;
+  int count;
+  int shutdown;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+} mutex_queue_t;
+
+static void mutex_queue_init(mutex_queue_t* q) {
+  q->head = 0;
+  q->tail = 0;
+  q->count = 0;
+  q->shutdown = 0;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->not_empty, NULL);
+  pthread_cond_init(&q->not_full, NULL);
+}
+
+static void mutex_queue_write(mutex_queue_t* q, void* data_ptr) {
+  pthread_mutex_lock(&q->lock);
+
+  while (q->count == MUTEX_QUEUE_MAX_SIZE) {
+    pthread_cond_wait(&q->not_full, &q->lock);
+  }
+
+  q->buffer[q->tail] = data_ptr;
+  q->tail = (q->tail + 1) % MUTEX_QUEUE_MAX_SIZE;
+  q->count++;
+
+  pthread_cond_signal(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
+
+static int mutex_queue_read(mutex_queue_t* q, void** data_ptr) {
+  pthread_mutex_lock(&q->lock);
+
+  while (q->count == 0 && !q->shutdown) {
+    pthread_cond_wait(&q->not_empty, &q->lock);
+  }
+
+  if (q->count == 0 && q->shutdown) {
+    pthread_mutex_unlock(&q->lock);
+    return 0; // Queue empty and shutting down
+  }
+
+  *data_ptr = q->buffer[q->head];
+  q->head = (q->head + 1) % MUTEX_QUEUE_MAX_SIZE;
+  q->count--;
+
+  pthread_cond_signal(&q->not_full);
+  pthread_mutex_unlock(&q->lock);
+  return 1; // Success
+}
+
+static void mutex_queue_shutdown(mutex_queue_t* q) {
+  pthread_mutex_lock(&q->lock);
+  q->shutdown = 1;
+  pthread_cond_broadcast(&q->not_empty); // Wake all waiting readers
+  pthread_cond_broadcast(&q->not_full);  // Wake all waiting writers (if any)
+  pthread_mutex_unlock(&q->lock);
+}
+
+static void mutex_queue_destroy(mutex_queue_t* q) {
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->not_empty);
+  pthread_cond_destroy(&q->not_full);
+}
+
+// ---- Harness ----
+
+typedef enum { KIND_MUTEX, KIND_RING, KIND_RING_BATCH } Kind;
+
+typedef struct {
+  Kind kind;
+  mutex_queue_t* mq;
+  ts_queue_t* rq;
+  long first, count;       // Producer: items [first, first + count)
+  unsigned char* seen;     // Consumers mark each item they take
+  long taken;
+} Worker;
+
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Items are small integers offset by one, so none of them is NULL
+static void* producer(void* arg) {
+  Worker* w = arg;
+  for (long i = w->first; i < w->first + w->count; i++) {
+    if (w->kind == KIND_MUTEX) mutex_queue_write(w->mq, (void*)(i + 1));
+    else queue_write(w->rq, (void*)(i + 1));
+  }
+  return NULL;
+}
+
+static void* consumer(void* arg) {
+  Worker* w = arg;
+  void* items[WORKER_BATCH_SIZE];
+  int n;
+  while (1) {
+    if (w->kind == KIND_MUTEX) n = mutex_queue_read(w->mq, &items[0]);
+    else if (w->kind == KIND_RING) n = queue_read(w->rq, &items[0]);
+    else n = queue_read_batch(w->rq, items, WORKER_BATCH_SIZE);
+    if (n == 0) break;
+
+    for (int k = 0; k < n; k++) w->seen[(long)items[k] - 1]++;
+    w->taken += n;
+  }
+  return NULL;
+}
+
+// Returns ns per item, or -1 if an item was lost or duplicated
+static double run(Kind kind, int threads, long items) {
+  mutex_queue_t mq;
+  ts_queue_t rq;
+  if (kind == KIND_MUTEX) mutex_queue_init(&mq);
+  else queue_init(&rq);
+
+  unsigned char* seen = calloc(items, 1);
+  Worker* producers = calloc(threads, sizeof(Worker));
+  Worker* consumers = calloc(threads, sizeof(Worker));
+  pthread_t* producer_ids = malloc(sizeof(pthread_t) * threads);
+  pthread_t* consumer_ids = malloc(sizeof(pthread_t) * threads);
+
+  // Consumers share one seen array; every item is a separate byte, so their marks never race
+  double start = now_ns();
+  for (int t = 0; t < threads; t++) {
+    consumers[t] = (Worker){ .kind = kind, .mq = &mq, .rq = &rq, .seen = seen };
+    pthread_create(&consumer_ids[t], NULL, consumer, &consumers[t]);
+  }
+  long per_thread = items / threads;
+  for (int t = 0; t < threads; t++) {
+    long count = (t == threads - 1) ? items - per_thread * t : per_thread;
+    producers[t] = (Worker){ .kind = kind, .mq = &mq, .rq = &rq, .first = per_thread * t, .count = count };
+    pthread_create(&producer_ids[t], NULL, producer, &producers[t]);
+  }
+  for (int t = 0; t < threads; t++) pthread_join(producer_ids[t], NULL);
+
+  // Consumers drain whatever is left before they see the shutdown
+  if (kind == KIND_MUTEX) mutex_queue_shutdown(&mq);
+  else queue_shutdown(&rq);
+  for (int t = 0; t < threads; t++) pthread_join(consumer_ids[t], NULL);
+  double ns = (now_ns() - start) / items;
+
+  long taken = 0;
+  for (int t = 0; t < threads; t++) taken += consumers[t].taken;
+  for (long i = 0; i < items; i++) {
+    if (seen[i] != 1) taken = -1;
+  }
+
+  if (kind == KIND_MUTEX) mutex_queue_destroy(&mq);
+  else queue_destroy(&rq);
+  free(seen);
+  free(producers);
+  free(consumers);
+  free(producer_ids);
+  free(consumer_ids);
+  return (taken == items) ? ns : -1;
+}
+
+int main(int argc, char** argv) {
+  long items = (argc > 1) ? atol(argv[1]) : 1000000;
+  if (items <= 0) return 1;
+
+  static const int thread_counts[] = { 1, 4, 16 };
+  static const char* names[] = { "mutex", "ring", "ring-batch" };
+
+  printf("%-10s %-12s %12s\n", "threads", "queue", "ns/item");
+  for (size_t k = 0; k < sizeof(thread_counts) / sizeof(thread_counts[0]); k++) {
+    for (Kind kind = KIND_MUTEX; kind <= KIND_RING_BATCH; kind++) {
+      double ns = run(kind, thread_counts[k], items);
+      if (ns < 0) {
+        fprintf(stderr, "queue_bench: %s queue lost or duplicated items with %d threads\n", names[kind],
+                thread_counts[k]);
+        return 1;
+      }
+      printf("%-10d %-12s %12.1f\n", thread_counts[k], names[kind], ns);
+    }
+  }
+  return 0;
+}
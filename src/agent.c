@@ -14,6 +14,7 @@
 #include <pthread.h>
 
 #include "agent_config.h"
+#include "frame.h"
 #include "tokenizer.h"
 
 volatile sig_atomic_t keep_running = 1;
@@ -124,16 +125,228 @@ int parse_ini_action(const char* action_dir, const char* command, const char* ar
     return found_config;
 }
 
+// Set once the broker has agreed to binary framing (see frame.h); every command after that goes out as a frame
+static int binary_mode = 0;
+
 void* agent_ping_thread(void* arg) {
     SSL* ssl = (SSL*)arg;
+    static const char ping_frame[] = { OP_PING, 0, 0 };
     while (1) {
         sleep(30); // Ping every 30 seconds
-        char* ping_msg = "PING\n";
-        SSL_write(ssl, ping_msg, strlen(ping_msg));
+        if (binary_mode) SSL_write(ssl, ping_frame, sizeof(ping_frame));
+        else SSL_write(ssl, "PING\n", 5);
     }
     return NULL;
 }
 
+void send_publish(SSL* ssl, const char* topic, const char* payload) {
+    size_t topic_len = strlen(topic), payload_len = strlen(payload);
+    char* msg = malloc(frame_len(frame_str_len(topic_len) + frame_str_len(payload_len)) + 16);
+    char* end;
+    if (binary_mode) {
+        end = frame_put_header(msg, OP_PUBLISH, 0, frame_str_len(topic_len) + frame_str_len(payload_len));
+        end = frame_put_str(frame_put_str(end, topic, topic_len), payload, payload_len);
+    } else {
+        end = msg + sprintf(msg, "PUBLISH %s %s\n", topic, payload);
+    }
+    SSL_write(ssl, msg, end - msg);
+    free(msg);
+}
+
+// Sends "ACK <n>" or "QOS <n>"
+void send_number(SSL* ssl, int opcode, const char* verb, unsigned long long n) {
+    char msg[64];
+    char* end;
+    if (binary_mode) end = frame_put_varint(frame_put_header(msg, opcode, 0, frame_varint_len(n)), n);
+    else end = msg + snprintf(msg, sizeof(msg), "%s %llu\n", verb, n);
+    SSL_write(ssl, msg, end - msg);
+}
+
+
+// Offset of the last message handled on each durable topic, kept on disk so a restarted agent can resume
+#define MAX_TRACKED_TOPICS 16
+
+typedef struct {
+    char topic[128];
+    long long offset;
+} TopicOffset;
+
+static TopicOffset offsets[MAX_TRACKED_TOPICS];
+static int offset_count = 0;
+
+void offsets_load(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return;
+
+    char line[256];
+    while (offset_count < MAX_TRACKED_TOPICS && fgets(line, sizeof(line), file)) {
+        TopicOffset* o = &offsets[offset_count];
+        if (sscanf(line, "%127[^=]=%lld", o->topic, &o->offset) == 2) offset_count++;
+    }
+    fclose(file);
+}
+
+// Remembers the offset of a handled message and rewrites the offset file (atomically, via rename)
+void offset_record(const char* path, const char* topic, long long offset) {
+    int i = 0;
+    while (i < offset_count && strcmp(offsets[i].topic, topic) != 0) i++;
+    if (i == offset_count) {
+        if (offset_count == MAX_TRACKED_TOPICS) return;
+        strncpy(offsets[i].topic, topic, sizeof(offsets[i].topic) - 1);
+        offset_count++;
+    }
+    offsets[i].offset = offset;
+
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* file = fopen(tmp_path, "w");
+    if (!file) return;
+    for (int j = 0; j < offset_count; j++) fprintf(file, "%s=%lld\n", offsets[j].topic, offsets[j].offset);
+    fclose(file);
+    rename(tmp_path, path);
+}
+
+void subscribe_topic(SSL* ssl, const char* topic) {
+    char msg[256];
+    int i = 0;
+    while (i < offset_count && strcmp(offsets[i].topic, topic) != 0) i++;
+
+    if (binary_mode) {
+        // "from" is the offset plus one, zero meaning live messages only
+        size_t topic_len = strlen(topic);
+        unsigned long long from = (i < offset_count) ? offsets[i].offset + 2 : 0;
+        size_t body_len = frame_str_len(topic_len) + frame_varint_len(from) + frame_str_len(0);
+        char* end = frame_put_header(msg, OP_SUBSCRIBE, 0, body_len);
+        end = frame_put_str(frame_put_varint(frame_put_str(end, topic, topic_len), from), "", 0);
+        SSL_write(ssl, msg, end - msg);
+        return;
+    }
+
+    if (i < offset_count) snprintf(msg, sizeof(msg), "SUBSCRIBE %s FROM %lld\n", topic, offsets[i].offset + 1);
+    else snprintf(msg, sizeof(msg), "SUBSCRIBE %s\n", topic);
+    SSL_write(ssl, msg, strlen(msg));
+}
+
+
+// Handles one delivery: its topic, the attributes the broker put in its brackets and the payload.
+// seq is nonzero for a QoS 1 delivery, which is acknowledged once handled.
+static void handle_delivery(SSL* ssl, const AgentConfig* config, const char* topic, const char* attrs,
+                            const char* payload, unsigned long long seq) {
+    char command[64] = {0};
+    char argument[128] = {0};
+    sscanf(payload, "%63s %127[^\n]", command, argument);
+
+    // Messages on durable topics carry their log offset inside the brackets, "[topic off=N]", and commands
+    // from the admin CLI a correlation id, "[topic cid=N]", which our reports echo so the broker can tally them
+    long long offset = -1;
+    char cid[40] = {0};
+    const char* off = strstr(attrs, "off=");
+    if (off) offset = atoll(off + 4);
+    const char* id = strstr(attrs, "cid=");
+    if (id) snprintf(cid, sizeof(cid), "%.*s ", (int)strcspn(id, " "), id);
+
+    // Commands for our command group, or addressed to this host directly (the broker only delivers "@..." targets to matching hosts)
+    if (strcmp(topic, config->command_group) == 0 || topic[0] == '@') {
+        if (strlen(topic) > 0 && strlen(command) > 0 && strlen(argument) >= 0) { // Also make sure we have at least topic and command values
+
+            ActionConfig act_config = {0};
+            if (parse_ini_action(config->action_dir, command, argument, &act_config)) {
+
+               char exec_cmd[1024];
+               snprintf(exec_cmd, sizeof(exec_cmd), "%s %s %s", act_config.cmd, act_config.target, act_config.arguments);
+
+                // Tokenize the string and use execvp()
+                char **argv_list = NULL;
+                int argc_count = tokenize_command(exec_cmd, &argv_list);
+
+                if (argc_count > 0) {
+                    pid_t pid = fork();
+
+                    if (pid == 0) {
+                        // execvp bypasses /bin/sh completely to prevent shell injection
+                        execvp(argv_list[0], argv_list);
+                        perror("execvp failed"); // Only prints if the command doesn't exist
+                        exit(1);
+                    } else if (pid > 0) {
+                        char report[512];
+                        snprintf(report, sizeof(report), "%sSUCCESS: Task '%s' started (PID %d).",
+                             cid, command, pid);
+                        send_publish(ssl, "agent-status", report);
+                    }
+                }
+
+                // Free the memory allocated by the tokenizer
+                free_tokens(argv_list, argc_count);
+
+            } else {
+                char report[512];
+                snprintf(report, sizeof(report), "%sERROR: Unknown action '%s %s'", cid, command, argument);
+                send_publish(ssl, "agent-status", report);
+            }
+        }
+    } else if (strlen(topic) > 0 && strlen(command) > 0) { // If it isn't from the command queue just print it
+        printf("\n[AdMQ Agent] Message received on channel '%s': %s %s\n", topic, command, argument);
+    }
+
+    if (offset >= 0) offset_record(config->offset_file, topic, offset);
+
+    if (seq > 0) send_number(ssl, OP_ACK, "ACK", seq);
+}
+
+// Handles one message line from the broker
+static void handle_message(SSL* ssl, const AgentConfig* config, char* line) {
+    // With QoS 1 on, deliveries arrive as "MSG <seq> [topic] ..." and are acknowledged once handled
+    unsigned long long seq = 0;
+    int consumed = 0;
+    if (sscanf(line, "MSG %llu %n", &seq, &consumed) == 1 && consumed > 0) line += consumed;
+
+    // "[topic attrs] payload"; anything else is a reply to one of our commands
+    char topic[128] = {0};
+    int payload_at = 0;
+    if (sscanf(line, "[%127[^]]]%n", topic, &payload_at) != 1 || payload_at == 0) {
+        if (seq > 0) send_number(ssl, OP_ACK, "ACK", seq);
+        return;
+    }
+    char* payload = &line[payload_at];
+    if (*payload == ' ') payload++;
+
+    char* attrs = strchr(topic, ' ');
+    if (attrs) *attrs++ = '\0';
+    else attrs = "";
+    handle_delivery(ssl, config, topic, attrs, payload, seq);
+}
+
+// Handles one frame from the broker once binary framing is on. Returns 0 if the frame does not add up.
+static int handle_frame(SSL* ssl, const AgentConfig* config, const Frame* f) {
+    static unsigned long long next_seq = 0; // From the OP_SEQ in front of a QoS 1 delivery
+    const char* p = f->body;
+    const char* end = f->body + f->body_len;
+    const char *topic, *attrs, *payload;
+    size_t len;
+    uint64_t seq;
+
+    switch (f->opcode) {
+        case OP_SEQ:
+            if (!frame_get_varint(&p, end, &seq)) return 0;
+            next_seq = seq;
+            return 1;
+        case OP_DELIVER:
+            if (!frame_get_str(&p, end, &topic, &len) || !frame_get_str(&p, end, &attrs, &len) ||
+                !frame_get_bytes(&p, end, &payload, &len)) {
+                return 0;
+            }
+            seq = next_seq;
+            next_seq = 0;
+            handle_delivery(ssl, config, topic, attrs, payload, seq);
+            return 1;
+        default:
+            return 1; // Replies and PONGs need nothing from us
+    }
+}
+
+
+
+
 
 SSL_CTX* create_client_context(const char* cert_path, const char* key_path, const char* ca_path) {
     OpenSSL_add_all_algorithms();
@@ -268,14 +481,40 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
-    // Subscribe to group from the config file
-    char sub_msg[128];
-    snprintf(sub_msg, sizeof(sub_msg), "SUBSCRIBE %s\n", config.command_group);
-    SSL_write(ssl, sub_msg, strlen(sub_msg));
+    // Large enough for a delivery carrying a whole script or config file
+    static char buffer[131072];
+    int buffered = 0;
+
+    // Binary framing is asked for in text and answered in text; a broker that does not know HELLO rejects it
+    // like any unknown command, and we carry on in text. Whatever follows the answer stays buffered.
+    if (strcmp(config.protocol, "binary") == 0) {
+        SSL_write(ssl, FRAME_HELLO "\n", strlen(FRAME_HELLO) + 1);
+        char* newline = NULL;
+        while (newline == NULL && buffered < (int)sizeof(buffer) - 1) {
+            int bytes_read = SSL_read(ssl, &buffer[buffered], sizeof(buffer) - 1 - buffered);
+            if (bytes_read <= 0) break;
+            buffered += bytes_read;
+            newline = memchr(buffer, '\n', buffered);
+        }
+        if (newline == NULL) {
+            printf("[AdMQ Agent] Disconnected from server - shutting down.\n");
+            return 1;
+        }
+
+        *newline = '\0';
+        binary_mode = (strncmp(buffer, FRAME_HELLO, strlen(FRAME_HELLO)) == 0);
+        if (!binary_mode) printf("[AdMQ Agent] Broker does not support binary framing, using text.\n");
+        buffered -= newline + 1 - buffer;
+        memmove(buffer, newline + 1, buffered);
+    }
 
-    // Subscribe to the global broadcast channel
-    char* sub_broadcast = "SUBSCRIBE BROADCAST\n";
-    SSL_write(ssl, sub_broadcast, strlen(sub_broadcast));
+    // Subscribe to group from the config file, and to the global broadcast channel.
+    // Durable topics resume right after the last message this agent handled, replaying anything it missed.
+    // QoS 1 goes first, so commands left unacknowledged by a previous connection are redelivered right away
+    send_number(ssl, OP_QOS, "QOS", 1);
+    offsets_load(config.offset_file);
+    subscribe_topic(ssl, config.command_group);
+    subscribe_topic(ssl, "BROADCAST");
 
     pthread_t ping_tid;
     pthread_create(&ping_tid, NULL, agent_ping_thread, (void*)ssl);
@@ -283,13 +522,10 @@ int main(int argc, char* argv[]) {
 
     printf("[AdMQ Agent] Connected to AdMQ server and starting main loop.\n");
 
-    char buffer[1024];
     // Main loop for persistent connection
     while (keep_running) {
-        memset(buffer, 0, sizeof(buffer));
-
         // SSL_read will unblock and return <= 0 if interrupted by the signal
-        int bytes_read = SSL_read(ssl, buffer, sizeof(buffer) - 1);
+        int bytes_read = SSL_read(ssl, &buffer[buffered], sizeof(buffer) - 1 - buffered);
 
         if (bytes_read <= 0) {
             if (!keep_running) {
@@ -300,59 +536,39 @@ int main(int argc, char* argv[]) {
             printf("[AdMQ Agent] Disconnected from server - shutting down.\n");
             break;
         }
-        buffer[strcspn(buffer, "\r\n")] = 0;
-
-        char topic[64] = {0};
-        char command[64] = {0};
-        char argument[128] = {0};
-
-        sscanf(buffer, "[%63[^]]] %63s %127[^\n]", topic, command, argument);
-
-
-        if (strcmp(topic, config.command_group) == 0) { // If this is a command from our command group, we execute it
-            if (strlen(topic) > 0 && strlen(command) > 0 && strlen(argument) >= 0) { // Also make sure we have at least topic and command values
-
-                ActionConfig act_config = {0};
-                if (parse_ini_action(config.action_dir, command, argument, &act_config)) {
-
-                   char exec_cmd[1024];
-                   snprintf(exec_cmd, sizeof(exec_cmd), "%s %s %s", act_config.cmd, act_config.target, act_config.arguments);
-
-                    // Tokenize the string and use execvp()
-                    char **argv_list = NULL;
-                    int argc_count = tokenize_command(exec_cmd, &argv_list);
-
-                    if (argc_count > 0) {
-                        pid_t pid = fork();
-
-                        if (pid == 0) {
-                            // execvp bypasses /bin/sh completely to prevent shell injection
-                            execvp(argv_list[0], argv_list);
-                            perror("execvp failed"); // Only prints if the command doesn't exist
-                            exit(1);
-                        } else if (pid > 0) {
-                            char report[512];
-                            snprintf(report, sizeof(report),
-                                 "PUBLISH agent-status SUCCESS: Task '%s' started (PID %d).\n",
-                                 command, pid);
-                            SSL_write(ssl, report, strlen(report));
-                        }
-                    }
-
-                    // Free the memory allocated by the tokenizer
-                    free_tokens(argv_list, argc_count);
-
-                } else {
-                    char report[512];
-                    snprintf(report, sizeof(report),
-                             "PUBLISH agent-status ERROR: Unknown action '%s %s'\n",
-                             command, argument);
-                    SSL_write(ssl, report, strlen(report));
-                }
+        buffered += bytes_read;
+        buffer[buffered] = '\0';
+
+        if (binary_mode) {
+            // Frames are handled in place; a frame cut short waits for the rest of it
+            int pos = 0;
+            Frame f;
+            long n;
+            while ((n = frame_parse(&buffer[pos], buffered - pos, sizeof(buffer) - 1, &f)) > 0 &&
+                   handle_frame(ssl, &config, &f)) {
+                pos += n;
             }
-        } else if (strlen(topic) > 0 && strlen(command) > 0) { // If it isn't from the command queue just print it
-            printf("\n[AdMQ Agent] Message received on channel '%s': %s %s\n", topic, command, argument);
+            if (n != 0) {
+                printf("[AdMQ Agent] Malformed frame from the broker - shutting down.\n");
+                break;
+            }
+            buffered -= pos;
+            memmove(buffer, &buffer[pos], buffered);
+            continue;
+        }
+
+        // One read may carry many messages (a replayed backlog arrives in bulk), and the last one may be cut short
+        char* line = buffer;
+        char* newline;
+        while ((newline = strchr(line, '\n')) != NULL) {
+            *newline = '\0';
+            line[strcspn(line, "\r")] = '\0';
+            handle_message(ssl, &config, line);
+            line = newline + 1;
         }
+        buffered -= line - buffer;
+        memmove(buffer, line, buffered);
+        if (buffered == sizeof(buffer) - 1) buffered = 0; // A line longer than the buffer is dropped
     }
 
     // SHUTDOWN SEQUENCE
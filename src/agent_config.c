@@ -25,6 +25,8 @@ int agent_config_load(const char* filepath, AgentConfig* config) {
     strncpy(config->ca_path, "certs/ca.crt", 255);
     strncpy(config->command_group, "CMD-GRP-1", 63);
     strncpy(config->action_dir, "./actions", 255);
+    strncpy(config->offset_file, "agent_offsets.dat", 255);
+    strncpy(config->protocol, "binary", 15);
 
     FILE* file = fopen(filepath, "r");
     if (!file) {
@@ -55,6 +57,8 @@ int agent_config_load(const char* filepath, AgentConfig* config) {
             else if (strcmp(key, "ca_path") == 0) strncpy(config->ca_path, val, sizeof(config->ca_path) - 1);
             else if (strcmp(key, "command_group") == 0) strncpy(config->command_group, val, sizeof(config->command_group) - 1);
             else if (strcmp(key, "action_dir") == 0) strncpy(config->action_dir, val, sizeof(config->action_dir) - 1);
+            else if (strcmp(key, "offset_file") == 0) strncpy(config->offset_file, val, sizeof(config->offset_file) - 1);
+            else if (strcmp(key, "protocol") == 0) strncpy(config->protocol, val, sizeof(config->protocol) - 1);
         }
     }
 
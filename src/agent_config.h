@@ -9,6 +9,8 @@ typedef struct {
     char ca_path[256];
     char command_group[64];
     char action_dir[256];
+    char offset_file[256]; // Where the last handled offset of each durable topic is kept
+    char protocol[16];     // "binary" asks the broker for binary framing (falling back to text if it declines), "text" does not
 } AgentConfig;
 
 int agent_config_load(const char* filepath, AgentConfig* config);
@@ -1,6 +1,12 @@
 #include "cli.h"
 #include "db.h"
 #include "pubsub.h"
+#include "topic.h"
+#include "retained.h"
+#include "qos.h"
+#include "tracker.h"
+#include "rollout.h"
+#include "scheduler.h"
 #include "client_manager.h"
 #include "tokenizer.h"
 
@@ -200,20 +206,85 @@ void* admin_cli_thread(void* arg) {
                 // Prints a status message
                 client_manager_print_status();
                 pubsub_print_status();
+                retained_print_status();
+                qos_print_status();
+
+            } else if (strcmp(argv[0], "PUBLISH") == 0 && argc >= 5 &&
+                       (strcmp(argv[1], "--at") == 0 || strcmp(argv[1], "--in") == 0)) {
+                // Schedules a publish for later; it is tracked as a command once it fires
+                int absolute = (strcmp(argv[1], "--at") == 0);
+                long delay = absolute ? 0 : scheduler_parse_duration(argv[2]);
+                time_t fire_at = absolute ? scheduler_parse_at(argv[2]) : (delay >= 0) ? time(NULL) + delay : -1;
+
+                size_t payload_len = 0;
+                for (int i = 4; i < argc; i++) payload_len += strlen(argv[i]) + 1;
+                char* payload = calloc(payload_len + 1, 1);
+                for (int i = 4; i < argc; i++) {
+                    strcat(payload, argv[i]);
+                    if (i < argc - 1) strcat(payload, " ");
+                }
 
-            } else if (strcmp(argv[0], "PUBLISH") == 0 && argc >= 3) {
-                // Publishes to a specific channel
-                char topic[64];
-                char payload[800] = {0};
-                strncpy(topic, argv[1], 63);
-
-                for (int i = 2; i < argc; i++) {
+                if (fire_at <= 0) {
+                    printf("%s Error: '%s' is not a valid %s.\n", output_header, argv[2], absolute ? "time" : "duration");
+                } else if (topic_has_wildcard(argv[3])) {
+                    printf("%s Error: Cannot publish to a wildcard topic.\n", output_header);
+                } else {
+                    long long id = scheduler_add(fire_at, NULL, argv[3], payload, strlen(payload));
+                    if (id) {
+                        char when[32];
+                        struct tm tm;
+                        localtime_r(&fire_at, &tm);
+                        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+                        printf("%s Publish #%lld to topic '%s' scheduled for %s.\n", output_header, id, argv[3], when);
+                    } else {
+                        printf("%s Error: Could not schedule the publish.\n", output_header);
+                    }
+                }
+                free(payload);
+
+            } else if (strcmp(argv[0], "SCHEDULED") == 0 && argc == 1) {
+                scheduler_print_status();
+
+            } else if (strcmp(argv[0], "UNSCHEDULE") == 0 && argc == 2) {
+                long long id = strtoll(argv[1][0] == '#' ? argv[1] + 1 : argv[1], NULL, 10);
+                if (scheduler_cancel(id)) printf("%s Scheduled publish #%lld cancelled.\n", output_header, id);
+                else printf("%s Error: No scheduled publish #%lld.\n", output_header, id);
+
+            } else if (strcmp(argv[0], "PUBLISH") == 0 && argc >= 3 &&
+                       (strcmp(argv[1], "--") != 0 || argc >= 4)) {
+                // Publishes to a specific channel, optionally keeping the message as the topic's retained value.
+                // "--" ends the options, for a topic that starts with "--".
+                int retain = (strcmp(argv[1], "--retain") == 0);
+                int first = (retain || strcmp(argv[1], "--") == 0) ? 2 : 1;
+                char topic[64] = {0};
+                strncpy(topic, argv[first], 63);
+
+                // Size the payload to the arguments so long messages are not truncated
+                size_t payload_len = 0;
+                for (int i = first + 1; i < argc; i++) payload_len += strlen(argv[i]) + 1;
+                char* payload = calloc(payload_len + 1, 1);
+
+                for (int i = first + 1; i < argc; i++) {
                     strcat(payload, argv[i]);
                     if (i < argc - 1) strcat(payload, " ");
                 }
 
-                pubsub_publish(topic, payload);
-                printf("%s Message dispatched to topic '%s'\n", output_header, topic);
+                if (topic_has_wildcard(topic)) {
+                    printf("%s Error: Cannot publish to a wildcard topic.\n", output_header);
+                } else if (retain && topic[0] == '@') {
+                    printf("%s Error: Direct targets cannot retain messages.\n", output_header);
+                } else if (retain && payload[0] == '\0') {
+                    retained_store(topic, payload, 0);
+                    printf("%s Retained message cleared on topic '%s'\n", output_header, topic);
+                } else if (payload[0] != '\0') {
+                    // Tracked as a command, so the agents' reports can be followed with RESULTS
+                    if (retain) retained_store(topic, payload, strlen(payload));
+                    unsigned long long cid = tracker_begin(topic, payload);
+                    int reached = pubsub_publish_tracked(topic, payload, strlen(payload), cid);
+                    printf("%s Message dispatched to topic '%s'%s as command #%llu (%d host%s)\n", output_header, topic,
+                           retain ? " (retained)" : "", cid, reached, reached == 1 ? "" : "s");
+                }
+                free(payload);
 
             } else if (strcmp(argv[0], "SET") == 0 && argc >= 4) {
                 // Sets a specific key/value pair in the database
@@ -227,6 +298,13 @@ void* admin_cli_thread(void* arg) {
                 }
 
                 db_set_device_state(target_host, key, value);
+
+                // A connected host's cached copy feeds its subscription filters
+                Client* c = client_get_and_lock_by_hostname(target_host);
+                if (c) {
+                    client_state_set(c, key, value);
+                    client_unlock(c);
+                }
                 printf("%s State manually updated for %s.\n", output_header, target_host);
 
             } else if (strcmp(argv[0], "GET") == 0 && argc == 3) {
@@ -241,19 +319,34 @@ void* admin_cli_thread(void* arg) {
                     printf("%s State key '%s' not found for '%s'.\n",output_header, key, target_host);
                 }
 
-            } else if (strcmp(argv[0], "SUBSCRIBE") == 0 && argc == 3) {
-                // Subscribes a specific hostname to a topic
-                char target_host[128], topic[64] = {0};
+            } else if (strcmp(argv[0], "SUBSCRIBE") == 0 && argc >= 3) {
+                // Subscribes a specific hostname to a topic, optionally with a content filter
+                char target_host[128], topic[64] = {0}, filter_expr[512] = {0};
                 strncpy(target_host, argv[1], 127);
                 strncpy(topic, argv[2], 63);
 
+                for (int i = 3; i < argc && strlen(filter_expr) + strlen(argv[i]) + 2 < sizeof(filter_expr); i++) {
+                    strcat(filter_expr, argv[i]);
+                    if (i < argc - 1) strcat(filter_expr, " ");
+                }
+                SubFilter* filter = (argc > 3) ? filter_compile(filter_expr) : NULL;
+
                 // Leverage Map to look up hostname queries directly
                 Client* c = client_get_and_lock_by_hostname(target_host);
-                if (c) {
-                    int fd = c->fd;
+                if (argc > 3 && filter == NULL) {
                     client_unlock(c);
-                    pubsub_subscribe(fd, topic);
+                    printf("%s Error: '%s' is not a valid subscription filter.\n", output_header, filter_expr);
+                } else if (c) {
+                    conn_handle_t handle = c->handle;
+                    client_unlock(c);
+                    if (!pubsub_subscribe(handle, topic, filter)) {
+                        printf("%s Error: '%s' is not a valid topic filter.\n", output_header, topic);
+                    } else if ((c = client_get_and_lock(handle)) != NULL) {
+                        pubsub_deliver_retained(c, topic);
+                        client_unlock(c);
+                    }
                 } else {
+                    filter_unref(filter);
                     printf("%s Error: No active connection found under %s.\n", output_header, target_host);
                 }
 
@@ -265,13 +358,65 @@ void* admin_cli_thread(void* arg) {
 
                 Client* c = client_get_and_lock_by_hostname(target_host);
                 if (c) {
-                    int fd = c->fd;
+                    conn_handle_t handle = c->handle;
                     client_unlock(c);
-                    pubsub_unsubscribe(fd, topic);
+                    pubsub_unsubscribe(handle, topic);
                 } else {
                     printf("%s Error: No active connection found under %s.\n", output_header, target_host);
                 }
 
+            } else if (strcmp(argv[0], "RESULTS") == 0 && argc <= 2) {
+                // Live results of the recent commands, or the full breakdown of one of them
+                if (argc == 1) {
+                    tracker_print_summary();
+                } else if (!tracker_print_command(strtoull(argv[1][0] == '#' ? argv[1] + 1 : argv[1], NULL, 10))) {
+                    printf("%s Error: Command %s is not being tracked.\n", output_header, argv[1]);
+                }
+
+            } else if (strcmp(argv[0], "ROLLOUT") == 0 && argc == 2 && strcmp(argv[1], "STATUS") == 0) {
+                rollout_print_status();
+
+            } else if (strcmp(argv[0], "ROLLOUT") == 0 && argc == 3 &&
+                       (strcmp(argv[1], "HALT") == 0 || strcmp(argv[1], "RESUME") == 0)) {
+                int id = atoi(argv[2][0] == '#' ? argv[2] + 1 : argv[2]);
+                int halt = (strcmp(argv[1], "HALT") == 0);
+                if (halt ? rollout_halt(id) : rollout_resume(id)) {
+                    printf("%s Rollout #%d %s.\n", output_header, id, halt ? "halted" : "resumed");
+                } else {
+                    printf("%s Error: No %s rollout #%d.\n", output_header, halt ? "running" : "halted", id);
+                }
+
+            } else if (strcmp(argv[0], "ROLLOUT") == 0 && argc >= 3) {
+                // Releases a command in waves; the rollout thread takes it from here
+                int wave = 0, concurrency = 0, max_failures = -1;
+                int first = 1;
+                while (first + 1 < argc && strncmp(argv[first], "--", 2) == 0) {
+                    if (strcmp(argv[first], "--wave") == 0) wave = atoi(argv[first + 1]);
+                    else if (strcmp(argv[first], "--concurrency") == 0) concurrency = atoi(argv[first + 1]);
+                    else if (strcmp(argv[first], "--max-failures") == 0) max_failures = atoi(argv[first + 1]);
+                    else break;
+                    first += 2;
+                }
+
+                size_t payload_len = 0;
+                for (int i = first + 1; i < argc; i++) payload_len += strlen(argv[i]) + 1;
+                char* payload = calloc(payload_len + 1, 1);
+                for (int i = first + 1; i < argc; i++) {
+                    strcat(payload, argv[i]);
+                    if (i < argc - 1) strcat(payload, " ");
+                }
+
+                if (first + 1 >= argc || strncmp(argv[first], "--", 2) == 0) {
+                    printf("%s Error: Usage: ROLLOUT [--wave N] [--concurrency N] [--max-failures PCT] <topic> <\"message\">\n", output_header);
+                } else if (topic_has_wildcard(argv[first])) {
+                    printf("%s Error: Cannot publish to a wildcard topic.\n", output_header);
+                } else {
+                    int id = rollout_start(argv[first], payload, wave, concurrency, max_failures);
+                    if (id) printf("%s Rollout #%d of '%s' started.\n", output_header, id, argv[first]);
+                    else printf("%s Error: Nobody is subscribed to '%s'.\n", output_header, argv[first]);
+                }
+                free(payload);
+
             } else if (strcmp(argv[0], "EXIT") == 0) {
                 printf("Shutting down CLI...\n");
                 free_tokens(argv, argc);
@@ -280,11 +425,17 @@ void* admin_cli_thread(void* arg) {
 
             } else {
                 printf("%s Invalid command or missing arguments.\n", output_header);
-                printf("  Usage: PUBLISH <topic> <\"message\">\n");
-                printf("  Usage: SUBSCRIBE <hostname> <topic>\n");
+                printf("  Usage: PUBLISH [--retain] [--] <topic> <\"message\">\n");
+                printf("  Usage: PUBLISH --at <unix-time|HH:MM|YYYY-MM-DDTHH:MM[:SS]> <topic> <\"message\">\n");
+                printf("  Usage: PUBLISH --in <duration, e.g. 90s|15m|1h30m> <topic> <\"message\">\n");
+                printf("  Usage: SCHEDULED | UNSCHEDULE <id>\n");
+                printf("  Usage: SUBSCRIBE <hostname> <topic> [verb=A,B] [key=value]\n");
                 printf("  Usage: UNSUBSCRIBE <hostname> <topic>\n");
                 printf("  Usage: SET <hostname> <key> <\"value\">\n");
                 printf("  Usage: GET <hostname> <key>\n");
+                printf("  Usage: RESULTS [command-id]\n");
+                printf("  Usage: ROLLOUT [--wave N] [--concurrency N] [--max-failures PCT] <topic> <\"message\">\n");
+                printf("  Usage: ROLLOUT STATUS | HALT <id> | RESUME <id>\n");
                 printf("  Usage: STATUS\n");
                 printf("  Usage: EXIT\n");
             }
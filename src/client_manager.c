@@ -1,23 +1,228 @@
 #include "client_manager.h"
 #include "auth.h"
-#include "hash.h"
+#include "epoch.h"
 #include "pubsub.h"
+#include "qos.h"
+#include "reactor.h"
+#include "rbac.h"
+#include "db.h"
+#include "frame.h"
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
-
-static HashTable* clients_map;
-static pthread_rwlock_t clients_rwlock;
+#include <fnmatch.h>
+#include <sys/socket.h>
+
+#define FD_TABLE_INITIAL_SIZE 1024
+
+// The registry is read without any lock. Readers look clients up inside an epoch section (see epoch.h); writers,
+// serialised by registry_lock, publish every change with a single atomic store and retire what it replaced.
+// A removed Client is torn down under its own lock and only freed once no reader can still hold a pointer to it,
+// so a reader that locks a client it found checks that it has not been torn down meanwhile (see lock_live).
+
+// Primary lookup: clients are indexed directly by fd. The table is grown by copying, never in place.
+typedef struct {
+    int size;
+    _Atomic(Client*) slots[];
+} FdTable;
+
+// One authenticated hostname (one entry per hostname, newest connection wins)
+typedef struct {
+    char* hostname;
+    conn_handle_t handle;
+} HostEntry;
+
+// Secondary lookup: hostnames kept in sorted order, so that a name or a host glob resolves with a binary search.
+// Each change publishes a new copy; the copies share the hostname strings, which are retired with their entry.
+typedef struct {
+    int count;
+    HostEntry entries[];
+} HostIndex;
+
+static _Atomic(FdTable*) fd_table;
+static _Atomic(HostIndex*) host_index;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// A generation counter per fd slot, so stale handles never match a new connection (registry_lock guards them)
+static uint32_t* fd_generations = NULL;
+static int fd_generations_size = 0;
+
+static size_t outbound_max_bytes = 4 * 1024 * 1024;
+static int outbound_max_messages = 10000;
+static int outbound_default_policy = OVERFLOW_DROP_NEWEST;
+
+static int idle_timeout = 60;
+static int handshake_timeout = 10;
 
 void client_manager_init() {
-    clients_map = create_table();
-    pthread_rwlock_init(&clients_rwlock, NULL);
+    FdTable* table = calloc(1, sizeof(FdTable) + sizeof(_Atomic(Client*)) * FD_TABLE_INITIAL_SIZE);
+    table->size = FD_TABLE_INITIAL_SIZE;
+    atomic_store(&fd_table, table);
+    atomic_store(&host_index, calloc(1, sizeof(HostIndex)));
+
+    fd_generations_size = FD_TABLE_INITIAL_SIZE;
+    fd_generations = calloc(fd_generations_size, sizeof(uint32_t));
+}
+
+void client_manager_set_limits(size_t max_bytes, int max_messages, int default_policy) {
+    outbound_max_bytes = max_bytes;
+    outbound_max_messages = max_messages;
+    if (default_policy != OVERFLOW_UNSET) outbound_default_policy = default_policy;
 }
 
-void client_add(int fd, int conn_type) {
+void client_manager_set_timeouts(int idle_seconds, int handshake_seconds) {
+    if (idle_seconds > 0) idle_timeout = idle_seconds;
+    if (handshake_seconds > 0) handshake_timeout = handshake_seconds;
+}
+
+// Runs on the timer thread. Activity does not touch the timer: last_activity is only compared here, and the timer
+// is pushed out to the new deadline if it has moved, so expiry costs nothing for clients that stay busy.
+// The Client stays allocated while this runs, because client_remove() cancels the timer synchronously.
+static void client_deadline_expired(Timer* t) {
+    conn_handle_t handle = ((Client*)((char*)t - offsetof(Client, deadline)))->handle;
+    Client* c = client_get_and_lock(handle);
+    if (c == NULL) return;
+
+    // Until the handshake completes, last_activity is still the time the connection was accepted
+    int authenticated = (c->auth_status == AUTH_SUCCESS);
+    time_t next = c->last_activity + (authenticated ? idle_timeout : handshake_timeout);
+    time_t now = time(NULL);
+
+    const char* reason = NULL;
+    if (c->evicted) reason = "evicted";
+    else if (now >= next) reason = authenticated ? "inactive" : "handshake timed out";
+
+    if (reason) {
+        client_unlock(c);
+        printf("\n[Timeout] Closing FD %d (%s)...\nadmq> ", HANDLE_FD(handle), reason);
+        fflush(stdout);
+        pubsub_unsubscribe_all(handle);
+        client_remove(handle);
+        return;
+    }
+
+    // Once per idle period, a connection with nothing buffered gives its input memory back until its next read
+    if (!c->in_worker) linebuf_shrink(&c->in);
+
+    time_t qos_due = c->qos ? qos_redeliver_expired(c, now) : 0;
+    if (qos_due && qos_due < next) next = qos_due;
+    timer_add_before(t, next); // A QoS 1 send may have armed it sooner meanwhile
+    client_unlock(c);
+}
+
+// Grows the fd table so that fd is a valid index (registry_lock must be held)
+static FdTable* fd_table_reserve(int fd) {
+    FdTable* table = atomic_load(&fd_table);
+    if (fd < table->size) return table;
+
+    int new_size = table->size;
+    while (new_size <= fd) new_size *= 2;
+
+    FdTable* grown = calloc(1, sizeof(FdTable) + sizeof(_Atomic(Client*)) * new_size);
+    grown->size = new_size;
+    for (int i = 0; i < table->size; i++) atomic_store_explicit(&grown->slots[i], atomic_load(&table->slots[i]),
+                                                                memory_order_relaxed);
+    atomic_store(&fd_table, grown);
+    epoch_retire(table, free);
+
+    fd_generations = realloc(fd_generations, sizeof(uint32_t) * new_size);
+    memset(&fd_generations[fd_generations_size], 0, sizeof(uint32_t) * (new_size - fd_generations_size));
+    fd_generations_size = new_size;
+    return grown;
+}
+
+// Position of the first entry not less than key
+static int host_index_lower_bound(const HostIndex* index, const char* key, int key_len) {
+    int lo = 0, hi = index->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strncmp(index->entries[mid].hostname, key, key_len) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// A new index with room for count entries, filled in by the caller
+static HostIndex* host_index_alloc(int count) {
+    HostIndex* index = malloc(sizeof(HostIndex) + sizeof(HostEntry) * count);
+    index->count = count;
+    return index;
+}
+
+// Points hostname at handle, inserting it if new (registry_lock must be held)
+static void host_index_set(const char* hostname, conn_handle_t handle) {
+    HostIndex* old = atomic_load(&host_index);
+    int len = strlen(hostname) + 1; // Compare the terminator too, so only the exact name is found
+    int pos = host_index_lower_bound(old, hostname, len);
+    int exists = (pos < old->count && strcmp(old->entries[pos].hostname, hostname) == 0);
+
+    HostIndex* index = host_index_alloc(old->count + !exists);
+    memcpy(index->entries, old->entries, sizeof(HostEntry) * pos);
+    if (exists) {
+        index->entries[pos] = (HostEntry){ old->entries[pos].hostname, handle };
+        memcpy(&index->entries[pos + 1], &old->entries[pos + 1], sizeof(HostEntry) * (old->count - pos - 1));
+    } else {
+        index->entries[pos] = (HostEntry){ strdup(hostname), handle };
+        memcpy(&index->entries[pos + 1], &old->entries[pos], sizeof(HostEntry) * (old->count - pos));
+    }
+
+    atomic_store(&host_index, index);
+    epoch_retire(old, free);
+}
+
+// Drops hostname from the index if it still belongs to handle (registry_lock must be held)
+static void host_index_remove(const char* hostname, conn_handle_t handle) {
+    HostIndex* old = atomic_load(&host_index);
+    int pos = host_index_lower_bound(old, hostname, strlen(hostname) + 1);
+    if (pos >= old->count || old->entries[pos].handle != handle || strcmp(old->entries[pos].hostname, hostname) != 0) {
+        return;
+    }
+
+    HostIndex* index = host_index_alloc(old->count - 1);
+    memcpy(index->entries, old->entries, sizeof(HostEntry) * pos);
+    memcpy(&index->entries[pos], &old->entries[pos + 1], sizeof(HostEntry) * (old->count - pos - 1));
+
+    atomic_store(&host_index, index);
+    epoch_retire(old->entries[pos].hostname, free);
+    epoch_retire(old, free);
+}
+
+// Looks up a client by handle (inside an epoch section, or with registry_lock held)
+static Client* lookup_handle(conn_handle_t handle) {
+    FdTable* table = atomic_load(&fd_table);
+    int fd = HANDLE_FD(handle);
+    if (fd < 0 || fd >= table->size) return NULL;
+
+    Client* c = atomic_load(&table->slots[fd]);
+    if (c && c->generation != HANDLE_GEN(handle)) return NULL;
+    return c;
+}
+
+// Locks a client found inside an epoch section. Returns NULL if client_remove() has torn it down in the meantime;
+// otherwise it stays registered until the lock is released, so the caller may leave its section.
+static Client* lock_live(Client* c) {
+    if (c == NULL) return NULL;
+    pthread_mutex_lock(&c->lock);
+    if (c->state == STATE_DISCONNECTED) {
+        pthread_mutex_unlock(&c->lock);
+        return NULL;
+    }
+    return c;
+}
+
+static void client_free(void* ptr) {
+    Client* c = ptr;
+    linebuf_free(&c->in); // Only now: a worker may still be running a line out of it (see process_buffered_lines)
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
+
+conn_handle_t client_add(int fd, int conn_type, int epoll_fd) {
     Client* c = malloc(sizeof(Client));
     c->fd = fd;
     c->state = STATE_IDLE;
@@ -26,39 +231,60 @@ void client_add(int fd, int conn_type) {
     c->ssl = NULL;
     c->hostname[0] = '\0';
     c->last_activity = time(NULL);
-    c->buffer_len = 0;
+    memset(&c->deadline, 0, sizeof(c->deadline));
+    c->deadline.fn = client_deadline_expired;
+    c->epoll_fd = epoll_fd;
+    linebuf_init(&c->in);
+    outq_init(&c->out);
+    c->corked = 0;
+    c->write_failed = 0;
+    c->in_worker = 0;
+    c->rerun = 0;
+    c->evicted = 0;
+    c->binary = 0;
+    c->dropped_messages = 0;
+    c->device_state = NULL;
+    c->device_state_count = 0;
+    c->replay = NULL;
+    c->qos = NULL;
     pthread_mutex_init(&c->lock, NULL);
 
-    char fd_key[32];
-    snprintf(fd_key, sizeof(fd_key), "fd:%d", fd);
+    pthread_mutex_lock(&registry_lock);
+    FdTable* table = fd_table_reserve(fd);
 
-    pthread_rwlock_wrlock(&clients_rwlock);
-    set(clients_map, fd_key, c);
-    pthread_rwlock_unlock(&clients_rwlock);
-}
+    // Generation 0 is reserved for listening sockets, so a live client handle is never zero
+    uint32_t generation = (fd_generations[fd] + 1) & 0x7FFFFFFFu;
+    if (generation == 0) generation = 1;
+    fd_generations[fd] = generation;
+
+    c->generation = generation;
+    c->handle = HANDLE_MAKE(fd, generation);
+    atomic_store(&table->slots[fd], c);
+    pthread_mutex_unlock(&registry_lock);
 
-void client_remove(int fd) {
-    char fd_key[32];
-    snprintf(fd_key, sizeof(fd_key), "fd:%d", fd);
+    // A connection that never completes its handshake is closed at this deadline
+    timer_add_in(&c->deadline, handshake_timeout);
 
+    return c->handle;
+}
+
+void client_remove(conn_handle_t handle) {
     Client *c = NULL;
 
-    pthread_rwlock_wrlock(&clients_rwlock);
-    c = (Client*)get(clients_map, fd_key);
+    pthread_mutex_lock(&registry_lock);
+    c = lookup_handle(handle);
     if (c) {
-        del(clients_map, fd_key);
-        // Only remove the hostname map if it actively points to THIS client (prevents breaking reconnects)
-        if (strlen(c->hostname) > 0) {
-            Client* current_c = (Client*)get(clients_map, c->hostname);
-            if (current_c == c) {
-                del(clients_map, c->hostname);
-            }
-        }
+        atomic_store(&atomic_load(&fd_table)->slots[c->fd], NULL);
+        // Only drops the hostname if it actively points to THIS client (prevents breaking reconnects)
+        if (strlen(c->hostname) > 0) host_index_remove(c->hostname, c->handle);
     }
-    pthread_rwlock_unlock(&clients_rwlock);
+    pthread_mutex_unlock(&registry_lock);
 
     if (c) {
-        // Safe destruction: wait for any active worker threads using c->lock to finish
+        // Not under c->lock, which the timer callback takes; it can no longer find c, so it does not re-arm
+        timer_cancel_sync(&c->deadline);
+
+        // Wait for any thread that found c before it was unpublished to finish with it
         pthread_mutex_lock(&c->lock);
 
         if (c->ssl) {
@@ -71,147 +297,249 @@ void client_remove(int fd) {
             c->fd = -1;
         }
         c->state = STATE_DISCONNECTED;
+        outq_free(&c->out);
+        pubsub_replay_cancel(c, NULL);
+        qos_detach(c);
+        for (int i = 0; i < c->device_state_count; i++) {
+            free(c->device_state[i].key);
+            free(c->device_state[i].value);
+        }
+        free(c->device_state);
 
+        // Readers that still hold a pointer see STATE_DISCONNECTED once they get the lock; the memory goes when
+        // the last of them has left its epoch section
         pthread_mutex_unlock(&c->lock);
-        pthread_mutex_destroy(&c->lock);
-        free(c);
+        epoch_retire(c, client_free);
     }
 }
 
-Client* client_get_and_lock_by_fd(int fd) {
-    char key[32];
-    snprintf(key, sizeof(key), "fd:%d", fd);
+Client* client_get_and_lock(conn_handle_t handle) {
+    epoch_enter();
+    Client* c = lock_live(lookup_handle(handle));
+    epoch_exit();
+    return c;
+}
 
-    pthread_rwlock_rdlock(&clients_rwlock);
-    Client* c = (Client*)get(clients_map, key);
-    if (c) {
-        pthread_mutex_lock(&c->lock); // Acquire the individual mutex before releasing the overarching read lock
-    }
-    pthread_rwlock_unlock(&clients_rwlock);
+Client* client_get_and_lock_by_fd(int fd) {
+    epoch_enter();
+    FdTable* table = atomic_load(&fd_table);
+    Client* c = lock_live((fd >= 0 && fd < table->size) ? atomic_load(&table->slots[fd]) : NULL);
+    epoch_exit();
     return c;
 }
 
 Client* client_get_and_lock_by_hostname(const char* hostname) {
-    pthread_rwlock_rdlock(&clients_rwlock);
-    Client* c = (Client*)get(clients_map, hostname);
-    if (c) {
-        pthread_mutex_lock(&c->lock);
-    }
-    pthread_rwlock_unlock(&clients_rwlock);
+    epoch_enter();
+    HostIndex* index = atomic_load(&host_index);
+    int pos = host_index_lower_bound(index, hostname, strlen(hostname) + 1);
+    int found = (pos < index->count && strcmp(index->entries[pos].hostname, hostname) == 0);
+    Client* c = found ? lock_live(lookup_handle(index->entries[pos].handle)) : NULL;
+    epoch_exit();
     return c;
 }
 
+int client_match_hostnames(const char* pattern, conn_handle_t** handles) {
+    // Only names starting with the pattern's literal prefix can match, and they are contiguous in the index
+    int prefix_len = strcspn(pattern, "*?[");
+    int matched = 0;
+    int capacity = 0;
+    *handles = NULL;
+
+    epoch_enter();
+    HostIndex* index = atomic_load(&host_index);
+    for (int i = host_index_lower_bound(index, pattern, prefix_len); i < index->count; i++) {
+        if (strncmp(index->entries[i].hostname, pattern, prefix_len) != 0) break;
+        if (fnmatch(pattern, index->entries[i].hostname, 0) != 0) continue;
+
+        if (matched == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            *handles = realloc(*handles, sizeof(conn_handle_t) * capacity);
+        }
+        (*handles)[matched++] = index->entries[i].handle;
+    }
+    epoch_exit();
+    return matched;
+}
+
 void client_unlock(Client* c) {
     if (c) {
         pthread_mutex_unlock(&c->lock);
     }
 }
 
-void client_set_hostname(int fd, const char* hostname) {
-    char fd_key[32];
-    snprintf(fd_key, sizeof(fd_key), "fd:%d", fd);
-
-    pthread_rwlock_wrlock(&clients_rwlock);
-    Client *c = (Client*)get(clients_map, fd_key);
-    if (c) {
-        set(clients_map, hostname, c); // Implement secondary lookup using the hostname
-    }
-    pthread_rwlock_unlock(&clients_rwlock);
+typedef struct {
+    StateEntry* rows;
+    int count;
+} StateRows;
+
+static void collect_state_row(void* ctx, const char* key, const char* value) {
+    StateRows* loaded = ctx;
+    loaded->rows = realloc(loaded->rows, sizeof(StateEntry) * (loaded->count + 1));
+    loaded->rows[loaded->count].key = strdup(key);
+    loaded->rows[loaded->count].value = strdup(value);
+    loaded->count++;
+}
 
+void client_set_hostname(conn_handle_t handle, const char* hostname) {
+    // The name is written under registry_lock as well, so client_remove() always sees the one it was indexed by
+    pthread_mutex_lock(&registry_lock);
+    Client *c = lookup_handle(handle);
     if (c) {
         pthread_mutex_lock(&c->lock);
         strncpy(c->hostname, hostname, sizeof(c->hostname) - 1);
         pthread_mutex_unlock(&c->lock);
+        host_index_set(hostname, handle);
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    // Read the rows before taking the client lock, so SQLite never runs under it
+    StateRows loaded = { NULL, 0 };
+    db_load_device_state(hostname, collect_state_row, &loaded);
+
+    c = client_get_and_lock(handle);
+    if (c) {
+        for (int i = 0; i < loaded.count; i++) client_state_set(c, loaded.rows[i].key, loaded.rows[i].value);
+    }
+    client_unlock(c);
+
+    for (int i = 0; i < loaded.count; i++) {
+        free(loaded.rows[i].key);
+        free(loaded.rows[i].value);
     }
+    free(loaded.rows);
 }
 
-void client_buffer_append(Client* c, const char* data, int len) {
-    if (c->buffer_len + len >= sizeof(c->buffer)) {
-        printf("Warning: Client %d buffer overflow. Dropping data.\n", c->fd);
-        c->buffer_len = 0;
-        return;
+const char* client_state_get(Client* c, const char* key) {
+    for (int i = 0; i < c->device_state_count; i++) {
+        if (strcmp(c->device_state[i].key, key) == 0) return c->device_state[i].value;
+    }
+    return NULL;
+}
+
+void client_state_set(Client* c, const char* key, const char* value) {
+    for (int i = 0; i < c->device_state_count; i++) {
+        if (strcmp(c->device_state[i].key, key) == 0) {
+            free(c->device_state[i].value);
+            c->device_state[i].value = strdup(value);
+            return;
+        }
+    }
+    c->device_state = realloc(c->device_state, sizeof(StateEntry) * (c->device_state_count + 1));
+    c->device_state[c->device_state_count].key = strdup(key);
+    c->device_state[c->device_state_count].value = strdup(value);
+    c->device_state_count++;
+}
+
+void client_flush(Client* c) {
+    if (c->ssl == NULL || c->write_failed || (!outq_pending(&c->out) && c->replay == NULL)) return;
+
+    int status = outq_flush(&c->out, c->ssl);
+    while (status == OUTQ_DRAINED && c->replay) {
+        // A replayed backlog is queued a stretch at a time, as fast as the socket takes it
+        pubsub_replay_pump(c);
+        status = outq_flush(&c->out, c->ssl);
+    }
+    if (status == OUTQ_BLOCKED) {
+        // Let the owning reactor tell us when the socket drains
+        reactor_rearm(c->epoll_fd, c->fd, c->handle, 1);
+    } else if (status == OUTQ_ERROR) {
+        // Wake the owner with a hang-up so it tears the connection down through the normal path
+        c->write_failed = 1;
+        shutdown(c->fd, SHUT_RDWR);
     }
-    memcpy(&c->buffer[c->buffer_len], data, len);
-    c->buffer_len += len;
-    c->buffer[c->buffer_len] = '\0';
 }
 
-int client_buffer_extract_line(Client* c, char* out_message, int max_len) {
-    if (c->buffer_len == 0) return 0;
+void client_send(Client* c, const char* data, int len) {
+    if (c->ssl == NULL || c->write_failed) return;
 
-    char* newline_ptr = strchr(c->buffer, '\n');
-    if (newline_ptr == NULL) return 0;
+    outq_push(&c->out, data, len);
+    if (!c->corked) client_flush(c);
+}
 
-    int msg_len = newline_ptr - c->buffer;
-    int copy_len = (msg_len < max_len - 1) ? msg_len : max_len - 1;
-    strncpy(out_message, c->buffer, copy_len);
-    out_message[copy_len] = '\0';
+int client_deliver(Client* c, Message* msg, const char* topic) {
+    if (c->ssl == NULL || c->write_failed) return 0;
+
+    int len = msg->len;
+    OutQueue* q = &c->out;
+    // QoS 1 deliveries held for a free window slot are as good as queued, so they count against the same limits
+    size_t held_bytes;
+    int held = qos_held(c, &held_bytes);
+    if (q->bytes + held_bytes + len > outbound_max_bytes || q->frames + held + 1 > outbound_max_messages) {
+        // Only subscribers that are already backed up pay for the policy lookup
+        int policy = rbac_overflow_policy(c->hostname, topic);
+        if (policy == OVERFLOW_UNSET) policy = outbound_default_policy;
+
+        if (policy == OVERFLOW_DISCONNECT) {
+            printf("\n[Backpressure] Disconnecting slow consumer %s (%zu bytes queued)...\nadmq> ",
+                   c->hostname, q->bytes);
+            fflush(stdout);
+            c->dropped_messages++;
+            c->evicted = 1;
+            c->write_failed = 1;
+            shutdown(c->fd, SHUT_RDWR);
+            timer_add_before(&c->deadline, 0); // Swept on the next tick if the owner does not get to it first
+            return 0;
+        }
 
-    int bytes_to_remove = msg_len + 1;
-    int remaining_bytes = c->buffer_len - bytes_to_remove;
+        if (policy == OVERFLOW_DROP_OLDEST) {
+            size_t keep_bytes = (outbound_max_bytes > held_bytes + len) ? outbound_max_bytes - held_bytes - len : 0;
+            int keep_frames = (outbound_max_messages > held + 1) ? outbound_max_messages - held - 1 : 0;
+            c->dropped_messages += outq_drop_oldest(q, keep_bytes, keep_frames);
+        }
 
-    if (remaining_bytes > 0) {
-        memmove(c->buffer, &c->buffer[bytes_to_remove], remaining_bytes);
+        // drop-newest, or drop-oldest that could not make enough room
+        if (q->bytes + held_bytes + len > outbound_max_bytes || q->frames + held + 1 > outbound_max_messages) {
+            c->dropped_messages++;
+            return 0;
+        }
     }
-    c->buffer_len = remaining_bytes;
-    c->buffer[remaining_bytes] = '\0';
 
+    if (c->qos) {
+        // The window is bookkept under the lock already held here, so QoS 1 adds no lock to the fanout
+        qos_send(c, msg);
+    } else {
+        outq_push_msg(q, c->binary ? msg_binary(msg) : msg);
+    }
+    if (!c->corked) client_flush(c);
     return 1;
 }
 
-void client_manager_sweep_inactive(int timeout_seconds) {
-    time_t now = time(NULL);
-    int fds_to_remove[100];
-    int remove_count = 0;
-
-    pthread_rwlock_rdlock(&clients_rwlock);
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        Entry *entry = clients_map->buckets[i];
-        while (entry != NULL) {
-            // Check only the network fd mapping bounds to iterate unique devices
-            if (strncmp(entry->key, "fd:", 3) == 0) {
-                Client *c = (Client*)entry->value;
-                pthread_mutex_lock(&c->lock);
-                if (c->state == STATE_IDLE && (now - c->last_activity > timeout_seconds)) {
-                    fds_to_remove[remove_count++] = c->fd;
-                }
-                pthread_mutex_unlock(&c->lock);
-            }
-            entry = entry->next;
-        }
+void client_send_str(Client* c, const char* str) {
+    if (!c->binary) {
+        client_send(c, str, strlen(str));
+        return;
     }
-    pthread_rwlock_unlock(&clients_rwlock);
 
-    for (int i = 0; i < remove_count; i++) {
-        printf("\n[Heartbeat] Sweeping disconnected FD %d...\nadmq> ", fds_to_remove[i]);
-        fflush(stdout);
-        pubsub_unsubscribe_all(fds_to_remove[i]);
-        client_remove(fds_to_remove[i]);
-    }
+    size_t len = strcspn(str, "\n");
+    char stack[512];
+    size_t total = frame_len(frame_str_len(len));
+    char* frame = (total <= sizeof(stack)) ? stack : malloc(total);
+    frame_put_str(frame_put_header(frame, OP_REPLY, 0, frame_str_len(len)), str, len);
+    client_send(c, frame, total);
+    if (frame != stack) free(frame);
 }
 
 void client_manager_print_status() {
     printf("\n=== CONNECTED AGENTS ===\n");
     int count = 0;
 
-    pthread_rwlock_rdlock(&clients_rwlock);
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        Entry *entry = clients_map->buckets[i];
-        while (entry != NULL) {
-            if (strncmp(entry->key, "fd:", 3) == 0) {
-                Client *c = (Client*)entry->value;
-                pthread_mutex_lock(&c->lock);
-
-                char* name = (strlen(c->hostname) > 0) ? c->hostname : "Unknown/Pending";
-                printf("  [FD: %d] %s\n", c->fd, name);
-                count++;
-
-                pthread_mutex_unlock(&c->lock);
-            }
-            entry = entry->next;
-        }
+    epoch_enter();
+    FdTable* table = atomic_load(&fd_table);
+    for (int fd = 0; fd < table->size; fd++) {
+        Client *c = lock_live(atomic_load(&table->slots[fd]));
+        if (c == NULL) continue;
+
+        char* name = (strlen(c->hostname) > 0) ? c->hostname : "Unknown/Pending";
+        printf("  [FD: %d] %s (queued: %zu bytes / %d msgs, dropped: %lu",
+               c->fd, name, c->out.bytes, c->out.frames, c->dropped_messages);
+        size_t held_bytes;
+        if (c->qos) printf(", QoS 1 unacked: %d, held: %d", qos_unacked(c), qos_held(c, &held_bytes));
+        printf(")\n");
+        count++;
+
+        pthread_mutex_unlock(&c->lock);
     }
-    pthread_rwlock_unlock(&clients_rwlock);
+    epoch_exit();
 
     if (count == 0) printf("  No agents connected.\n");
     printf("========================\n");
@@ -7,41 +7,108 @@
 #define CONN_VAULT 0
 #define CONN_LOBBY 1
 
+#include "linebuf.h"
+#include "outbound.h"
+#include "timer.h"
+
 #include <openssl/ssl.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <time.h>
 
+// Connection handles travel in epoll_event.data.u64 and through the task ring without any allocation.
+// The low 32 bits carry the fd and the upper bits a per-fd generation, so an event queued for a
+// connection that has since been removed can never be applied to a new connection reusing its fd.
+typedef uint64_t conn_handle_t;
+
+#define HANDLE_LOBBY_BIT (1ULL << 63)
+#define HANDLE_MAKE(fd, gen) (((uint64_t)(gen) << 32) | (uint32_t)(fd))
+#define HANDLE_FD(h) ((int)((h) & 0xFFFFFFFFu))
+#define HANDLE_GEN(h) ((uint32_t)(((h) >> 32) & 0x7FFFFFFFu))
+
+// One cached device_state row
+typedef struct {
+    char* key;
+    char* value;
+} StateEntry;
+
 // Client struct holding all individual device information and its internal mutex
 typedef struct Client {
     int fd;
+    uint32_t generation;
+    conn_handle_t handle;
     int state;
     int conn_type;
     int auth_status;
     SSL* ssl;
     char hostname[128];
     time_t last_activity;
+    Timer deadline; // Fires at the handshake, idle or QoS 1 ack deadline, whichever is next (see client_manager.c)
+    int epoll_fd; // The epoll set that owns this connection (used to re-arm it)
+
+    LineBuffer in; // Received bytes not yet run as commands; released while the connection is quiet
+
+    OutQueue out;     // Pending outbound frames, flushed by the owner when the socket is writable
+    int corked;       // Set while a worker is processing this client's input; sends are batched until it finishes
+    int write_failed; // The transport is broken; the owning worker removes the client on its next event
+    int in_worker;    // A worker is processing this client's input (possibly with the lock dropped to publish)
+    int rerun;        // Another event arrived meanwhile; the active worker drains again before finishing
+    int evicted;      // Disconnected by the slow-consumer policy; swept through client_remove
+    int binary;       // Switched to binary framing by "HELLO BINARY" (see frame.h)
+    unsigned long dropped_messages; // Pub/sub deliveries discarded by the slow-consumer policy
 
-    char buffer[2048];
-    int buffer_len;
+    // The host's device_state rows, loaded at authentication and kept in step with SET, so subscription
+    // filters can be evaluated during fanout without touching the database
+    StateEntry* device_state;
+    int device_state_count;
+
+    struct Replay* replay; // Durable-topic backlogs still streaming to this client (see pubsub_subscribe_from)
+    struct QosWindow* qos; // Unacknowledged deliveries once the client has enabled QoS 1 (see qos.h), else NULL
 
     pthread_mutex_t lock;
 } Client;
 
 void client_manager_init();
-void client_add(int fd, int conn_type);
-void client_remove(int fd);
 
-// These retrieve a pointer to the client and automatically lock c->lock for safe multithreaded operations
+// Per-connection outbound limits for pub/sub deliveries, and the overflow policy used when neither
+// the topic nor the subscriber's role configures one (see rbac_overflow_policy)
+void client_manager_set_limits(size_t max_bytes, int max_messages, int default_policy);
+// Seconds a connection may stay silent once authenticated, and may take to complete its TLS handshake
+void client_manager_set_timeouts(int idle_seconds, int handshake_seconds);
+// Registers a new connection and returns the handle its epoll registration should carry
+conn_handle_t client_add(int fd, int conn_type, int epoll_fd);
+void client_remove(conn_handle_t handle);
+
+// These retrieve a pointer to the client and automatically lock c->lock for safe multithreaded operations.
+// The lookup itself takes no registry lock, so connects and disconnects never stall it.
+Client* client_get_and_lock(conn_handle_t handle); // Returns NULL if the handle's generation is stale
 Client* client_get_and_lock_by_fd(int fd);
 Client* client_get_and_lock_by_hostname(const char* hostname);
+
+// Collects the handles of every authenticated client whose hostname matches a glob such as "desktop-*".
+// Returns the number of matches; *handles is malloc'd (NULL when there are none) and owned by the caller.
+int client_match_hostnames(const char* pattern, conn_handle_t** handles);
 void client_unlock(Client* c);
 
-void client_set_hostname(int fd, const char* hostname);
-void client_manager_sweep_inactive(int timeout_seconds);
+// Records the authenticated hostname and loads the host's device_state into the client
+void client_set_hostname(conn_handle_t handle, const char* hostname);
+
+// Cached device_state access (should only be called when c->lock is held)
+const char* client_state_get(Client* c, const char* key);
+void client_state_set(Client* c, const char* key, const char* value);
 void client_manager_print_status();
 
-// Buffer management (should only be called when c->lock is held)
-void client_buffer_append(Client* c, const char* data, int len);
-int client_buffer_extract_line(Client* c, char* out_message, int max_len);
+// Outbound data (should only be called when c->lock is held). client_send() never blocks: data is queued and
+// flushed right away unless the client is corked; whatever the socket refuses waits for EPOLLOUT.
+// client_send() queues the bytes as they are; client_send_str() queues a reply line, as an OP_REPLY frame once the
+// client has switched to binary framing.
+void client_send(Client* c, const char* data, int len);
+void client_send_str(Client* c, const char* str);
+void client_flush(Client* c);
+
+// Queues a pub/sub delivery subject to the outbound limits and the topic/role overflow policy.
+// The message is shared, not copied: the queue takes a reference. Returns 1 if the message was queued,
+// 0 if it was dropped or the subscriber was disconnected.
+int client_deliver(Client* c, Message* msg, const char* topic);
 
 #endif
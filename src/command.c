@@ -0,0 +1,92 @@
+#include "command.h"
+#include "frame.h"
+
+#include <string.h>
+
+typedef struct {
+    const char* name;
+    int op;
+    int min_words; // Counting the verb itself
+    int max_words;
+} Verb;
+
+enum { V_SET, V_GET, V_PING, V_PONG, V_ACK, V_QOS, V_SUBSCRIBE, V_UNSUBSCRIBE, V_PUBLISH, V_HELLO, V_COUNT };
+
+// The text protocol's verbs and how many words each takes (3 means a payload follows the topic)
+static const Verb verbs[V_COUNT] = {
+    [V_SET] = { "SET", OP_SET, 3, 3 },
+    [V_GET] = { "GET", OP_GET, 2, 2 },
+    [V_PING] = { "PING", OP_PING, 1, 3 },
+    [V_PONG] = { "PONG", OP_PONG, 1, 3 },
+    [V_ACK] = { "ACK", OP_ACK, 2, 2 },
+    [V_QOS] = { "QOS", OP_QOS, 2, 2 },
+    [V_SUBSCRIBE] = { "SUBSCRIBE", OP_SUBSCRIBE, 2, 3 },
+    [V_UNSUBSCRIBE] = { "UNSUBSCRIBE", OP_UNSUBSCRIBE, 2, 3 },
+    [V_PUBLISH] = { "PUBLISH", OP_PUBLISH, 3, 3 },
+    [V_HELLO] = { "HELLO", VERB_HELLO, 2, 2 },
+};
+
+// Length and first character (the second for PING/PONG) single out the only verb the word can be; one memcmp
+// then confirms it. A verb filed under the wrong length never matches, so a mistake here rejects, never misroutes.
+static const Verb* verb_lookup(const char* word, size_t len) {
+    int i;
+    switch (len) {
+    case 3:
+        switch (word[0]) {
+        case 'S': i = V_SET; break;
+        case 'G': i = V_GET; break;
+        case 'A': i = V_ACK; break;
+        case 'Q': i = V_QOS; break;
+        default: return NULL;
+        }
+        break;
+    case 4: i = (word[1] == 'I') ? V_PING : V_PONG; break;
+    case 5: i = V_HELLO; break;
+    case 7: i = V_PUBLISH; break;
+    case 9: i = V_SUBSCRIBE; break;
+    case 11: i = V_UNSUBSCRIBE; break;
+    default: return NULL;
+    }
+
+    const Verb* v = &verbs[i];
+    return (memcmp(v->name, word, len) == 0 && v->name[len] == '\0') ? v : NULL;
+}
+
+// The blanks sscanf's "%s" stops at
+static inline int is_blank(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+char* command_word(char** p, size_t* len) {
+    char* s = *p;
+    while (is_blank(*s)) s++;
+    if (*s == '\0') {
+        *p = s;
+        *len = 0;
+        return NULL;
+    }
+
+    char* e = s;
+    while (*e != '\0' && !is_blank(*e)) e++;
+    *len = e - s;
+    if (*e != '\0') *e++ = '\0';
+    while (is_blank(*e)) e++;
+    *p = e;
+    return s;
+}
+
+int command_parse_line(char* line, CommandLine* out) {
+    char* p = line;
+    size_t verb_len, topic_len;
+    char* verb = command_word(&p, &verb_len);
+    char* topic = verb ? command_word(&p, &topic_len) : NULL;
+
+    out->verb = verb ? verb : p;
+    out->topic = topic ? topic : p; // Both empty strings at the end of the line
+    out->rest = p;
+    out->words = (verb != NULL) + (topic != NULL) + (topic != NULL && *p != '\0');
+
+    const Verb* v = verb ? verb_lookup(verb, verb_len) : NULL;
+    out->op = (v && out->words >= v->min_words && out->words <= v->max_words) ? v->op : -1;
+    return out->op;
+}
@@ -0,0 +1,30 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stddef.h>
+
+// Tokenizer and verb lookup for the text protocol. A command line is split in place: its words are NUL-terminated
+// where they lie in the connection's input buffer and handed out as pointers, never copied.
+// Verbs are found by a switch on their length and first character in command.c, so a line costs one branch and one
+// memcmp whatever the verb. A new verb is a row in the table there, a case in verb_lookup() and a handler in worker.c.
+
+// Text-only verb that switches a connection's framing; every other verb shares its OP_* code with the frames
+// that carry the same command (see frame.h)
+#define VERB_HELLO 0x7F
+
+typedef struct {
+    int op;        // OP_* or VERB_HELLO; -1 if the verb is unknown or has the wrong number of words
+    int words;     // 1 to 3: the verb, a topic, and whatever follows it
+    char* verb;
+    char* topic;   // "" if absent
+    char* rest;    // Everything after the topic and the blanks that follow it; "" if absent
+} CommandLine;
+
+// Splits off the next blank-delimited word at *p: skips leading blanks, NUL-terminates the word in place and leaves
+// *p at the start of whatever follows it (or the end of the line). Returns NULL and sets *len to 0 if nothing is left.
+char* command_word(char** p, size_t* len);
+
+// Tokenizes a line in place and looks up its verb. Returns out->op.
+int command_parse_line(char* line, CommandLine* out);
+
+#endif
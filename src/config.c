@@ -19,10 +19,34 @@ int config_load(const char* filepath, BrokerConfig* config) {
     // Set safe defaults just in case the file is missing or a key is deleted
     config->vault_port = 35565;
     config->lobby_port = 35566;
+    config->idle_timeout = 60;
+    config->handshake_timeout = 10;
+    config->max_line_bytes = 65536;
     strncpy(config->cert_path, "certs/server.crt", 255);
     strncpy(config->key_path, "certs/server.key", 255);
     strncpy(config->ca_path, "certs/ca.crt", 255);
     strncpy(config->db_path, "broker_audit.db", 255);
+    config->reactor_threads = 0;
+    config->queue_capacity = 4096;
+    config->edge_triggered = 0;
+    config->outbound_max_bytes = 4 * 1024 * 1024;
+    config->outbound_max_messages = 10000;
+    strncpy(config->overflow_policy, "drop-newest", sizeof(config->overflow_policy) - 1);
+    config->durable_topics[0] = '\0';
+    strncpy(config->log_dir, "topic_log", sizeof(config->log_dir) - 1);
+    config->log_segment_bytes = 16 * 1024 * 1024;
+    config->log_retention_seconds = 7 * 24 * 3600;
+    config->log_retention_bytes = 256 * 1024 * 1024;
+    config->retained_max_bytes = 16 * 1024 * 1024;
+    config->qos_window = 256;
+    config->qos_ack_timeout = 30;
+    config->qos_session_expiry = 300;
+    config->command_history = 64;
+    config->command_deadline = 300;
+    config->rollout_wave = 100;
+    config->rollout_concurrency = 100;
+    config->rollout_max_failures = 10;
+    config->rollout_host_timeout = 300;
 
     FILE* file = fopen(filepath, "r");
     if (!file) {
@@ -55,10 +79,34 @@ int config_load(const char* filepath, BrokerConfig* config) {
             // Map keys to our struct
             if (strcmp(key, "vault_port") == 0) config->vault_port = atoi(val);
             else if (strcmp(key, "lobby_port") == 0) config->lobby_port = atoi(val);
+            else if (strcmp(key, "idle_timeout") == 0) config->idle_timeout = atoi(val);
+            else if (strcmp(key, "handshake_timeout") == 0) config->handshake_timeout = atoi(val);
+            else if (strcmp(key, "max_line_bytes") == 0) config->max_line_bytes = atol(val);
             else if (strcmp(key, "cert_path") == 0) strncpy(config->cert_path, val, sizeof(config->cert_path) - 1);
             else if (strcmp(key, "key_path") == 0) strncpy(config->key_path, val, sizeof(config->key_path) - 1);
             else if (strcmp(key, "ca_path") == 0) strncpy(config->ca_path, val, sizeof(config->ca_path) - 1);
             else if (strcmp(key, "db_path") == 0) strncpy(config->db_path, val, sizeof(config->db_path) - 1);
+            else if (strcmp(key, "reactor_threads") == 0) config->reactor_threads = atoi(val);
+            else if (strcmp(key, "queue_capacity") == 0) config->queue_capacity = atoi(val);
+            else if (strcmp(key, "edge_triggered") == 0) config->edge_triggered = atoi(val);
+            else if (strcmp(key, "outbound_max_bytes") == 0) config->outbound_max_bytes = atol(val);
+            else if (strcmp(key, "outbound_max_messages") == 0) config->outbound_max_messages = atoi(val);
+            else if (strcmp(key, "overflow_policy") == 0) strncpy(config->overflow_policy, val, sizeof(config->overflow_policy) - 1);
+            else if (strcmp(key, "durable_topics") == 0) strncpy(config->durable_topics, val, sizeof(config->durable_topics) - 1);
+            else if (strcmp(key, "log_dir") == 0) strncpy(config->log_dir, val, sizeof(config->log_dir) - 1);
+            else if (strcmp(key, "log_segment_bytes") == 0) config->log_segment_bytes = atol(val);
+            else if (strcmp(key, "log_retention_seconds") == 0) config->log_retention_seconds = atol(val);
+            else if (strcmp(key, "log_retention_bytes") == 0) config->log_retention_bytes = atol(val);
+            else if (strcmp(key, "retained_max_bytes") == 0) config->retained_max_bytes = atol(val);
+            else if (strcmp(key, "qos_window") == 0) config->qos_window = atoi(val);
+            else if (strcmp(key, "qos_ack_timeout") == 0) config->qos_ack_timeout = atoi(val);
+            else if (strcmp(key, "qos_session_expiry") == 0) config->qos_session_expiry = atoi(val);
+            else if (strcmp(key, "command_history") == 0) config->command_history = atoi(val);
+            else if (strcmp(key, "command_deadline") == 0) config->command_deadline = atoi(val);
+            else if (strcmp(key, "rollout_wave") == 0) config->rollout_wave = atoi(val);
+            else if (strcmp(key, "rollout_concurrency") == 0) config->rollout_concurrency = atoi(val);
+            else if (strcmp(key, "rollout_max_failures") == 0) config->rollout_max_failures = atoi(val);
+            else if (strcmp(key, "rollout_host_timeout") == 0) config->rollout_host_timeout = atoi(val);
         }
     }
 
@@ -5,10 +5,34 @@
 typedef struct {
     int vault_port;
     int lobby_port;
+    int idle_timeout;      // Seconds an authenticated connection may stay silent before it is closed
+    int handshake_timeout; // Seconds a vault connection may take to complete its TLS handshake
+    long max_line_bytes;   // Longest command line a connection may send (its input buffer grows up to this)
     char cert_path[256];
     char key_path[256];
     char ca_path[256];
     char db_path[256];
+    int reactor_threads; // 0 = single acceptor feeding the worker pool, N = sharded SO_REUSEPORT reactors
+    int queue_capacity;  // Slots in the lock-free task ring (rounded up to a power of two)
+    int edge_triggered;  // 1 = EPOLLET vault registrations that never need re-arming
+    long outbound_max_bytes;     // Per-connection limit on queued pub/sub bytes
+    int outbound_max_messages;   // Per-connection limit on queued pub/sub messages
+    char overflow_policy[32];    // Default slow-consumer policy: drop-newest, drop-oldest or disconnect
+    char durable_topics[256];    // Comma-separated topic filters whose publishes are logged to disk
+    char log_dir[256];           // Where durable topic logs live, one subdirectory per topic
+    long log_segment_bytes;      // Size of each mapped log segment file
+    long log_retention_seconds;  // Segments older than this are deleted (0 = no age limit)
+    long log_retention_bytes;    // Per-topic cap on logged bytes (0 = no size limit)
+    long retained_max_bytes;     // Memory budget for retained messages (the rest wait in the database)
+    int qos_window;              // QoS 1 messages in flight per client before further deliveries are dropped
+    int qos_ack_timeout;         // Seconds without an ACK before a QoS 1 message is redelivered
+    int qos_session_expiry;      // Seconds a disconnected host's unacknowledged messages are kept for it
+    int command_history;         // Tracked CLI commands kept for RESULTS
+    int command_deadline;        // Seconds after which hosts that have not reported a command count as missing
+    int rollout_wave;            // Default number of hosts released together by a ROLLOUT
+    int rollout_concurrency;     // Default limit on released hosts that have not reported yet
+    int rollout_max_failures;    // Default failure percentage above which a rollout halts
+    int rollout_host_timeout;    // Seconds a released host may take to report before it counts as failed
 } BrokerConfig;
 
 // Parses the INI file and populates the struct.
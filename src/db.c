@@ -46,6 +46,33 @@ void db_init(const char* filepath) {
         exit(1);
     }
 
+    // Retained messages, one row per topic
+    const char *sql_create_retained_table =
+        "CREATE TABLE IF NOT EXISTS retained_messages ("
+        "topic TEXT PRIMARY KEY, "
+        "message TEXT, "
+        "updated DATETIME DEFAULT CURRENT_TIMESTAMP);";
+
+    if (sqlite3_exec(db, sql_create_retained_table, 0, 0, &err_msg) != SQLITE_OK) {
+        fprintf(stderr, "SQL error (retained_messages): %s\n", err_msg);
+        sqlite3_free(err_msg);
+        exit(1);
+    }
+
+    const char *sql_create_scheduled_table =
+        "CREATE TABLE IF NOT EXISTS scheduled_publishes ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "fire_at INTEGER, "
+        "sender TEXT, "
+        "topic TEXT, "
+        "message TEXT);";
+
+    if (sqlite3_exec(db, sql_create_scheduled_table, 0, 0, &err_msg) != SQLITE_OK) {
+        fprintf(stderr, "SQL error (scheduled_publishes): %s\n", err_msg);
+        sqlite3_free(err_msg);
+        exit(1);
+    }
+
 }
 
 void db_set_device_state(const char* hostname, const char* key, const char* value) {
@@ -98,7 +125,27 @@ int db_get_device_state(const char* hostname, const char* key, char* out_value,
     return found;
 }
 
+void db_load_device_state(const char* hostname, void (*fn)(void* ctx, const char* key, const char* value), void* ctx) {
+    if (!db) return;
 
+    pthread_mutex_lock(&db_lock);
+
+    const char *sql = "SELECT key, value FROM device_state WHERE hostname = ?;";
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, hostname, -1, SQLITE_STATIC);
+
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const unsigned char* key = sqlite3_column_text(stmt, 0);
+            const unsigned char* val = sqlite3_column_text(stmt, 1);
+            if (key && val) fn(ctx, (const char*)key, (const char*)val);
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    pthread_mutex_unlock(&db_lock);
+}
 
 void db_log_message(const char* sender, const char* topic, const char* message) {
     if (!db) return;
@@ -130,6 +177,136 @@ void db_log_message(const char* sender, const char* topic, const char* message)
     pthread_mutex_unlock(&db_lock);
 }
 
+void db_set_retained(const char* topic, const char* payload, size_t payload_len) {
+    if (!db) return;
+    pthread_mutex_lock(&db_lock);
+
+    const char *sql = "INSERT OR REPLACE INTO retained_messages (topic, message, updated) VALUES (?, ?, CURRENT_TIMESTAMP);";
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, topic, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, payload, (int)payload_len, SQLITE_STATIC);
+
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            fprintf(stderr, "Failed to store retained message: %s\n", sqlite3_errmsg(db));
+        }
+        sqlite3_finalize(stmt);
+    }
+    pthread_mutex_unlock(&db_lock);
+}
+
+void db_delete_retained(const char* topic) {
+    if (!db) return;
+    pthread_mutex_lock(&db_lock);
+
+    const char *sql = "DELETE FROM retained_messages WHERE topic = ?;";
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, topic, -1, SQLITE_STATIC);
+
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            fprintf(stderr, "Failed to clear retained message: %s\n", sqlite3_errmsg(db));
+        }
+        sqlite3_finalize(stmt);
+    }
+    pthread_mutex_unlock(&db_lock);
+}
+
+void db_load_retained(const char* topic, void (*fn)(void* ctx, const char* topic, const char* payload, size_t payload_len),
+                      void* ctx) {
+    if (!db) return;
+
+    pthread_mutex_lock(&db_lock);
+
+    const char *sql = topic ? "SELECT topic, message FROM retained_messages WHERE topic = ?;"
+                            : "SELECT topic, message FROM retained_messages ORDER BY updated, rowid;";
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (topic) sqlite3_bind_text(stmt, 1, topic, -1, SQLITE_STATIC);
+
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const unsigned char* name = sqlite3_column_text(stmt, 0);
+            const unsigned char* payload = sqlite3_column_text(stmt, 1);
+            if (name && payload) fn(ctx, (const char*)name, (const char*)payload, sqlite3_column_bytes(stmt, 1));
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    pthread_mutex_unlock(&db_lock);
+}
+
+long long db_add_scheduled(long long fire_at, const char* sender, const char* topic, const char* message,
+                           size_t message_len) {
+    if (!db) return 0;
+    long long id = 0;
+    pthread_mutex_lock(&db_lock);
+
+    const char *sql = "INSERT INTO scheduled_publishes (fire_at, sender, topic, message) VALUES (?, ?, ?, ?);";
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, fire_at);
+        sqlite3_bind_text(stmt, 2, sender, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 3, topic, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 4, message, (int)message_len, SQLITE_STATIC);
+
+        if (sqlite3_step(stmt) == SQLITE_DONE) {
+            id = sqlite3_last_insert_rowid(db);
+        } else {
+            fprintf(stderr, "Failed to store scheduled publish: %s\n", sqlite3_errmsg(db));
+        }
+        sqlite3_finalize(stmt);
+    }
+    pthread_mutex_unlock(&db_lock);
+    return id;
+}
+
+void db_delete_scheduled(long long id) {
+    if (!db) return;
+    pthread_mutex_lock(&db_lock);
+
+    const char *sql = "DELETE FROM scheduled_publishes WHERE id = ?;";
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, id);
+
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            fprintf(stderr, "Failed to remove scheduled publish: %s\n", sqlite3_errmsg(db));
+        }
+        sqlite3_finalize(stmt);
+    }
+    pthread_mutex_unlock(&db_lock);
+}
+
+void db_load_scheduled(void (*fn)(void* ctx, long long id, long long fire_at, const char* sender,
+                                  const char* topic, const char* message, size_t message_len), void* ctx) {
+    if (!db) return;
+
+    pthread_mutex_lock(&db_lock);
+
+    const char *sql = "SELECT id, fire_at, sender, topic, message FROM scheduled_publishes ORDER BY fire_at, id;";
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const unsigned char* sender = sqlite3_column_text(stmt, 2);
+            const unsigned char* topic = sqlite3_column_text(stmt, 3);
+            const unsigned char* message = sqlite3_column_text(stmt, 4);
+            if (sender && topic && message) {
+                fn(ctx, sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1), (const char*)sender,
+                   (const char*)topic, (const char*)message, sqlite3_column_bytes(stmt, 4));
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    pthread_mutex_unlock(&db_lock);
+}
+
 void db_close() {
     if (db) {
         sqlite3_close(db);
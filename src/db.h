@@ -1,6 +1,8 @@
 #ifndef DB_H
 #define DB_H
 
+#include <stddef.h>
+
 // Opens the database file and creates the table if it doesn't exist
 void db_init(const char* filepath);
 
@@ -16,4 +18,25 @@ void db_set_device_state(const char* hostname, const char* key, const char* valu
 // Retrieves a value from the state table. Returns 1 if found, 0 if not.
 int db_get_device_state(const char* hostname, const char* key, char* out_value, int max_len);
 
+// Calls fn for every state row of a host
+void db_load_device_state(const char* hostname, void (*fn)(void* ctx, const char* key, const char* value), void* ctx);
+
+// Retained messages: the latest payload kept for a topic (an empty payload is never stored). Payloads and scheduled
+// messages are stored with their length, as a binary-framed client may have sent NULs in them.
+void db_set_retained(const char* topic, const char* payload, size_t payload_len);
+void db_delete_retained(const char* topic);
+
+// Calls fn for the retained message of one topic, or of every topic (oldest first) when topic is NULL
+void db_load_retained(const char* topic, void (*fn)(void* ctx, const char* topic, const char* payload, size_t payload_len),
+                      void* ctx);
+
+// Scheduled publishes (see scheduler.h). Returns the new row's id, or 0 if it could not be stored.
+long long db_add_scheduled(long long fire_at, const char* sender, const char* topic, const char* message,
+                           size_t message_len);
+void db_delete_scheduled(long long id);
+
+// Calls fn for every scheduled publish, earliest first
+void db_load_scheduled(void (*fn)(void* ctx, long long id, long long fire_at, const char* sender,
+                                  const char* topic, const char* message, size_t message_len), void* ctx);
+
 #endif
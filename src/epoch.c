@@ -0,0 +1,124 @@
+#include "epoch.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Retired objects are reclaimed in batches once this many are waiting
+#define EPOCH_RECLAIM_THRESHOLD 64
+
+typedef struct EpochRecord {
+    _Atomic uint64_t epoch;  // Global epoch observed when the outermost section was entered
+    _Atomic int active;
+    int depth;               // Nesting level, only touched by the owning thread
+    struct EpochRecord* next;
+} EpochRecord;
+
+typedef struct Retired {
+    void* ptr;
+    void (*free_fn)(void*);
+    uint64_t epoch;
+    struct Retired* next;
+} Retired;
+
+static _Atomic uint64_t global_epoch = 1;
+
+// Every thread that ever entered a section. Records are never unlinked (the broker's threads are long-lived).
+static _Atomic(EpochRecord*) records = NULL;
+static __thread EpochRecord* self = NULL;
+
+static pthread_mutex_t limbo_lock = PTHREAD_MUTEX_INITIALIZER;
+static Retired* limbo = NULL;
+static int limbo_count = 0;
+
+static EpochRecord* self_record() {
+    if (self == NULL) {
+        self = calloc(1, sizeof(EpochRecord));
+        EpochRecord* head = atomic_load(&records);
+        do {
+            self->next = head;
+        } while (!atomic_compare_exchange_weak(&records, &head, self));
+    }
+    return self;
+}
+
+void epoch_enter() {
+    EpochRecord* r = self_record();
+    if (r->depth++ > 0) return;
+
+    // Announce before reading any shared pointer; both stores are sequentially consistent
+    atomic_store(&r->active, 1);
+    atomic_store(&r->epoch, atomic_load(&global_epoch));
+}
+
+void epoch_exit() {
+    EpochRecord* r = self;
+    if (--r->depth > 0) return;
+    atomic_store(&r->active, 0);
+}
+
+// Moves the global epoch forward by one if no active reader lags behind it
+static void try_advance() {
+    uint64_t current = atomic_load(&global_epoch);
+    for (EpochRecord* r = atomic_load(&records); r != NULL; r = r->next) {
+        if (atomic_load(&r->active) && atomic_load(&r->epoch) != current) return;
+    }
+    atomic_compare_exchange_strong(&global_epoch, &current, current + 1);
+}
+
+// Detaches every retired object that no reader can reach any more (limbo_lock must be held).
+// Readers are at most one epoch behind the global one, so an object retired two epochs ago is unreachable.
+static Retired* collect_safe() {
+    try_advance();
+    uint64_t current = atomic_load(&global_epoch);
+
+    Retired* safe = NULL;
+    Retired** link = &limbo;
+    while (*link) {
+        Retired* item = *link;
+        if (item->epoch + 2 <= current) {
+            *link = item->next;
+            item->next = safe;
+            safe = item;
+            limbo_count--;
+        } else {
+            link = &item->next;
+        }
+    }
+    return safe;
+}
+
+// Runs the free functions outside limbo_lock so they may retire further objects themselves
+static void free_retired(Retired* list) {
+    while (list) {
+        Retired* next = list->next;
+        list->free_fn(list->ptr);
+        free(list);
+        list = next;
+    }
+}
+
+void epoch_retire(void* ptr, void (*free_fn)(void*)) {
+    Retired* item = malloc(sizeof(Retired));
+    item->ptr = ptr;
+    item->free_fn = free_fn;
+    item->epoch = atomic_load(&global_epoch);
+
+    Retired* safe = NULL;
+    pthread_mutex_lock(&limbo_lock);
+    item->next = limbo;
+    limbo = item;
+    if (++limbo_count >= EPOCH_RECLAIM_THRESHOLD) safe = collect_safe();
+    pthread_mutex_unlock(&limbo_lock);
+
+    free_retired(safe);
+}
+
+void epoch_reclaim() {
+    pthread_mutex_lock(&limbo_lock);
+    Retired* safe = collect_safe();
+    pthread_mutex_unlock(&limbo_lock);
+
+    free_retired(safe);
+}
@@ -0,0 +1,19 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+// Epoch-based reclamation for read-mostly structures that are replaced by copy-on-write.
+// Readers bracket their accesses with epoch_enter()/epoch_exit() and never block; writers unlink an
+// object and hand it to epoch_retire(), which frees it once no reader can still be looking at it.
+// Sections nest, and each thread registers itself on its first epoch_enter().
+
+void epoch_enter();
+void epoch_exit();
+
+// Schedules free_fn(ptr) for after every reader that might have seen ptr has left its section
+void epoch_retire(void* ptr, void (*free_fn)(void*));
+
+// Advances the global epoch if every active reader has caught up, then frees whatever is now safe.
+// Called periodically by the heartbeat so retired objects do not linger when writes are rare.
+void epoch_reclaim();
+
+#endif
@@ -0,0 +1,95 @@
+#include "filter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void free_filter(SubFilter* f) {
+    for (int i = 0; i < f->clause_count; i++) {
+        free(f->clauses[i].field);
+        for (int j = 0; j < f->clauses[i].value_count; j++) free(f->clauses[i].values[j]);
+        free(f->clauses[i].values);
+    }
+    free(f->clauses);
+    free(f->source);
+    free(f);
+}
+
+// Parses "field=v1,v2" into a clause. Returns 0 if the clause is malformed.
+static int parse_clause(char* text, FilterClause* clause) {
+    char* equals = strchr(text, '=');
+    if (equals == NULL || equals == text || equals[1] == '\0') return 0;
+    *equals = '\0';
+
+    clause->field = (strcmp(text, "verb") == 0) ? NULL : strdup(text);
+    clause->value_count = 0;
+    clause->values = NULL;
+
+    char* saveptr;
+    for (char* value = strtok_r(equals + 1, ",", &saveptr); value; value = strtok_r(NULL, ",", &saveptr)) {
+        clause->values = realloc(clause->values, sizeof(char*) * (clause->value_count + 1));
+        clause->values[clause->value_count++] = strdup(value);
+    }
+    return clause->value_count > 0;
+}
+
+SubFilter* filter_compile(const char* expr) {
+    SubFilter* f = calloc(1, sizeof(SubFilter));
+    atomic_init(&f->refs, 1);
+    f->source = strdup(expr);
+
+    char* text = strdup(expr);
+    char* saveptr;
+    for (char* token = strtok_r(text, " \t", &saveptr); token; token = strtok_r(NULL, " \t", &saveptr)) {
+        f->clauses = realloc(f->clauses, sizeof(FilterClause) * (f->clause_count + 1));
+        FilterClause* clause = &f->clauses[f->clause_count];
+        memset(clause, 0, sizeof(FilterClause));
+        f->clause_count++;
+
+        if (!parse_clause(token, clause)) {
+            free(text);
+            free_filter(f);
+            return NULL;
+        }
+        if (clause->field) f->needs_state = 1;
+    }
+    free(text);
+
+    if (f->clause_count == 0) {
+        free_filter(f);
+        return NULL;
+    }
+    return f;
+}
+
+SubFilter* filter_ref(SubFilter* f) {
+    atomic_fetch_add_explicit(&f->refs, 1, memory_order_relaxed);
+    return f;
+}
+
+void filter_unref(SubFilter* f) {
+    if (f && atomic_fetch_sub_explicit(&f->refs, 1, memory_order_acq_rel) == 1) free_filter(f);
+}
+
+static int clause_accepts(const FilterClause* clause, const char* value, int len) {
+    for (int j = 0; j < clause->value_count; j++) {
+        if ((int)strlen(clause->values[j]) == len && memcmp(clause->values[j], value, len) == 0) return 1;
+    }
+    return 0;
+}
+
+int filter_match_verb(const SubFilter* f, const char* verb, int verb_len) {
+    for (int i = 0; i < f->clause_count; i++) {
+        if (f->clauses[i].field == NULL && !clause_accepts(&f->clauses[i], verb, verb_len)) return 0;
+    }
+    return 1;
+}
+
+int filter_match_state(const SubFilter* f, Client* c) {
+    for (int i = 0; i < f->clause_count; i++) {
+        if (f->clauses[i].field == NULL) continue;
+
+        const char* value = client_state_get(c, f->clauses[i].field);
+        if (value == NULL || !clause_accepts(&f->clauses[i], value, strlen(value))) return 0;
+    }
+    return 1;
+}
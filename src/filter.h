@@ -0,0 +1,37 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "client_manager.h"
+
+#include <stdatomic.h>
+
+// A content filter attached to a subscription, e.g. "verb=UPDATE,REBOOT os=linux".
+// Clauses are separated by spaces and must all hold; each names a field and the comma-separated values
+// it may take. The "verb" field is the first word of the published payload; any other field is looked up
+// in the subscriber's device_state (as written with SET).
+typedef struct {
+    char* field; // NULL for the verb clause
+    int value_count;
+    char** values;
+} FilterClause;
+
+typedef struct {
+    _Atomic int refs;
+    char* source;       // The expression as written, for STATUS
+    int clause_count;
+    FilterClause* clauses;
+    int needs_state;    // At least one clause reads device_state, so the subscriber must be locked to evaluate it
+} SubFilter;
+
+// Compiles an expression once at subscribe time. Returns NULL if it is malformed.
+SubFilter* filter_compile(const char* expr);
+SubFilter* filter_ref(SubFilter* f);
+void filter_unref(SubFilter* f);
+
+// Checks only the verb clauses, so a publisher can skip a subscriber without locking it
+int filter_match_verb(const SubFilter* f, const char* verb, int verb_len);
+
+// Checks the device_state clauses against a subscriber (c->lock must be held)
+int filter_match_state(const SubFilter* f, Client* c);
+
+#endif
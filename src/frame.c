@@ -0,0 +1,94 @@
+#include "frame.h"
+
+#include <string.h>
+
+// Reads a varint from [*p, end). Returns 1 and advances *p, 0 if it runs past end, -1 if it is over 10 bytes long.
+static int read_varint(const char** p, const char* end, uint64_t* v) {
+    const unsigned char* q = (const unsigned char*)*p;
+    uint64_t value = 0;
+    for (int shift = 0; shift < 70; shift += 7) {
+        if ((const char*)q >= end) return 0;
+        unsigned char byte = *q++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *p = (const char*)q;
+            *v = value;
+            return 1;
+        }
+    }
+    return -1;
+}
+
+long frame_parse(const char* buf, size_t avail, size_t max_len, Frame* f) {
+    if (avail < 3) return 0;
+
+    const char* p = buf + 2;
+    uint64_t body_len;
+    int status = read_varint(&p, buf + avail, &body_len);
+    if (status < 0) return -1;
+    if (status == 0) return (avail >= FRAME_HEADER_MAX) ? -1 : 0;
+
+    size_t header_len = p - buf;
+    if (body_len > max_len || header_len + body_len > max_len) return -1;
+    if (avail < header_len + body_len) return 0;
+
+    f->opcode = (unsigned char)buf[0];
+    f->flags = (unsigned char)buf[1];
+    f->body = p;
+    f->body_len = body_len;
+    return (long)(header_len + body_len);
+}
+
+int frame_get_varint(const char** p, const char* end, uint64_t* v) {
+    return read_varint(p, end, v) == 1;
+}
+
+int frame_get_bytes(const char** p, const char* end, const char** s, size_t* len) {
+    const char* q = *p;
+    uint64_t n;
+    if (read_varint(&q, end, &n) != 1) return 0;
+    if (n >= (uint64_t)(end - q) || q[n] != '\0') return 0; // Room for the bytes and the terminator that ends them
+
+    *s = q;
+    *len = n;
+    *p = q + n + 1;
+    return 1;
+}
+
+int frame_get_str(const char** p, const char* end, const char** s, size_t* len) {
+    const char* q = *p;
+    if (!frame_get_bytes(&q, end, s, len) || memchr(*s, '\0', *len) != NULL) return 0; // A C string must not end early
+    *p = q;
+    return 1;
+}
+
+size_t frame_varint_len(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+char* frame_put_varint(char* out, uint64_t v) {
+    while (v >= 0x80) {
+        *out++ = (char)((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    *out++ = (char)v;
+    return out;
+}
+
+char* frame_put_str(char* out, const char* s, size_t len) {
+    out = frame_put_varint(out, len);
+    memcpy(out, s, len);
+    out[len] = '\0';
+    return out + len + 1;
+}
+
+char* frame_put_header(char* out, int opcode, int flags, size_t body_len) {
+    *out++ = (char)opcode;
+    *out++ = (char)flags;
+    return frame_put_varint(out, body_len);
+}
@@ -0,0 +1,76 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary framing for vault connections, shared by the broker and the agent.
+// A connection speaks the newline-delimited text protocol until the client sends "HELLO BINARY" and the broker
+// answers "HELLO BINARY"; every byte after those two lines is a frame, in both directions. Clients that never say
+// HELLO (scripts/connect, older agents) keep the text protocol.
+//
+//   frame   := opcode:u8 flags:u8 body_len:varint body[body_len]
+//   varint  := unsigned LEB128, at most 10 bytes
+//   str     := len:varint bytes[len] 0x00
+//   bytes   := len:varint bytes[len] 0x00
+//
+// Strings carry their terminator on the wire, so the receiver uses them in place as C strings once the frame is
+// checked; they may hold any byte but NUL, newlines included. Payloads are bytes: laid out the same way, but any
+// byte may appear, so they are handled by length. Each field is listed below in the order it appears.
+
+#define FRAME_HELLO "HELLO BINARY"
+
+// Client to broker
+#define OP_SET 0x01         // str key, str value
+#define OP_GET 0x02         // str key
+#define OP_PING 0x03        // (empty)
+#define OP_PONG 0x04        // (empty); also the broker's answer to OP_PING
+#define OP_ACK 0x05         // varint seq
+#define OP_QOS 0x06         // varint level
+#define OP_SUBSCRIBE 0x07   // str topic, varint from (0 = live only, N = replay from offset N - 1), str filter
+#define OP_UNSUBSCRIBE 0x08 // str topic
+#define OP_PUBLISH 0x09     // str topic, bytes payload, [varint fire_at (unix seconds) if FRAME_AT]
+
+// Broker to client
+#define OP_REPLY 0x20   // str text: the line the text protocol would have sent, without its newline
+#define OP_DELIVER 0x21 // str topic, str attrs ("off=N", "cid=N", "retained", ...; may be empty), bytes payload
+#define OP_SEQ 0x22     // varint seq: the next OP_DELIVER is a QoS 1 delivery to acknowledge with OP_ACK
+
+// OP_PUBLISH flags
+#define FRAME_RETAIN 0x01 // "PUBLISH --retain"
+#define FRAME_AT 0x02     // Scheduled: "PUBLISH --at"
+
+// Longest header: opcode, flags and a 10-byte varint
+#define FRAME_HEADER_MAX 12
+
+typedef struct {
+    int opcode;
+    int flags;
+    const char* body;
+    size_t body_len;
+} Frame;
+
+// Checks the frame at the start of buf, of which avail bytes have arrived. Returns its total length, 0 if more
+// bytes are needed, or -1 if the header is malformed or the frame would be longer than max_len.
+long frame_parse(const char* buf, size_t avail, size_t max_len, Frame* f);
+
+// Field readers: each walks *p forward, never past end, and returns 0 if the field is missing or malformed
+int frame_get_varint(const char** p, const char* end, uint64_t* v);
+int frame_get_str(const char** p, const char* end, const char** s, size_t* len);
+int frame_get_bytes(const char** p, const char* end, const char** s, size_t* len);
+
+// Writers: each returns the position just past what it wrote. The *_len helpers size a body in advance.
+size_t frame_varint_len(uint64_t v);
+char* frame_put_varint(char* out, uint64_t v);
+
+static inline size_t frame_str_len(size_t len) {
+    return frame_varint_len(len) + len + 1;
+}
+char* frame_put_str(char* out, const char* s, size_t len); // Also writes bytes fields
+
+static inline size_t frame_len(size_t body_len) {
+    return 2 + frame_varint_len(body_len) + body_len;
+}
+char* frame_put_header(char* out, int opcode, int flags, size_t body_len);
+
+#endif
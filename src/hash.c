@@ -5,97 +5,257 @@
 
 #include "hash.h"
 
-unsigned int hash(const char *key) {
-    unsigned long int value = 0;
-    unsigned int i = 0;
-    unsigned int key_len = strlen(key);
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-    for (; i < key_len; ++i) {
-        value = value * 37 + key[i];
+#define CTRL_EMPTY ((int8_t)0x80)
+#define CTRL_DELETED ((int8_t)0xFE)
+// Full slots hold the low 7 bits of the hash, so their control byte is never negative
+
+#define HASH_INITIAL_CAPACITY HASH_GROUP_WIDTH
+
+// ---- Hashing (after wyhash, by Wang Yi) ----
+
+static const uint64_t secret[4] = { 0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+                                    0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull };
+
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t read8(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t read4(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// wyhash-style 64-bit hash of len bytes
+static uint64_t hash(const char *key, size_t len) {
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t seed = mix(secret[0], secret[1]);
+    uint64_t a, b;
+
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t mid = (len >> 3) << 2;
+            a = (read4(p) << 32) | read4(p + mid);
+            b = (read4(p + len - 4) << 32) | read4(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+                see1 = mix(read8(p + 16) ^ secret[2], read8(p + 24) ^ see1);
+                see2 = mix(read8(p + 32) ^ secret[3], read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+
+    __uint128_t r = (__uint128_t)(a ^ secret[1]) * (b ^ seed);
+    return mix((uint64_t)r ^ secret[0] ^ len, (uint64_t)(r >> 64) ^ secret[1]);
+}
+
+// ---- Group probing ----
+
+// Bit i is set for each control byte in the group equal to byte
+static inline unsigned int group_match(const int8_t *group, int8_t byte) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte)));
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < HASH_GROUP_WIDTH; i++) mask |= (unsigned int)(group[i] == byte) << i;
+    return mask;
+#endif
+}
+
+// Bit i is set for each empty or deleted slot in the group (the only negative control bytes)
+static inline unsigned int group_match_free(const int8_t *group) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < HASH_GROUP_WIDTH; i++) mask |= (unsigned int)(group[i] < 0) << i;
+    return mask;
+#endif
+}
+
+static inline const char *slot_key(const HashSlot *s) {
+    return (s->len <= HASH_INLINE_KEY) ? s->key.inline_key : s->key.heap_key;
+}
+
+static inline int8_t hash_tag(uint64_t h) {
+    return (int8_t)(h & 0x7F);
+}
+
+// Groups are visited in triangular order (g, g+1, g+3, g+6, ...), which covers every group of a power-of-two table
+static inline size_t hash_group(const HashTable *table, uint64_t h) {
+    return (size_t)(h >> 7) & (table->capacity / HASH_GROUP_WIDTH - 1);
+}
+
+// Index of key's slot, or -1 if it is absent
+static long find_slot(const HashTable *table, const char *key, size_t len, uint64_t h) {
+    size_t group_mask = table->capacity / HASH_GROUP_WIDTH - 1;
+    size_t g = hash_group(table, h);
+    int8_t tag = hash_tag(h);
+
+    for (size_t step = 1; step <= group_mask + 1; step++) {
+        const int8_t *ctrl = &table->ctrl[g * HASH_GROUP_WIDTH];
+        for (unsigned int m = group_match(ctrl, tag); m; m &= m - 1) {
+            size_t i = g * HASH_GROUP_WIDTH + __builtin_ctz(m);
+            const HashSlot *s = &table->slots[i];
+            if (s->len == len && memcmp(slot_key(s), key, len) == 0) return (long)i;
+        }
+        // An empty slot ends every probe sequence that reaches this group
+        if (group_match(ctrl, CTRL_EMPTY)) return -1;
+        g = (g + step) & group_mask;
+    }
+    return -1;
+}
+
+// First empty or deleted slot on h's probe sequence
+static size_t find_free(const HashTable *table, uint64_t h) {
+    size_t group_mask = table->capacity / HASH_GROUP_WIDTH - 1;
+    size_t g = hash_group(table, h);
+
+    for (size_t step = 1;; step++) {
+        unsigned int m = group_match_free(&table->ctrl[g * HASH_GROUP_WIDTH]);
+        if (m) return g * HASH_GROUP_WIDTH + __builtin_ctz(m);
+        g = (g + step) & group_mask;
     }
-    return value % TABLE_SIZE;
+}
+
+static void table_alloc(HashTable *table, size_t capacity) {
+    table->capacity = capacity;
+    table->ctrl = malloc(capacity);
+    memset(table->ctrl, CTRL_EMPTY, capacity);
+    table->slots = malloc(sizeof(HashSlot) * capacity);
+    table->size = 0;
+    table->tombstones = 0;
+}
+
+// Moves every entry into a table of the given capacity, dropping the tombstones. Keys move with their slots.
+static void rehash(HashTable *table, size_t capacity) {
+    int8_t *old_ctrl = table->ctrl;
+    HashSlot *old_slots = table->slots;
+    size_t old_capacity = table->capacity;
+    size_t size = table->size;
+
+    table_alloc(table, capacity);
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_ctrl[i] < 0) continue;
+        HashSlot *s = &old_slots[i];
+        uint64_t h = hash(slot_key(s), s->len);
+        size_t j = find_free(table, h);
+        table->ctrl[j] = hash_tag(h);
+        table->slots[j] = *s;
+    }
+    table->size = size;
+
+    free(old_ctrl);
+    free(old_slots);
 }
 
 HashTable *create_table() {
     HashTable *table = malloc(sizeof(HashTable));
-    table->buckets = malloc(sizeof(Entry *) * TABLE_SIZE);
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        table->buckets[i] = NULL;
-    }
+    table_alloc(table, HASH_INITIAL_CAPACITY);
     return table;
 }
 
 void free_table(HashTable *table) {
     if (table == NULL) return;
 
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        Entry *entry = table->buckets[i];
-        while (entry != NULL) {
-            Entry *next_entry = entry->next;
-            free(entry->key);
-            // We do NOT free(entry->value) here, as memory for the Client is managed externally
-            free(entry);
-            entry = next_entry;
-        }
+    for (size_t i = 0; i < table->capacity; i++) {
+        // We do NOT free the values here, as their memory is managed by the caller
+        if (table->ctrl[i] >= 0 && table->slots[i].len > HASH_INLINE_KEY) free(table->slots[i].key.heap_key);
     }
-    free(table->buckets);
+    free(table->ctrl);
+    free(table->slots);
     free(table);
 }
 
 void set(HashTable *table, const char *key, void *value) {
-    unsigned int slot = hash(key);
+    size_t len = strlen(key);
+    uint64_t h = hash(key, len);
 
-    Entry *entry = table->buckets[slot];
-    while (entry != NULL) {
-        if (strcmp(entry->key, key) == 0) {
-            entry->value = value; // Key exists, just update the pointer
-            return;
-        }
-        entry = entry->next;
+    long found = find_slot(table, key, len, h);
+    if (found >= 0) {
+        table->slots[found].value = value; // Key exists, just update the pointer
+        return;
     }
 
-    Entry *new_entry = malloc(sizeof(Entry));
-    new_entry->key = strdup(key);
-    new_entry->value = value;
+    // Keep at most 7/8 of the slots in use, counting tombstones; when mostly tombstones, rehashing in place is enough
+    if ((table->size + table->tombstones + 1) * 8 > table->capacity * 7) {
+        size_t capacity = table->capacity;
+        if ((table->size + 1) * 16 > capacity * 7) capacity *= 2;
+        rehash(table, capacity);
+    }
+
+    size_t i = find_free(table, h);
+    if (table->ctrl[i] == CTRL_DELETED) table->tombstones--;
+    table->ctrl[i] = hash_tag(h);
+    table->size++;
 
-    new_entry->next = table->buckets[slot];
-    table->buckets[slot] = new_entry;
+    HashSlot *s = &table->slots[i];
+    s->value = value;
+    s->len = (uint32_t)len;
+    if (len <= HASH_INLINE_KEY) {
+        memcpy(s->key.inline_key, key, len);
+    } else {
+        s->key.heap_key = malloc(len);
+        memcpy(s->key.heap_key, key, len);
+    }
 }
 
 void *get(HashTable *table, const char *key) {
-    unsigned int slot = hash(key);
-
-    Entry *entry = table->buckets[slot];
-    while (entry != NULL) {
-        if (strcmp(entry->key, key) == 0) {
-            return entry->value;
-        }
-        entry = entry->next;
-    }
-    return NULL; 
+    size_t len = strlen(key);
+    long i = find_slot(table, key, len, hash(key, len));
+    return (i >= 0) ? table->slots[i].value : NULL;
 }
 
 bool del(HashTable *table, const char *key) {
     if (table == NULL || key == NULL) return false;
 
-    unsigned int slot = hash(key);
-    Entry *current = table->buckets[slot];
-    Entry *previous = NULL;
-
-    while (current != NULL) {
-        if (strcmp(current->key, key) == 0) {
-            if (previous == NULL) {
-                table->buckets[slot] = current->next;
-            } else {
-                previous->next = current->next;
-            }
-
-            free(current->key);
-            free(current);
-            return true;
-        }
-        previous = current;
-        current = current->next;
+    size_t len = strlen(key);
+    long i = find_slot(table, key, len, hash(key, len));
+    if (i < 0) return false;
+
+    HashSlot *s = &table->slots[i];
+    if (s->len > HASH_INLINE_KEY) free(s->key.heap_key);
+
+    // If the group still has an empty slot, no probe sequence runs past it, so the slot can become empty again
+    const int8_t *group = &table->ctrl[(i / HASH_GROUP_WIDTH) * HASH_GROUP_WIDTH];
+    if (group_match(group, CTRL_EMPTY)) {
+        table->ctrl[i] = CTRL_EMPTY;
+    } else {
+        table->ctrl[i] = CTRL_DELETED;
+        table->tombstones++;
     }
-    return false;
+    table->size--;
+    return true;
 }
@@ -2,22 +2,35 @@
 #define HASH_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-#define TABLE_SIZE 100
+// An open-addressing string-keyed table that grows as it fills. Slots are probed sixteen at a time: each slot has
+// a control byte holding 7 bits of its key's hash (or an empty/deleted marker), and a whole group of control bytes
+// is compared in one SSE2 instruction, so a lookup rarely touches a key that does not match. Keys of up to
+// HASH_INLINE_KEY bytes are stored inside the slot; longer ones are copied to the heap.
+// Values are never freed by the table.
 
-// A node representing a key-value pair
-typedef struct Entry {
-    char *key;
-    void *value;        // Updated to void* to generically store Client struct pointers
-    struct Entry *next; // Pointer to the next entry (for collisions)
-} Entry;
+#define HASH_GROUP_WIDTH 16
+#define HASH_INLINE_KEY 20
+
+typedef struct {
+    void *value;
+    uint32_t len;
+    union {
+        char inline_key[HASH_INLINE_KEY]; // len <= HASH_INLINE_KEY
+        char *heap_key;                   // Longer keys
+    } key;
+} HashSlot;
 
-// The Hash Table structure
 typedef struct HashTable {
-    Entry **buckets; // Array of pointers to Entries
+    int8_t *ctrl;      // One control byte per slot
+    HashSlot *slots;
+    size_t capacity;   // A power of two, and at least one group
+    size_t size;       // Live entries
+    size_t tombstones; // Deleted slots that still extend probe sequences until the next rehash
 } HashTable;
 
-unsigned int hash(const char *key);
 HashTable *create_table();
 void free_table(HashTable *table);
 void set(HashTable *table, const char *key, void *value);
@@ -1,23 +1,32 @@
 #include "heartbeat.h"
-#include "client_manager.h"
-#include <unistd.h>
-#include <stdio.h>
-#include <pthread.h>
-
-void* heartbeat_thread_loop(void* arg) {
-    while (1) {
-        sleep(10); // Run the sweep every 10 seconds
-
-        // Pass the command gracefully down into the manager so it can safely readlock the maps
-        client_manager_sweep_inactive(60);
-    }
-    return NULL;
+#include "epoch.h"
+#include "qos.h"
+#include "tracker.h"
+#include "topiclog.h"
+#include "timer.h"
+
+#define HEARTBEAT_INTERVAL 10 // Seconds between maintenance passes
+
+static Timer heartbeat_timer;
+
+// Runs on the timer thread and re-arms itself, so the heartbeat needs no thread of its own
+static void heartbeat_tick(Timer* t) {
+    // Free replaced snapshots and indexes even when subscription changes are too rare to trigger it
+    epoch_reclaim();
+
+    // Durable topic logs: drop segments past retention and start writeback of fresh records
+    topiclog_maintain();
+
+    // QoS 1: forget unacknowledged messages of hosts that stayed away past the session expiry
+    qos_expire_sessions();
+
+    // Report the final tally of commands whose deadline has passed
+    tracker_check_deadlines();
+
+    timer_add_in(t, HEARTBEAT_INTERVAL);
 }
 
 void heartbeat_init() {
-    pthread_t tid;
-    if (pthread_create(&tid, NULL, heartbeat_thread_loop, NULL) != 0) {
-        perror("Failed to start heartbeat thread");
-    }
-    pthread_detach(tid);
+    heartbeat_timer.fn = heartbeat_tick;
+    timer_add_in(&heartbeat_timer, HEARTBEAT_INTERVAL);
 }
@@ -0,0 +1,94 @@
+#include "linebuf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static size_t max_size = 65536;
+
+void linebuf_set_limit(size_t max_bytes) {
+    // A line of a few kilobytes must always fit, or ordinary commands would be dropped
+    if (max_bytes >= LINEBUF_INITIAL_SIZE) max_size = max_bytes;
+}
+
+size_t linebuf_limit() {
+    return max_size;
+}
+
+void linebuf_init(LineBuffer* lb) {
+    memset(lb, 0, sizeof(LineBuffer));
+}
+
+void linebuf_free(LineBuffer* lb) {
+    free(lb->data);
+    linebuf_init(lb);
+}
+
+size_t linebuf_reserve(LineBuffer* lb, char** tail) {
+    // Keeps a quarter of the buffer free for reads where possible. One byte always stays free for the
+    // terminator linebuf_next_line() writes over a newline.
+    if (lb->capacity - lb->end < lb->capacity / 4 && lb->start > 0) {
+        // Slide the unread bytes back to the front, once for all the lines handed out before them
+        size_t pending = lb->end - lb->start;
+        memmove(lb->data, lb->data + lb->start, pending);
+        lb->scanned -= lb->start;
+        lb->start = 0;
+        lb->end = pending;
+    }
+
+    if (lb->capacity - lb->end < lb->capacity / 4 + 1 && lb->capacity < max_size) {
+        size_t capacity = lb->capacity ? lb->capacity * 2 : LINEBUF_INITIAL_SIZE;
+        if (capacity > max_size) capacity = max_size;
+        lb->data = realloc(lb->data, capacity);
+        lb->capacity = capacity;
+    }
+
+    if (lb->capacity - lb->end <= 1) return 0;
+    *tail = lb->data + lb->end;
+    return lb->capacity - lb->end - 1;
+}
+
+char* linebuf_next_line(LineBuffer* lb, size_t* len) {
+    for (;;) {
+        size_t from = (lb->scanned > lb->start) ? lb->scanned : lb->start;
+        char* newline = (from < lb->end) ? memchr(lb->data + from, '\n', lb->end - from) : NULL;
+        if (newline == NULL) {
+            lb->scanned = lb->end;
+            if (lb->discarding) lb->start = lb->scanned = lb->end = 0; // Still inside the dropped line
+            return NULL;
+        }
+
+        char* line = lb->data + lb->start;
+        size_t line_len = newline - line;
+        lb->start = lb->scanned = (newline - lb->data) + 1;
+        if (lb->start == lb->end) lb->start = lb->scanned = lb->end = 0; // Drained: the next read starts at the front
+
+        if (lb->discarding) {
+            lb->discarding = 0; // The tail end of the over-long line
+            continue;
+        }
+
+        if (line_len > 0 && line[line_len - 1] == '\r') line_len--;
+        line[line_len] = '\0';
+        *len = line_len;
+        return line;
+    }
+}
+
+void linebuf_consume(LineBuffer* lb, size_t n) {
+    lb->start += n;
+    if (lb->scanned < lb->start) lb->scanned = lb->start;
+    if (lb->start == lb->end) lb->start = lb->scanned = lb->end = 0;
+}
+
+void linebuf_discard_partial(LineBuffer* lb) {
+    lb->start = lb->scanned = lb->end = 0;
+    lb->discarding = 1;
+}
+
+int linebuf_shrink(LineBuffer* lb) {
+    if (lb->data == NULL || lb->end > lb->start) return 0;
+    int discarding = lb->discarding;
+    linebuf_free(lb);
+    lb->discarding = discarding;
+    return 1;
+}
@@ -0,0 +1,63 @@
+#ifndef LINEBUF_H
+#define LINEBUF_H
+
+#include <stddef.h>
+
+// First allocation for a connection's input; it doubles from here as long lines or large bursts need it
+#define LINEBUF_INITIAL_SIZE 4096
+
+// Per-connection input buffer that frames newline-terminated commands.
+// Reads append at the tail, complete lines are handed out in place from the head, and the search for the next
+// newline resumes where the last one stopped, so every byte is scanned once however the input was split up.
+// The unread bytes are only moved back to the front when the tail runs out of room. The buffer grows up to the
+// configured limit (the longest line a client may send) and is released by linebuf_shrink() once it is empty.
+// Not thread-safe on its own: it lives inside a Client and is guarded by c->lock.
+typedef struct {
+    char* data;      // NULL until the first read
+    size_t capacity;
+    size_t start;    // First byte not yet handed out
+    size_t end;      // One past the last byte received
+    size_t scanned;  // [start, scanned) is known to hold no newline
+    int discarding;  // Skipping the rest of an over-long line up to its newline
+} LineBuffer;
+
+// Largest size any connection's buffer may grow to (default 65536)
+void linebuf_set_limit(size_t max_bytes);
+size_t linebuf_limit();
+
+void linebuf_init(LineBuffer* lb);
+void linebuf_free(LineBuffer* lb);
+
+// Makes room at the tail for the next read and points *tail at it. Returns the bytes available, or 0 when the
+// buffer is at its limit and the only thing in it is an incomplete line: take the complete lines first, and if
+// that still leaves no room, linebuf_discard_partial().
+size_t linebuf_reserve(LineBuffer* lb, char** tail);
+
+// Records that n bytes were written at the tail returned by linebuf_reserve()
+static inline void linebuf_commit(LineBuffer* lb, size_t n) {
+    lb->end += n;
+}
+
+// Hands out the next complete line without its "\n" (or "\r\n"), NUL-terminated in place, or NULL if the buffer
+// holds no complete line. The line stays valid until the next linebuf_reserve() or linebuf_shrink().
+char* linebuf_next_line(LineBuffer* lb, size_t* len);
+
+// Raw access for length-prefixed frames: the unread bytes, and handing out the first n of them. Consumed bytes stay
+// in place until the next linebuf_reserve(), like a line.
+static inline const char* linebuf_peek(const LineBuffer* lb, size_t* avail) {
+    *avail = lb->end - lb->start;
+    return lb->data + lb->start;
+}
+void linebuf_consume(LineBuffer* lb, size_t n);
+
+// Throws away an incomplete line that has filled the whole buffer, along with the rest of it still to come
+void linebuf_discard_partial(LineBuffer* lb);
+
+// Gives the memory back if nothing is buffered. Returns 1 if it did.
+int linebuf_shrink(LineBuffer* lb);
+
+static inline size_t linebuf_pending(const LineBuffer* lb) {
+    return lb->end - lb->start;
+}
+
+#endif
@@ -0,0 +1,316 @@
+#include "outbound.h"
+#include "frame.h"
+
+#include <openssl/err.h>
+#include <stdlib.h>
+#include <string.h>
+
+Message* msg_alloc(int len) {
+    Message* m = malloc(sizeof(Message) + len + 1);
+    atomic_init(&m->refs, 1);
+    m->len = len;
+    m->data = m->bytes;
+    m->data[len] = '\0';
+    m->release = NULL;
+    m->owner = NULL;
+    atomic_init(&m->binary, NULL);
+    m->topic_len = 0;
+    return m;
+}
+
+Message* msg_view(const char* data, int len, void (*release)(void* owner), void* owner) {
+    Message* m = malloc(sizeof(Message));
+    atomic_init(&m->refs, 1);
+    m->len = len;
+    m->data = (char*)data;
+    m->release = release;
+    m->owner = owner;
+    atomic_init(&m->binary, NULL);
+    m->topic_len = 0;
+    return m;
+}
+
+Message* msg_ref(Message* m) {
+    atomic_fetch_add_explicit(&m->refs, 1, memory_order_relaxed);
+    return m;
+}
+
+void msg_unref(Message* m) {
+    if (atomic_fetch_sub_explicit(&m->refs, 1, memory_order_acq_rel) == 1) {
+        if (m->release) m->release(m->owner);
+        Message* binary = atomic_load_explicit(&m->binary, memory_order_acquire);
+        if (binary) msg_unref(binary);
+        free(m);
+    }
+}
+
+// One line of a text frame, split into the fields of an OP_DELIVER (or, if it is not "[topic attrs] payload",
+// kept whole for an OP_REPLY)
+typedef struct {
+    const char *topic, *attrs, *payload;
+    size_t topic_len, attrs_len, payload_len;
+    int deliver;
+} TextLine;
+
+static void split_line(const char* line, size_t len, int topic_len, TextLine* t) {
+    // A known topic length steps over any ']' in the topic; past it, only broker-made attributes precede the ']'
+    size_t from = (topic_len > 0 && (size_t)topic_len + 1 < len) ? (size_t)topic_len + 1 : 1;
+    const char* close = (len > 0 && line[0] == '[') ? memchr(line + from, ']', len - from) : NULL;
+    if (close == NULL) {
+        t->deliver = 0;
+        t->payload = line;
+        t->payload_len = len;
+        return;
+    }
+
+    const char* end = line + len;
+    const char* inner = line + 1;
+    const char* space = memchr(line + from, ' ', close - (line + from));
+    t->deliver = 1;
+    t->topic = inner;
+    t->topic_len = (space ? space : close) - inner;
+    t->attrs = space ? space + 1 : close;
+    t->attrs_len = close - t->attrs;
+    t->payload = (close + 1 < end && close[1] == ' ') ? close + 2 : close + 1;
+    t->payload_len = end - t->payload;
+}
+
+static size_t line_body_len(const TextLine* t) {
+    if (!t->deliver) return frame_str_len(t->payload_len);
+    return frame_str_len(t->topic_len) + frame_str_len(t->attrs_len) + frame_str_len(t->payload_len);
+}
+
+static char* put_line_frame(char* out, const TextLine* t) {
+    out = frame_put_header(out, t->deliver ? OP_DELIVER : OP_REPLY, 0, line_body_len(t));
+    if (t->deliver) {
+        out = frame_put_str(out, t->topic, t->topic_len);
+        out = frame_put_str(out, t->attrs, t->attrs_len);
+    }
+    return frame_put_str(out, t->payload, t->payload_len);
+}
+
+Message* msg_alloc_deliver(const char* topic, const char* attrs, const char* payload, size_t payload_len) {
+    TextLine t = { topic, attrs, payload, strlen(topic), strlen(attrs), payload_len, 1 };
+    Message* m = msg_alloc(frame_len(line_body_len(&t)));
+    put_line_frame(m->data, &t);
+    return m;
+}
+
+Message* msg_alloc_publish(const char* topic, const char* attrs, const char* payload, size_t payload_len) {
+    // Formatted once and shared by every recipient's queue; it is freed when the last one has sent it
+    size_t topic_len = strlen(topic);
+    size_t attrs_len = attrs ? strlen(attrs) + 1 : 0;
+    Message* m = msg_alloc(topic_len + attrs_len + payload_len + 4);
+    char* p = m->data + (attrs ? sprintf(m->data, "[%s %s] ", topic, attrs) : sprintf(m->data, "[%s] ", topic));
+    memcpy(p, payload, payload_len);
+    p[payload_len] = '\n';
+    m->topic_len = topic_len;
+
+    if (msg_flatten(p, p + payload_len)) {
+        atomic_store_explicit(&m->binary, msg_alloc_deliver(topic, attrs ? attrs : "", payload, payload_len),
+                              memory_order_release);
+    }
+    return m;
+}
+
+// Renders every line of a text message as a frame, sizing them all first so the result is a single allocation
+static Message* convert_to_binary(const Message* m) {
+    const char* end = m->data + m->len;
+    size_t total = 0;
+    for (const char* p = m->data; p < end;) {
+        const char* nl = memchr(p, '\n', end - p);
+        const char* line_end = nl ? nl : end;
+        TextLine t;
+        split_line(p, line_end - p, m->topic_len, &t);
+        total += frame_len(line_body_len(&t));
+        p = line_end + 1;
+    }
+
+    Message* b = msg_alloc(total);
+    char* out = b->data;
+    for (const char* p = m->data; p < end;) {
+        const char* nl = memchr(p, '\n', end - p);
+        const char* line_end = nl ? nl : end;
+        TextLine t;
+        split_line(p, line_end - p, m->topic_len, &t);
+        out = put_line_frame(out, &t);
+        p = line_end + 1;
+    }
+    return b;
+}
+
+Message* msg_binary(Message* m) {
+    Message* b = atomic_load_explicit(&m->binary, memory_order_acquire);
+    if (b) return b;
+
+    // Several subscribers may race to convert the same message; the first rendering installed wins
+    b = convert_to_binary(m);
+    Message* installed = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&m->binary, &installed, b, memory_order_acq_rel,
+                                                 memory_order_acquire)) {
+        msg_unref(b);
+        return installed;
+    }
+    return b;
+}
+
+void outq_init(OutQueue* q) {
+    memset(q, 0, sizeof(OutQueue));
+}
+
+static void pop_head(OutQueue* q) {
+    OutFrame* f = q->head;
+    q->head = f->next;
+    if (q->head == NULL) q->tail = NULL;
+    q->head_off = 0;
+    q->head_busy = 0;
+    q->frames--;
+    msg_unref(f->msg);
+    free(f);
+}
+
+void outq_free(OutQueue* q) {
+    while (q->head) pop_head(q);
+    free(q->stage);
+    outq_init(q);
+}
+
+void outq_push_prefixed(OutQueue* q, const char* prefix, int prefix_len, Message* m) {
+    if (m->len <= 0) return;
+
+    OutFrame* f = malloc(sizeof(OutFrame));
+    f->next = NULL;
+    f->msg = msg_ref(m);
+    f->prefix_len = prefix_len;
+    if (prefix_len > 0) memcpy(f->prefix, prefix, prefix_len);
+
+    if (q->tail) q->tail->next = f;
+    else q->head = f;
+    q->tail = f;
+    q->frames++;
+    q->bytes += outframe_len(f);
+}
+
+void outq_push_msg(OutQueue* q, Message* m) {
+    outq_push_prefixed(q, NULL, 0, m);
+}
+
+void outq_push(OutQueue* q, const char* data, int len) {
+    if (len <= 0) return;
+
+    Message* m = msg_alloc(len);
+    memcpy(m->data, data, len);
+    outq_push_msg(q, m);
+    msg_unref(m);
+}
+
+int outq_drop_oldest(OutQueue* q, size_t max_bytes, int max_frames) {
+    int dropped = 0;
+    OutFrame* prev = NULL;
+    OutFrame* f = q->head;
+
+    // A head frame that is partly sent (or mid-retry) has to finish, otherwise the stream would be corrupted
+    if (f && (q->head_off > 0 || q->head_busy)) {
+        prev = f;
+        f = f->next;
+    }
+
+    while (f && (q->bytes > max_bytes || q->frames > max_frames)) {
+        OutFrame* next = f->next;
+        if (prev) prev->next = next;
+        else q->head = next;
+        if (q->tail == f) q->tail = prev;
+
+        q->bytes -= outframe_len(f);
+        q->frames--;
+        dropped++;
+        msg_unref(f->msg);
+        free(f);
+        f = next;
+    }
+    return dropped;
+}
+
+// Returns bytes written (> 0), 0 if the socket would block, or -1 on a fatal error
+static int write_some(SSL* ssl, const char* data, int len) {
+    ERR_clear_error();
+    int n = SSL_write(ssl, data, len);
+    if (n > 0) return n;
+
+    int err = SSL_get_error(ssl, n);
+    if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) return 0;
+    return -1;
+}
+
+// Returns the contiguous run of the head frame that starts at head_off: the rest of the prefix, or of the message
+static const char* head_chunk(const OutQueue* q, int* len) {
+    const OutFrame* f = q->head;
+    if (q->head_off < f->prefix_len) {
+        *len = f->prefix_len - q->head_off;
+        return &f->prefix[q->head_off];
+    }
+    *len = outframe_len(f) - q->head_off;
+    return &f->msg->data[q->head_off - f->prefix_len];
+}
+
+// Copies as many queued frames as fit into the stage so they leave in a single TLS record
+static void fill_stage(OutQueue* q) {
+    if (q->stage == NULL) q->stage = malloc(OUTBOUND_STAGE_SIZE);
+    q->stage_len = 0;
+    q->stage_off = 0;
+
+    while (q->head && q->stage_len < OUTBOUND_STAGE_SIZE) {
+        int remaining;
+        const char* chunk = head_chunk(q, &remaining);
+        int room = OUTBOUND_STAGE_SIZE - q->stage_len;
+        int take = (remaining < room) ? remaining : room;
+
+        memcpy(&q->stage[q->stage_len], chunk, take);
+        q->stage_len += take;
+        q->head_off += take;
+
+        if (q->head_off < outframe_len(q->head)) continue; // Either the prefix is done or the stage is full
+        pop_head(q);
+    }
+}
+
+int outq_flush(OutQueue* q, SSL* ssl) {
+    while (1) {
+        // Staged bytes must be retried exactly as they were first offered to OpenSSL
+        if (q->stage_off < q->stage_len) {
+            int n = write_some(ssl, &q->stage[q->stage_off], q->stage_len - q->stage_off);
+            if (n <= 0) return (n == 0) ? OUTQ_BLOCKED : OUTQ_ERROR;
+            q->stage_off += n;
+            q->bytes -= n;
+            continue;
+        }
+        q->stage_len = 0;
+        q->stage_off = 0;
+
+        if (q->head == NULL) {
+            // Fully drained: give the coalescing buffer back instead of parking 16 KB per idle client
+            free(q->stage);
+            q->stage = NULL;
+            return OUTQ_DRAINED;
+        }
+
+        // A prefix still to send is staged together with the message behind it, so the two share a TLS record
+        int remaining = outframe_len(q->head) - q->head_off;
+        int prefix_pending = q->head_off < q->head->prefix_len;
+        if (q->head_busy || (!prefix_pending && (q->head->next == NULL || remaining >= OUTBOUND_STAGE_SIZE))) {
+            // A lone or large frame is written in place from the shared message, with no copy
+            // (the chunk is recomputed identically on a retry)
+            int chunk_len;
+            const char* chunk = head_chunk(q, &chunk_len);
+            q->head_busy = 1;
+            int n = write_some(ssl, chunk, chunk_len);
+            if (n <= 0) return (n == 0) ? OUTQ_BLOCKED : OUTQ_ERROR;
+            q->head_busy = 0;
+            q->head_off += n;
+            q->bytes -= n;
+            if (q->head_off == outframe_len(q->head)) pop_head(q);
+        } else {
+            fill_stage(q);
+        }
+    }
+}
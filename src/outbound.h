@@ -0,0 +1,109 @@
+#ifndef OUTBOUND_H
+#define OUTBOUND_H
+
+#include <openssl/ssl.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+
+// Largest run of small frames coalesced into a single SSL_write (one full TLS record)
+#define OUTBOUND_STAGE_SIZE 16384
+
+#define OUTQ_DRAINED 1
+#define OUTQ_BLOCKED 0
+#define OUTQ_ERROR -1
+
+// An immutable, reference-counted wire message. A publish formats it once and every subscriber's queue
+// shares it; the last queue to finish sending it (or to drop it) frees it.
+// The bytes normally live right after the header. A view instead points into memory owned by someone else
+// (such as a mapped log segment) and calls release(owner) when the message is freed.
+// Messages are text frames ("[topic attrs] payload\n", possibly several back to back); connections that negotiated
+// binary framing get the same message as OP_DELIVER frames (see frame.h), converted once and shared as well.
+typedef struct Message {
+    _Atomic int refs;
+    int len;
+    char* data;
+    void (*release)(void* owner);
+    void* owner;
+    struct Message* _Atomic binary; // The OP_DELIVER rendering, built by msg_binary() on first use
+    int topic_len;                  // Of the topic in each "[topic ...]" line, which may hold a ']'; 0 if unknown
+    char bytes[];
+} Message;
+
+// Allocates a message with room for len bytes (plus a terminator) and a single reference owned by the caller
+Message* msg_alloc(int len);
+// Wraps len bytes at data without copying them. release(owner) runs once the last reference is gone.
+Message* msg_view(const char* data, int len, void (*release)(void* owner), void* owner);
+Message* msg_ref(Message* m);
+void msg_unref(Message* m);
+
+// The message as OP_DELIVER frames, owned by m. A line that is not a delivery goes out as an OP_REPLY.
+Message* msg_binary(Message* m);
+// A single OP_DELIVER frame, for a payload that its text rendering could not carry exactly
+Message* msg_alloc_deliver(const char* topic, const char* attrs, const char* payload, size_t payload_len);
+
+// A text frame is a single line of C string, so newlines and NULs in a payload (which binary-framed publishers may
+// send) are written as spaces in [p, end). Returns 1 if there were any.
+static inline int msg_flatten(char* p, char* end) {
+    int changed = 0;
+    for (char* q = p; q < end && (q = memchr(q, '\n', end - q)) != NULL; changed = 1) *q++ = ' ';
+    for (char* q = p; q < end && (q = memchr(q, '\0', end - q)) != NULL; changed = 1) *q++ = ' ';
+    return changed;
+}
+
+// Formats a publish as the text frame "[topic attrs] payload\n" (attrs may be NULL), with the payload flattened.
+// When that changed it, the exact OP_DELIVER rendering is made up front, so binary-framed connections still get
+// the payload byte for byte.
+Message* msg_alloc_publish(const char* topic, const char* attrs, const char* payload, size_t payload_len);
+
+// Longest per-connection header that may precede a shared message in a single frame
+#define OUTBOUND_PREFIX_MAX 32
+
+// A queued frame: an optional private prefix followed by a shared message, sent back to back
+typedef struct OutFrame {
+    struct OutFrame* next;
+    Message* msg;
+    int prefix_len;
+    char prefix[OUTBOUND_PREFIX_MAX];
+} OutFrame;
+
+static inline int outframe_len(const OutFrame* f) {
+    return f->prefix_len + f->msg->len;
+}
+
+// Per-connection queue of outbound frames. Writers append; the owner flushes whenever the socket is writable.
+// Not thread-safe on its own: it lives inside a Client and is guarded by c->lock.
+typedef struct {
+    OutFrame* head;
+    OutFrame* tail;
+    int frames;       // Frames not yet fully handed to OpenSSL
+    size_t bytes;     // Bytes not yet accepted by SSL_write (including staged ones)
+    int head_off;     // Bytes of the head frame (prefix included) already written or staged
+    int head_busy;    // An SSL_write of the head frame returned WANT_WRITE and must be retried as-is
+    char* stage;      // Coalescing buffer, allocated only while small frames are backed up
+    int stage_len;
+    int stage_off;
+} OutQueue;
+
+void outq_init(OutQueue* q);
+void outq_free(OutQueue* q);
+
+// Copies a frame onto the tail of the queue
+void outq_push(OutQueue* q, const char* data, int len);
+// Queues a shared message without copying it; the queue takes its own reference
+void outq_push_msg(OutQueue* q, Message* m);
+// Same, with a short header of this connection's own (at most OUTBOUND_PREFIX_MAX bytes) in front of the message
+void outq_push_prefixed(OutQueue* q, const char* prefix, int prefix_len, Message* m);
+
+// Drops whole frames that have not started transmitting, oldest first, until the queue holds at most
+// max_bytes and max_frames. Returns the number of frames dropped.
+int outq_drop_oldest(OutQueue* q, size_t max_bytes, int max_frames);
+
+// Writes as much as the socket accepts. Returns OUTQ_DRAINED, OUTQ_BLOCKED (wait for EPOLLOUT) or OUTQ_ERROR.
+int outq_flush(OutQueue* q, SSL* ssl);
+
+static inline int outq_pending(const OutQueue* q) {
+    return q->bytes > 0;
+}
+
+#endif
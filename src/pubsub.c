@@ -1,150 +1,1009 @@
 #include "pubsub.h"
 #include "client_manager.h"
+#include "epoch.h"
+#include "topic.h"
+#include "filter.h"
+#include "topiclog.h"
+#include "retained.h"
+#include "tracker.h"
 
 #include <openssl/ssl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <unistd.h>
 
+#define TOPIC_INDEX_INITIAL_SIZE 64   // Slots in the open-addressing index (always a power of two)
+#define TOPIC_SUBS_INITIAL_CAPACITY 4
+#define SUB_TABLE_INITIAL_SIZE 1024
+#define TRIE_CHILDREN_INITIAL_SIZE 4
+#define MATCH_INLINE_CAPACITY 16
+#define REPLAY_BATCH_BYTES (256 * 1024) // Backlog queued per pump; the next stretch waits until the socket has taken it
+#define REPLAY_BATCH_RECORDS 4096
+
+// One subscriber of a topic. sub_slot is where the matching entry sits in the subscriber's own list.
+typedef struct {
+    conn_handle_t handle;
+    int sub_slot;
+    SubFilter* filter; // Optional content filter; the subscription owns a reference
+} Subscriber;
+
+typedef struct {
+    conn_handle_t handle;
+    SubFilter* filter;
+} SnapEntry;
+
+// Subscriber entries shared by successive snapshots of a topic. A snapshot never reads past its own count, so joins
+// are appended in place behind the newest one; any other change copies the set into a new block.
+typedef struct {
+    _Atomic int refs;  // One per snapshot using it
+    int capacity;
+    int used;          // Entries written, each holding a reference to its filter (pubsub_lock must be held)
+    SnapEntry entries[];
+} SnapBlock;
+
+// Immutable view of a topic's subscribers. Publishers fan out from a snapshot without holding
+// pubsub_lock; the topic owns one reference and every in-flight publish holds another.
 typedef struct {
-    char name[64];
-    int subscribers[MAX_SUBSCRIBERS_PER_TOPIC];
+    _Atomic int refs;
+    int count;
+    int filtered;      // Some entry carries a content filter
+    SnapBlock* block;
+    SnapEntry* entries; // The first count entries of block
+} SubSnapshot;
+
+// What one publish hands to every recipient
+typedef struct {
+    Message* msg;
+    const char* topic_name;
+    const char* verb; // First word of the payload, for verb filters
+    int verb_len;
+    int track;        // A tracked command: collect the hostnames it reaches
+    int collect;      // Only collect the hostnames that would receive it, without sending anything
+    char** hosts;
+    int host_count;
+    int host_capacity;
+} Delivery;
+
+typedef struct {
+    char* name;
+    uint32_t id;                // Interned id: the topic's position in the topics array, stable for the broker's lifetime
+    uint32_t hash;
+    Subscriber* subscribers;    // Unordered; grows by doubling and shrinks by swap-remove
     int sub_count;
+    int sub_capacity;
+    _Atomic(SubSnapshot*) snapshot; // Never NULL; replaced whole once a batch of membership changes is done
+    int dirty;                  // Queued for a snapshot rebuild (pubsub_lock must be held)
+    int reshaped;               // Something besides a join changed since the last rebuild, so it needs a new block
+    TopicLog* log;              // Set for durable topics; fixed once the topic is interned
 } Topic;
 
-Topic topics[MAX_TOPICS];
-int topic_count = 0;
+// Open-addressing index from name to topic. Readers probe it inside an epoch section with no lock;
+// pubsub_lock holders insert into it, and replace it wholesale (retiring the old one) when it grows.
+typedef struct {
+    uint32_t size; // Always a power of two
+    _Atomic(Topic*) slots[];
+} TopicIndex;
+
+// One subscription of a connection. pos is where the connection sits in the topic's subscriber array.
+typedef struct {
+    uint32_t topic_id;
+    int pos;
+} Subscription;
+
+// A level of the wildcard trie. Only subscription filters are stored here (plain topics stay in the hash index),
+// so publish cost depends on the depth of the topic rather than on how many wildcard subscriptions exist.
+// Nodes are never freed, and every pointer a publisher follows is published with a release store.
+typedef struct TrieNode {
+    char* level;
+    int level_len;
+    uint32_t hash;
+    _Atomic(Topic*) filter;                   // The filter that ends at this node
+    _Atomic(Topic*) multi;                    // The filter that ends in '#' right below this node
+    _Atomic(struct TrieNode*) plus;           // The '+' child
+    _Atomic(struct TrieChildren*) children;   // Literal children, replaced copy-on-write when they grow
+    uint32_t child_count;                     // Only touched with pubsub_lock held
+} TrieNode;
+
+typedef struct TrieChildren {
+    uint32_t size; // Always a power of two
+    _Atomic(TrieNode*) slots[];
+} TrieChildren;
+
+// Topics matched by one publish: the exact topic plus every wildcard filter covering it
+typedef struct {
+    Topic** items;
+    int count;
+    int capacity;
+    Topic* inline_items[MATCH_INLINE_CAPACITY];
+} MatchSet;
+
+// A SUBSCRIBE ... FROM whose backlog is still streaming. Kept on the client in request order.
+typedef struct Replay {
+    struct Replay* next;
+    Topic* topic;
+    long long offset;   // Next record to queue
+    SubFilter* filter;  // Handed over to the subscription once the backlog is done
+} Replay;
+
+// Reverse index: the topics a connection is subscribed to, so teardown only touches those topics
+typedef struct {
+    conn_handle_t owner;
+    Subscription* items;
+    int count;
+    int capacity;
+} SubList;
+
+// Topics are interned on first use and never freed, so an id (and a Topic pointer) stays valid for as long as the broker runs.
+// The id-indexed array serves the reverse index and is only touched with pubsub_lock held.
+static Topic** topics = NULL;
+static uint32_t topic_count = 0;
+static uint32_t topic_capacity = 0;
+
+static _Atomic(TopicIndex*) topic_index = NULL;
+
+static TrieNode trie_root;
+static _Atomic int filter_count = 0; // Lets publishes skip the trie walk entirely while nobody uses wildcards
+
+// Reverse index, indexed by fd like the client registry
+static SubList* sub_table = NULL;
+static int sub_table_size = 0;
+
+// Topics whose membership changed since their snapshot was built. Writers only mark topics here; the last one queued
+// for pubsub_lock rebuilds them all and the others wait for it, so a subscribe storm copies each set once per batch
+// instead of once per join.
+static Topic** dirty_topics = NULL;
+static int dirty_count = 0;
+static int dirty_capacity = 0;
+static _Atomic int queued_writers = 0;   // Membership writers holding or waiting for pubsub_lock
+static unsigned long rebuild_rounds = 0; // Bumped after each rebuild, under pubsub_lock
+static pthread_cond_t snapshots_rebuilt;
+
+// Serializes subscription changes and snapshot rebuilds; publishers never hold it during fanout.
+// Lock order: a client's lock, then a topic log's lock, then pubsub_lock. A durable publish and a caught-up replay
+// take it under the log lock, so nothing that holds it may lock a log or a client.
 pthread_mutex_t pubsub_lock;
 
+// FNV-1a
+static uint32_t hash_bytes(const char* data, int len) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t topic_hash(const char* name) {
+    return hash_bytes(name, strlen(name));
+}
+
+static TopicIndex* topic_index_alloc(uint32_t size) {
+    TopicIndex* idx = calloc(1, sizeof(TopicIndex) + sizeof(_Atomic(Topic*)) * size);
+    idx->size = size;
+    return idx;
+}
+
+// Linear probe for name. Returns its topic, or NULL with *empty_slot set to where it would go.
+static Topic* topic_probe(TopicIndex* idx, const char* name, uint32_t h, uint32_t* empty_slot) {
+    uint32_t slot = h & (idx->size - 1);
+    Topic* t;
+
+    while ((t = atomic_load_explicit(&idx->slots[slot], memory_order_acquire)) != NULL) {
+        if (t->hash == h && strcmp(t->name, name) == 0) return t;
+        slot = (slot + 1) & (idx->size - 1);
+    }
+    if (empty_slot) *empty_slot = slot;
+    return NULL;
+}
+
+// Doubles the index and swaps it in; readers still probing the old one finish before it is freed (pubsub_lock must be held)
+static void topic_index_grow() {
+    TopicIndex* old_idx = atomic_load(&topic_index);
+    TopicIndex* new_idx = topic_index_alloc(old_idx->size * 2);
+
+    for (uint32_t id = 0; id < topic_count; id++) {
+        uint32_t slot = topics[id]->hash & (new_idx->size - 1);
+        while (atomic_load_explicit(&new_idx->slots[slot], memory_order_relaxed) != NULL) {
+            slot = (slot + 1) & (new_idx->size - 1);
+        }
+        atomic_store_explicit(&new_idx->slots[slot], topics[id], memory_order_relaxed);
+    }
+    atomic_store_explicit(&topic_index, new_idx, memory_order_release);
+    epoch_retire(old_idx, free);
+}
+
+// Lock-free lookup for publishers (the caller must be inside an epoch section)
+static Topic* topic_find(const char* name) {
+    TopicIndex* idx = atomic_load_explicit(&topic_index, memory_order_acquire);
+    return topic_probe(idx, name, topic_hash(name), NULL);
+}
+
+static TrieNode* trie_node_new(const char* level, int len, uint32_t h) {
+    TrieNode* node = calloc(1, sizeof(TrieNode));
+    node->level = strndup(level, len);
+    node->level_len = len;
+    node->hash = h;
+    return node;
+}
+
+// Literal child lookup. Safe without pubsub_lock inside an epoch section.
+static TrieNode* trie_child_find(TrieNode* node, const char* level, int len, uint32_t h) {
+    TrieChildren* kids = atomic_load_explicit(&node->children, memory_order_acquire);
+    if (kids == NULL) return NULL;
+
+    uint32_t slot = h & (kids->size - 1);
+    TrieNode* child;
+    while ((child = atomic_load_explicit(&kids->slots[slot], memory_order_acquire)) != NULL) {
+        if (child->hash == h && child->level_len == len && memcmp(child->level, level, len) == 0) return child;
+        slot = (slot + 1) & (kids->size - 1);
+    }
+    return NULL;
+}
+
+static void trie_children_place(TrieChildren* kids, TrieNode* child) {
+    uint32_t slot = child->hash & (kids->size - 1);
+    while (atomic_load_explicit(&kids->slots[slot], memory_order_relaxed) != NULL) {
+        slot = (slot + 1) & (kids->size - 1);
+    }
+    atomic_store_explicit(&kids->slots[slot], child, memory_order_release);
+}
+
+// Returns the literal child for level, creating it if needed (pubsub_lock must be held)
+static TrieNode* trie_child_get(TrieNode* node, const char* level, int len) {
+    uint32_t h = hash_bytes(level, len);
+    TrieNode* child = trie_child_find(node, level, len, h);
+    if (child) return child;
+
+    child = trie_node_new(level, len, h);
+    TrieChildren* kids = atomic_load(&node->children);
+
+    if (kids == NULL || (node->child_count + 1) * 2 > kids->size) {
+        // Grow copy-on-write so concurrent publishers keep probing a complete table
+        uint32_t size = kids ? kids->size * 2 : TRIE_CHILDREN_INITIAL_SIZE;
+        TrieChildren* grown = calloc(1, sizeof(TrieChildren) + sizeof(_Atomic(TrieNode*)) * size);
+        grown->size = size;
+        for (uint32_t i = 0; kids && i < kids->size; i++) {
+            TrieNode* existing = atomic_load_explicit(&kids->slots[i], memory_order_relaxed);
+            if (existing) trie_children_place(grown, existing);
+        }
+        trie_children_place(grown, child);
+        atomic_store_explicit(&node->children, grown, memory_order_release);
+        if (kids) epoch_retire(kids, free);
+    } else {
+        trie_children_place(kids, child);
+    }
+    node->child_count++;
+    return child;
+}
+
+// Hooks a newly interned wildcard filter into the trie (pubsub_lock must be held)
+static void trie_insert(Topic* t) {
+    TrieNode* node = &trie_root;
+    const char* level = t->name;
+
+    while (1) {
+        const char* slash = strchr(level, '/');
+        int len = slash ? (int)(slash - level) : (int)strlen(level);
+
+        if (len == 1 && level[0] == '#') {
+            atomic_store_explicit(&node->multi, t, memory_order_release);
+            break;
+        }
+
+        if (len == 1 && level[0] == '+') {
+            TrieNode* plus = atomic_load(&node->plus);
+            if (plus == NULL) {
+                plus = trie_node_new(level, len, 0);
+                atomic_store_explicit(&node->plus, plus, memory_order_release);
+            }
+            node = plus;
+        } else {
+            node = trie_child_get(node, level, len);
+        }
+
+        if (slash == NULL) {
+            atomic_store_explicit(&node->filter, t, memory_order_release);
+            break;
+        }
+        level = slash + 1;
+    }
+    atomic_fetch_add(&filter_count, 1);
+}
+
+static void match_add(MatchSet* m, Topic* t) {
+    if (m->count == m->capacity) {
+        m->capacity *= 2;
+        if (m->items == m->inline_items) {
+            m->items = malloc(sizeof(Topic*) * m->capacity);
+            memcpy(m->items, m->inline_items, sizeof(m->inline_items));
+        } else {
+            m->items = realloc(m->items, sizeof(Topic*) * m->capacity);
+        }
+    }
+    m->items[m->count++] = t;
+}
+
+// Collects every filter matching the topic from `level` onwards (level is NULL once all levels are consumed).
+// Each step follows at most the literal child and the '+' child, so the walk is bounded by the topic's depth.
+static void trie_match(TrieNode* node, const char* level, MatchSet* m) {
+    Topic* multi = atomic_load_explicit(&node->multi, memory_order_acquire);
+    if (multi) match_add(m, multi);
+
+    if (level == NULL) {
+        Topic* filter = atomic_load_explicit(&node->filter, memory_order_acquire);
+        if (filter) match_add(m, filter);
+        return;
+    }
+
+    const char* slash = strchr(level, '/');
+    int len = slash ? (int)(slash - level) : (int)strlen(level);
+    const char* next = slash ? slash + 1 : NULL;
+
+    TrieNode* child = trie_child_find(node, level, len, hash_bytes(level, len));
+    if (child) trie_match(child, next, m);
+
+    TrieNode* plus = atomic_load_explicit(&node->plus, memory_order_acquire);
+    if (plus) trie_match(plus, next, m);
+}
+
+// Wraps the first count entries of a block in a snapshot holding one reference, and takes a block reference for it
+static SubSnapshot* snapshot_wrap(SnapBlock* block, int count, int filtered) {
+    SubSnapshot* snap = malloc(sizeof(SubSnapshot));
+    atomic_init(&snap->refs, 1);
+    snap->count = count;
+    snap->filtered = filtered;
+    snap->block = block;
+    snap->entries = block->entries;
+    atomic_fetch_add(&block->refs, 1);
+    return snap;
+}
+
+// Writes the topic's subscribers from entry `from` on into the block (pubsub_lock must be held).
+// Returns 1 if any of them carries a content filter.
+static int snapshot_fill(SnapBlock* block, Topic* t, int from) {
+    int filtered = 0;
+    for (int j = from; j < t->sub_count; j++) {
+        SubFilter* filter = t->subscribers[j].filter;
+        block->entries[j] = (SnapEntry){ t->subscribers[j].handle, filter ? filter_ref(filter) : NULL };
+        if (filter) filtered = 1;
+    }
+    block->used = t->sub_count;
+    return filtered;
+}
+
+// Builds the snapshot of the topic's current subscribers (pubsub_lock must be held). Joins since the previous one
+// (old, or NULL for a new topic) extend its block when there is room; otherwise the set is copied into a new block
+// with room to spare.
+static SubSnapshot* snapshot_build(Topic* t, SubSnapshot* old) {
+    if (old && !t->reshaped && old->block->used == old->count && t->sub_count <= old->block->capacity) {
+        int filtered = snapshot_fill(old->block, t, old->count);
+        return snapshot_wrap(old->block, t->sub_count, old->filtered | filtered);
+    }
+
+    int capacity = t->sub_count * 2 > TOPIC_SUBS_INITIAL_CAPACITY ? t->sub_count * 2 : TOPIC_SUBS_INITIAL_CAPACITY;
+    SnapBlock* block = malloc(sizeof(SnapBlock) + sizeof(SnapEntry) * capacity);
+    atomic_init(&block->refs, 0);
+    block->capacity = capacity;
+    t->reshaped = 0;
+    return snapshot_wrap(block, t->sub_count, snapshot_fill(block, t, 0));
+}
+
+// Finds a topic by name, interning it with the given durable log when create is set. Returns NULL if it does not
+// exist (pubsub_lock must be held).
+static Topic* topic_lookup(const char* name, int create, TopicLog* log) {
+    uint32_t h = topic_hash(name);
+    uint32_t slot;
+    TopicIndex* idx = atomic_load(&topic_index);
+
+    Topic* t = topic_probe(idx, name, h, &slot);
+    if (t || !create) return t;
+
+    if (topic_count == topic_capacity) {
+        topic_capacity = topic_capacity ? topic_capacity * 2 : TOPIC_INDEX_INITIAL_SIZE;
+        topics = realloc(topics, sizeof(Topic*) * topic_capacity);
+    }
+
+    t = calloc(1, sizeof(Topic));
+    t->name = strdup(name);
+    t->id = topic_count;
+    t->hash = h;
+    t->log = log;
+    atomic_init(&t->snapshot, snapshot_build(t, NULL));
+    topics[topic_count++] = t;
+    atomic_store_explicit(&idx->slots[slot], t, memory_order_release); // Publishes the fully built topic
+    if (topic_has_wildcard(name)) trie_insert(t);
+
+    // Keep the load factor at or below one half so probe runs stay short
+    if (topic_count * 2 > idx->size) topic_index_grow();
+    return t;
+}
+
+// Finds a topic by name, interning it if needed. A new durable topic's log is opened first, without pubsub_lock:
+// that may scan and map its segment files and recover the last one.
+static Topic* topic_intern(const char* name) {
+    epoch_enter();
+    Topic* t = topic_find(name);
+    epoch_exit();
+    if (t) return t; // Topics are never freed
+
+    TopicLog* log = topiclog_get(name);
+    pthread_mutex_lock(&pubsub_lock);
+    t = topic_lookup(name, 1, log);
+    pthread_mutex_unlock(&pubsub_lock);
+    return t;
+}
+
+static void snapshot_release(void* ptr) {
+    SubSnapshot* snap = ptr;
+    if (atomic_fetch_sub(&snap->refs, 1) == 1) {
+        SnapBlock* block = snap->block;
+        if (atomic_fetch_sub(&block->refs, 1) == 1) {
+            for (int j = 0; j < block->used; j++) filter_unref(block->entries[j].filter);
+            free(block);
+        }
+        free(snap);
+    }
+}
+
+// Returns a referenced snapshot of the topic's subscribers (the caller must be inside an epoch section)
+static SubSnapshot* topic_acquire_snapshot(Topic* t) {
+    // Safe even if a writer has just replaced it: the epoch section keeps it allocated until our reference lands
+    SubSnapshot* snap = atomic_load_explicit(&t->snapshot, memory_order_acquire);
+    atomic_fetch_add(&snap->refs, 1);
+    return snap;
+}
+
+// Queues the topic's snapshot for a rebuild after its membership changed; reshape is set for anything but a join
+// (pubsub_lock must be held)
+static void topic_touch(Topic* t, int reshape) {
+    t->reshaped |= reshape;
+    if (t->dirty) return;
+    if (dirty_count == dirty_capacity) {
+        dirty_capacity = dirty_capacity ? dirty_capacity * 2 : TOPIC_SUBS_INITIAL_CAPACITY;
+        dirty_topics = realloc(dirty_topics, sizeof(Topic*) * dirty_capacity);
+    }
+    t->dirty = 1;
+    dirty_topics[dirty_count++] = t;
+}
+
+// Publishes a fresh snapshot of every dirty topic and wakes the writers waiting for it (pubsub_lock must be held)
+static void snapshots_rebuild() {
+    for (int i = 0; i < dirty_count; i++) {
+        Topic* t = dirty_topics[i];
+        SubSnapshot* old = atomic_load_explicit(&t->snapshot, memory_order_relaxed);
+        atomic_store_explicit(&t->snapshot, snapshot_build(t, old), memory_order_release);
+        epoch_retire(old, snapshot_release);
+        t->dirty = 0;
+    }
+    dirty_count = 0;
+    rebuild_rounds++;
+    pthread_cond_broadcast(&snapshots_rebuilt);
+}
+
+// Takes pubsub_lock for a membership change
+static void membership_lock() {
+    atomic_fetch_add(&queued_writers, 1);
+    pthread_mutex_lock(&pubsub_lock);
+}
+
+// Releases pubsub_lock once this writer's changes are visible to publishers. The last writer in line rebuilds;
+// the others wait for it, so a publish that starts after SUBSCRIBE returns always reaches the new subscriber.
+static void membership_unlock() {
+    if (atomic_fetch_sub(&queued_writers, 1) == 1) {
+        if (dirty_count > 0) snapshots_rebuild();
+    } else if (dirty_count > 0) {
+        unsigned long round = rebuild_rounds;
+        while (rebuild_rounds == round) pthread_cond_wait(&snapshots_rebuilt, &pubsub_lock);
+    }
+    pthread_mutex_unlock(&pubsub_lock);
+}
+
 void pubsub_init() {
     pthread_mutex_init(&pubsub_lock, NULL);
+    pthread_cond_init(&snapshots_rebuilt, NULL);
     topic_count = 0;
+    atomic_store(&topic_index, topic_index_alloc(TOPIC_INDEX_INITIAL_SIZE));
+    sub_table_size = SUB_TABLE_INITIAL_SIZE;
+    sub_table = calloc(sub_table_size, sizeof(SubList));
 }
 
-void pubsub_subscribe(int client_fd, const char* topic_name) {
-    pthread_mutex_lock(&pubsub_lock);
-    Topic* target_topic = NULL;
+// Returns the reverse-index list of a connection, or NULL if it has none (pubsub_lock must be held)
+static SubList* sublist_find(conn_handle_t handle) {
+    int fd = HANDLE_FD(handle);
+    if (fd < 0 || fd >= sub_table_size || sub_table[fd].owner != handle) return NULL;
+    return &sub_table[fd];
+}
 
-    for (int i = 0; i < topic_count; i++) {
-        if (strcmp(topics[i].name, topic_name) == 0) {
-            target_topic = &topics[i];
-            break;
+// Swap-removes entry j from a topic and repairs the back-index of the subscriber moved into its place
+static void topic_remove_at(Topic* t, int j) {
+    topic_touch(t, 1);
+    filter_unref(t->subscribers[j].filter);
+    int last = --t->sub_count;
+    if (j != last) {
+        t->subscribers[j] = t->subscribers[last];
+        SubList* moved = sublist_find(t->subscribers[j].handle);
+        moved->items[t->subscribers[j].sub_slot].pos = j;
+    }
+}
+
+// Swap-removes entry k from a connection's list and repairs the topic entry that points at the moved subscription
+static void sublist_remove_at(SubList* l, int k) {
+    int last = --l->count;
+    if (k != last) {
+        l->items[k] = l->items[last];
+        topics[l->items[k].topic_id]->subscribers[l->items[k].pos].sub_slot = k;
+    }
+}
+
+// Drops every subscription of the connection that owns a reverse-index list (pubsub_lock must be held)
+static void sublist_clear(SubList* l) {
+    // Removing from the tail never moves another entry of this list
+    while (l->count > 0) {
+        Subscription* s = &l->items[l->count - 1];
+        topic_remove_at(topics[s->topic_id], s->pos);
+        l->count--;
+    }
+    free(l->items);
+    memset(l, 0, sizeof(SubList));
+}
+
+int pubsub_subscribe(conn_handle_t handle, const char* topic_name, SubFilter* filter) {
+    if (topic_name[0] == '@' || !topic_is_valid_filter(topic_name)) { // "@" names are direct targets, not topics
+        filter_unref(filter);
+        return 0;
+    }
+
+    Topic* t = topic_intern(topic_name);
+    membership_lock();
+
+    int fd = HANDLE_FD(handle);
+    if (fd >= sub_table_size) {
+        int new_size = sub_table_size;
+        while (new_size <= fd) new_size *= 2;
+        sub_table = realloc(sub_table, sizeof(SubList) * new_size);
+        memset(&sub_table[sub_table_size], 0, sizeof(SubList) * (new_size - sub_table_size));
+        sub_table_size = new_size;
+    }
+
+    SubList* l = &sub_table[fd];
+    if (l->owner != handle) {
+        // Anything left here belongs to an earlier connection on this fd that was never cleaned up
+        sublist_clear(l);
+        l->owner = handle;
+    }
+
+    // Duplicate check over this connection's own subscriptions, not the topic's subscribers
+    for (int k = 0; k < l->count; k++) {
+        if (l->items[k].topic_id == t->id) {
+            // Subscribing again replaces the content filter
+            Subscriber* existing = &t->subscribers[l->items[k].pos];
+            filter_unref(existing->filter);
+            existing->filter = filter;
+            topic_touch(t, 1);
+            membership_unlock();
+            return 1;
         }
     }
 
-    if (target_topic == NULL && topic_count < MAX_TOPICS) {
-        target_topic = &topics[topic_count];
-        strncpy(target_topic->name, topic_name, 63);
-        target_topic->name[63] = '\0';
-        target_topic->sub_count = 0;
-        topic_count++;
+    if (t->sub_count == t->sub_capacity) {
+        t->sub_capacity = t->sub_capacity ? t->sub_capacity * 2 : TOPIC_SUBS_INITIAL_CAPACITY;
+        t->subscribers = realloc(t->subscribers, sizeof(Subscriber) * t->sub_capacity);
+    }
+    if (l->count == l->capacity) {
+        l->capacity = l->capacity ? l->capacity * 2 : TOPIC_SUBS_INITIAL_CAPACITY;
+        l->items = realloc(l->items, sizeof(Subscription) * l->capacity);
     }
 
-    if (target_topic != NULL && target_topic->sub_count < MAX_SUBSCRIBERS_PER_TOPIC) {
-        int already_subscribed = 0;
-        for (int i = 0; i < target_topic->sub_count; i++) {
-            if (target_topic->subscribers[i] == client_fd) {
-                already_subscribed = 1;
+    topic_touch(t, 0);
+    t->subscribers[t->sub_count] = (Subscriber){ handle, l->count, filter };
+    l->items[l->count] = (Subscription){ t->id, t->sub_count };
+    t->sub_count++;
+    l->count++;
+    membership_unlock();
+    return 1;
+}
+
+void pubsub_unsubscribe(conn_handle_t handle, const char* topic_name) {
+    membership_lock();
+    Topic* t = topic_lookup(topic_name, 0, NULL);
+    SubList* l = sublist_find(handle);
+
+    if (t && l) {
+        for (int k = 0; k < l->count; k++) {
+            if (l->items[k].topic_id == t->id) {
+                topic_remove_at(t, l->items[k].pos);
+                sublist_remove_at(l, k);
                 break;
             }
         }
-        if (!already_subscribed) {
-            target_topic->subscribers[target_topic->sub_count] = client_fd;
-            target_topic->sub_count++;
+    }
+    membership_unlock();
+}
+
+void pubsub_unsubscribe_all(conn_handle_t handle) {
+    membership_lock();
+    SubList* l = sublist_find(handle);
+    if (l) sublist_clear(l);
+    membership_unlock();
+}
+
+void pubsub_replay_cancel(Client* c, const char* topic_name) {
+    Replay** link = &c->replay;
+    while (*link) {
+        Replay* r = *link;
+        if (topic_name == NULL || strcmp(r->topic->name, topic_name) == 0) {
+            *link = r->next;
+            filter_unref(r->filter);
+            free(r);
+        } else {
+            link = &r->next;
         }
     }
-    pthread_mutex_unlock(&pubsub_lock);
 }
 
-void pubsub_unsubscribe(int client_fd, const char* topic_name) {
-    pthread_mutex_lock(&pubsub_lock);
+long long pubsub_subscribe_from(Client* c, const char* topic_name, SubFilter* filter, long long offset) {
+    if (topic_name[0] == '@' || topic_has_wildcard(topic_name) || !topic_is_valid_filter(topic_name)) {
+        filter_unref(filter);
+        return -2;
+    }
+
+    Topic* t = topic_intern(topic_name);
+    if (t->log == NULL) return pubsub_subscribe(c->handle, topic_name, filter) ? -1 : -2;
+
+    // Starting over from an offset replaces whatever this client already had running on the topic
+    pubsub_unsubscribe(c->handle, topic_name);
+    pubsub_replay_cancel(c, topic_name);
+
+    long long first, next;
+    topiclog_bounds(t->log, &first, &next);
+    if (offset < first) offset = first;
+    if (offset > next) offset = next;
+
+    Replay* r = calloc(1, sizeof(Replay));
+    r->topic = t;
+    r->offset = offset;
+    r->filter = filter;
+    Replay** link = &c->replay;
+    while (*link) link = &(*link)->next;
+    *link = r;
+    return offset;
+}
+
+// Judges a stored frame (a log record or a retained message) against a subscription filter, the same way
+// a live publish would be
+static int frame_accepts(SubFilter* f, Client* c, const Message* record) {
+    const char* bracket = memchr(record->data, ']', record->len);
+    const char* verb = bracket ? bracket + 2 : record->data;
+    int verb_len = strcspn(verb, " \t\n");
+    return filter_match_verb(f, verb, verb_len) && (!f->needs_state || filter_match_state(f, c));
+}
+
+void pubsub_replay_pump(Client* c) {
+    Replay* r = c->replay;
+    if (r == NULL) return;
+    TopicLog* log = r->topic->log;
 
-    for (int i = 0; i < topic_count; i++) {
-        if (strcmp(topics[i].name, topic_name) == 0) {
-            for (int j = 0; j < topics[i].sub_count; j++) {
-                if (topics[i].subscribers[j] == client_fd) {
-                    for (int k = j; k < topics[i].sub_count - 1; k++) {
-                        topics[i].subscribers[k] = topics[i].subscribers[k + 1];
-                    }
-                    topics[i].sub_count--;
-                    break;
-                }
+    while (c->out.bytes < REPLAY_BATCH_BYTES) {
+        // Without a filter, runs of records go out as single views of the mapped segment; with one, each record is judged
+        Message* m = topiclog_read(log, &r->offset, r->filter ? 1 : REPLAY_BATCH_RECORDS, REPLAY_BATCH_BYTES);
+        if (m == NULL) {
+            // Caught up. Registering under the log lock means every later append finds this client in its snapshot.
+            topiclog_lock(log);
+            if (r->offset < topiclog_next_offset(log)) {
+                topiclog_unlock(log); // More was appended in the meantime
+                continue;
             }
+            pubsub_subscribe(c->handle, r->topic->name, r->filter);
+            topiclog_unlock(log);
+
+            c->replay = r->next;
+            free(r);
+            return;
+        }
+
+        if (r->filter == NULL || frame_accepts(r->filter, c, m)) outq_push_msg(&c->out, c->binary ? msg_binary(m) : m);
+        msg_unref(m);
+    }
+}
+
+typedef struct {
+    Client* c;
+    SubFilter* filter;
+} RetainedDelivery;
+
+static void deliver_retained(void* ctx, const char* topic, Message* msg) {
+    RetainedDelivery* rd = ctx;
+    if (rd->filter && !frame_accepts(rd->filter, rd->c, msg)) return;
+    client_deliver(rd->c, msg, topic);
+}
+
+void pubsub_deliver_retained(Client* c, const char* topic_name) {
+    // The subscription's own filter decides, exactly as it will for live publishes
+    RetainedDelivery rd = { c, NULL };
+    pthread_mutex_lock(&pubsub_lock);
+    Topic* t = topic_lookup(topic_name, 0, NULL);
+    SubList* l = sublist_find(c->handle);
+    for (int k = 0; t && l && k < l->count; k++) {
+        if (l->items[k].topic_id == t->id) {
+            SubFilter* f = t->subscribers[l->items[k].pos].filter;
+            rd.filter = f ? filter_ref(f) : NULL;
             break;
         }
     }
     pthread_mutex_unlock(&pubsub_lock);
+
+    retained_foreach(topic_name, deliver_retained, &rd);
+    filter_unref(rd.filter);
 }
 
-void pubsub_unsubscribe_all(int client_fd) {
-    pthread_mutex_lock(&pubsub_lock);
+// Notes a host a tracked command was queued for. Only the publishing thread touches d, so this needs no lock.
+static void delivery_add_host(Delivery* d, const char* hostname) {
+    if (d->host_count == d->host_capacity) {
+        d->host_capacity = d->host_capacity ? d->host_capacity * 2 : 16;
+        d->hosts = realloc(d->hosts, sizeof(char*) * d->host_capacity);
+    }
+    d->hosts[d->host_count++] = strdup(hostname);
+}
 
-    for (int i = 0; i < topic_count; i++) {
-        for (int j = 0; j < topics[i].sub_count; j++) {
-            if (topics[i].subscribers[j] == client_fd) {
-                for (int k = j; k < topics[i].sub_count - 1; k++) {
-                    topics[i].subscribers[k] = topics[i].subscribers[k + 1];
-                }
-                topics[i].sub_count--;
-                break;
+// Delivers once to a connection that one or more matching subscriptions point at. When filters are attached,
+// the message goes out if any of those subscriptions accepts it; rejected messages are never queued or encrypted.
+static void deliver(Delivery* d, const SnapEntry* group, int n) {
+    int unfiltered = 0;
+    int verb_ok = 0;
+    for (int i = 0; i < n; i++) {
+        if (group[i].filter == NULL) unfiltered = 1;
+        else if (filter_match_verb(group[i].filter, d->verb, d->verb_len)) verb_ok = 1;
+    }
+    if (!unfiltered && !verb_ok) return; // Settled on the payload alone, without locking the subscriber
+
+    // Safely lock the specific user struct inside the publication loop (a reused fd never matches an old handle)
+    Client* c = client_get_and_lock(group[0].handle);
+    if (c == NULL) return;
+
+    int accepted = unfiltered;
+    for (int i = 0; i < n && !accepted; i++) {
+        SubFilter* f = group[i].filter;
+        accepted = filter_match_verb(f, d->verb, d->verb_len) && (!f->needs_state || filter_match_state(f, c));
+    }
+    // Queued, never blocking: a congested subscriber no longer stalls this publisher
+    if (accepted && d->collect) delivery_add_host(d, c->hostname);
+    else if (accepted && client_deliver(c, d->msg, d->topic_name) && d->track) delivery_add_host(d, c->hostname);
+    client_unlock(c);
+}
+
+static int compare_entries(const void* a, const void* b) {
+    conn_handle_t x = ((const SnapEntry*)a)->handle;
+    conn_handle_t y = ((const SnapEntry*)b)->handle;
+    return (x > y) - (x < y);
+}
+
+// Fans out to the union of several snapshots, so a connection whose subscriptions overlap gets the message once
+static void deliver_union(SubSnapshot** snaps, int n, Delivery* d) {
+    int largest = 0;
+    int filtered = 0;
+    for (int i = 0; i < n; i++) {
+        if (snaps[i]->count > snaps[largest]->count) largest = i;
+        filtered |= snaps[i]->filtered;
+    }
+
+    // Without filters, the largest set is streamed as-is; only the others are merged and sorted, and looked up
+    // with a binary search. With filters, every set is merged so each connection's subscriptions are judged together.
+    int merged_count = 0;
+    for (int i = 0; i < n; i++) {
+        if (filtered || i != largest) merged_count += snaps[i]->count;
+    }
+    SnapEntry* merged = malloc(sizeof(SnapEntry) * (merged_count + 1));
+    merged_count = 0;
+    for (int i = 0; i < n; i++) {
+        if (!filtered && i == largest) continue;
+        memcpy(&merged[merged_count], snaps[i]->entries, sizeof(SnapEntry) * snaps[i]->count);
+        merged_count += snaps[i]->count;
+    }
+    qsort(merged, merged_count, sizeof(SnapEntry), compare_entries);
+
+    for (int i = 0; i < merged_count; ) {
+        int end = i + 1;
+        while (end < merged_count && merged[end].handle == merged[i].handle) end++;
+        deliver(d, &merged[i], end - i);
+        i = end;
+    }
+
+    if (!filtered) {
+        SubSnapshot* big = snaps[largest];
+        for (int j = 0; j < big->count; j++) {
+            if (!bsearch(&big->entries[j], merged, merged_count, sizeof(SnapEntry), compare_entries)) {
+                deliver(d, &big->entries[j], 1);
             }
         }
     }
-    pthread_mutex_unlock(&pubsub_lock);
+    free(merged);
 }
 
-void pubsub_publish(const char* topic_name, const char* message) {
-    pthread_mutex_lock(&pubsub_lock);
+// Delivers to the hosts named by an "@hostname" or "@glob" target without touching the topic registry
+static void publish_direct(Delivery* d, const char* attrs, const char* message, size_t message_len) {
+    const char* target = d->topic_name;
+    const char* pattern = target + 1;
 
-    char formatted_msg[1024];
-    snprintf(formatted_msg, sizeof(formatted_msg), "[%s] %s\n", topic_name, message);
-    int msg_len = strlen(formatted_msg);
-
-    for (int i = 0; i < topic_count; i++) {
-        if (strcmp(topics[i].name, topic_name) == 0) {
-            for (int j = 0; j < topics[i].sub_count; j++) {
-                int client_fd = topics[i].subscribers[j];
-
-                // Safely lock the specific user struct inside the publication loop
-                Client* c = client_get_and_lock_by_fd(client_fd);
-                if (c != NULL) {
-                    if (c->ssl != NULL) {
-                        SSL_write(c->ssl, formatted_msg, msg_len);
-                    } else if (c->fd > 0) {
-                        write(c->fd, formatted_msg, msg_len);
-                    }
-                    client_unlock(c);
-                }
+    if (strpbrk(pattern, "*?[") == NULL) {
+        // A single host resolves through the hostname map in O(1)
+        Client* c = client_get_and_lock_by_hostname(pattern);
+        if (c && d->collect) {
+            delivery_add_host(d, c->hostname);
+            client_unlock(c);
+        } else if (c) {
+            Message* msg = msg_alloc_publish(target, attrs, message, message_len);
+            if (client_deliver(c, msg, target) && d->track) delivery_add_host(d, c->hostname);
+            client_unlock(c);
+            msg_unref(msg);
+        }
+        return;
+    }
+
+    conn_handle_t* handles;
+    int count = client_match_hostnames(pattern, &handles);
+    if (count > 0) {
+        d->msg = d->collect ? NULL : msg_alloc_publish(target, attrs, message, message_len);
+        for (int i = 0; i < count; i++) {
+            SnapEntry entry = { handles[i], NULL };
+            deliver(d, &entry, 1);
+        }
+        if (d->msg) msg_unref(d->msg);
+    }
+    free(handles);
+}
+
+// Publishes with optional frame attributes; d names the topic and carries the tracking state
+static void publish(Delivery* d, const char* attrs, const char* message, size_t message_len) {
+    const char* topic_name = d->topic_name;
+    if (topic_name[0] == '@') {
+        publish_direct(d, attrs, message, message_len);
+        return;
+    }
+    if (topic_has_wildcard(topic_name)) return; // Wildcards only make sense in subscriptions
+
+    MatchSet m = { .count = 0, .capacity = MATCH_INLINE_CAPACITY };
+    m.items = m.inline_items;
+
+    // Only the lookups and the reference grabs run inside the epoch section; the fanout itself may take a while
+    epoch_enter();
+    Topic* t = topic_find(topic_name);
+    if (t == NULL && topiclog_is_durable(topic_name)) {
+        // A durable topic is logged even while nobody is subscribed to it. Its log may take a while to open,
+        // which is no reason to hold back reclamation.
+        epoch_exit();
+        t = topic_intern(topic_name);
+        epoch_enter();
+    }
+    if (t) match_add(&m, t);
+    if (atomic_load_explicit(&filter_count, memory_order_relaxed) > 0) trie_match(&trie_root, topic_name, &m);
+
+    // Appending and taking the snapshots under the log lock makes the offset order agree with who received each
+    // record live, which is what lets a replaying subscriber switch over to live delivery without a gap
+    Message* msg = NULL;
+    TopicLog* log = (t && !d->collect) ? t->log : NULL;
+    if (log) {
+        topiclog_lock(log);
+        msg = topiclog_append(log, topic_name, attrs, message, message_len);
+    }
+
+    SubSnapshot* inline_snaps[MATCH_INLINE_CAPACITY];
+    SubSnapshot** snaps = (m.count <= MATCH_INLINE_CAPACITY) ? inline_snaps : malloc(sizeof(SubSnapshot*) * m.count);
+    int total = 0;
+    for (int i = 0; i < m.count; i++) {
+        snaps[i] = topic_acquire_snapshot(m.items[i]);
+        total += snaps[i]->count;
+    }
+    if (log) topiclog_unlock(log);
+    epoch_exit();
+
+    if (total > 0) {
+        // A logged publish goes out as the record itself, straight from the mapped segment
+        if (msg == NULL && !d->collect) msg = msg_alloc_publish(topic_name, attrs, message, message_len);
+        d->msg = msg;
+        d->verb = message;
+        d->verb_len = strcspn(message, " \t");
+
+        if (m.count == 1) {
+            for (int j = 0; j < snaps[0]->count; j++) {
+                deliver(d, &snaps[0]->entries[j], 1);
             }
-            break;
+        } else {
+            deliver_union(snaps, m.count, d);
         }
     }
-    pthread_mutex_unlock(&pubsub_lock);
+    if (msg) msg_unref(msg);
+
+    for (int i = 0; i < m.count; i++) {
+        snapshot_release(snaps[i]);
+    }
+    if (snaps != inline_snaps) free(snaps);
+    if (m.items != m.inline_items) free(m.items);
+}
+
+void pubsub_publish(const char* topic_name, const char* message, size_t message_len) {
+    Delivery d = { .topic_name = topic_name };
+    publish(&d, NULL, message, message_len);
 }
 
+int pubsub_publish_tracked(const char* topic_name, const char* message, size_t message_len, unsigned long long cid) {
+    char attrs[32];
+    snprintf(attrs, sizeof(attrs), "cid=%llu", cid);
+
+    Delivery d = { .topic_name = topic_name, .track = 1 };
+    publish(&d, attrs, message, message_len);
+
+    int reached = d.host_count;
+    tracker_expect(cid, d.hosts, d.host_count);
+    free(d.hosts);
+    return reached;
+}
+
+int pubsub_collect_recipients(const char* topic_name, const char* message, char*** hostnames) {
+    Delivery d = { .topic_name = topic_name, .collect = 1 };
+    publish(&d, NULL, message, strlen(message));
+    *hostnames = d.hosts;
+    return d.host_count;
+}
+
+// One topic as STATUS prints it, copied out under pubsub_lock
+typedef struct {
+    Topic* topic;
+    SnapEntry* subs;
+    int count;
+} TopicStatus;
+
 void pubsub_print_status() {
+    // Copied out first and printed without pubsub_lock: a log's bounds and the subscribers' hostnames need locks
+    // that come before it in the lock order
     pthread_mutex_lock(&pubsub_lock);
-    printf("\n=== ACTIVE TOPICS ===\n");
+    TopicStatus* status = malloc(sizeof(TopicStatus) * (topic_count + 1));
     int count = 0;
-    for (int i = 0; i < topic_count; i++) {
-        if (topics[i].sub_count > 0) {
-            count++;
-            printf("  [%s]: ", topics[i].name);
-            for (int j = 0; j < topics[i].sub_count; j++) {
-                // Determine Hostname cleanly if possible
-                Client* c = client_get_and_lock_by_fd(topics[i].subscribers[j]);
-                if (c) {
-                    printf("%s ", (strlen(c->hostname) > 0) ? c->hostname : "Pending");
-                    client_unlock(c);
-                } else {
-                    printf("FD:%d ", topics[i].subscribers[j]);
-                }
+    for (uint32_t id = 0; id < topic_count; id++) {
+        Topic* t = topics[id];
+        if (t->sub_count == 0) continue;
+
+        TopicStatus* ts = &status[count++];
+        ts->topic = t;
+        ts->count = t->sub_count;
+        ts->subs = malloc(sizeof(SnapEntry) * t->sub_count);
+        for (int j = 0; j < t->sub_count; j++) {
+            SubFilter* filter = t->subscribers[j].filter;
+            ts->subs[j] = (SnapEntry){ t->subscribers[j].handle, filter ? filter_ref(filter) : NULL };
+        }
+    }
+    pthread_mutex_unlock(&pubsub_lock);
+
+    printf("\n=== ACTIVE TOPICS ===\n");
+    for (int i = 0; i < count; i++) {
+        Topic* t = status[i].topic; // Topics are never freed, and their name and log never change
+        printf("  [%s]", t->name);
+        if (t->log) {
+            long long first, next;
+            topiclog_bounds(t->log, &first, &next);
+            printf(" (durable, offsets %lld-%lld)", first, next - 1);
+        }
+        printf(": ");
+        for (int j = 0; j < status[i].count; j++) {
+            SnapEntry* e = &status[i].subs[j];
+            // Determine Hostname cleanly if possible
+            Client* c = client_get_and_lock(e->handle);
+            if (c) {
+                printf("%s", (strlen(c->hostname) > 0) ? c->hostname : "Pending");
+                if (e->filter) printf("{%s}", e->filter->source);
+                printf(" ");
+                client_unlock(c);
+            } else {
+                printf("FD:%d ", HANDLE_FD(e->handle));
             }
-            printf("\n");
+            filter_unref(e->filter);
         }
+        printf("\n");
+        free(status[i].subs);
     }
     if (count == 0) printf("  No active subscriptions.\n");
     printf("=====================\n\n");
-    pthread_mutex_unlock(&pubsub_lock);
+    free(status);
 }
@@ -1,14 +1,45 @@
 #ifndef PUBSUB_H
 #define PUBSUB_H
 
-#define MAX_TOPICS 50
-#define MAX_SUBSCRIBERS_PER_TOPIC 100
+#include "client_manager.h"
+#include "filter.h"
 
+// Topics are interned into a hash index on first subscribe; neither the number of topics
+// nor the number of subscribers per topic has a compile-time limit.
+// Subscribers are tracked by connection handle, so a reused fd never inherits old subscriptions.
+// Subscriptions may use the '+' and '#' wildcards described in topic.h; publishes must name a plain topic.
+// Publishing to "@hostname" or a host glob such as "@desktop-*" delivers straight to the matching
+// connections, with no subscription involved.
 void pubsub_init();
-void pubsub_subscribe(int client_fd, const char* topic_name);
-void pubsub_unsubscribe(int client_fd, const char* topic_name);
-void pubsub_unsubscribe_all(int client_fd);
-void pubsub_publish(const char* topic_name, const char* message);
+// Subscribes with an optional content filter (NULL for none), whose reference the subscription takes over.
+// Subscribing again to the same topic replaces the filter. Returns 0 if topic_name is not a well-formed topic filter.
+int pubsub_subscribe(conn_handle_t handle, const char* topic_name, SubFilter* filter);
+// Subscribes to a durable topic (see topiclog.h) after first streaming its log from offset, so a client that
+// was offline catches up on what it missed. The subscription itself starts once the backlog has been queued,
+// which keeps replayed and live messages in order with no gap or duplicate. c is the subscribing client,
+// locked by the caller; the filter works as in pubsub_subscribe and also applies to the backlog.
+// Returns the offset the replay starts from, -1 if the topic is not durable (the subscription is live only),
+// or -2 if topic_name is not a well-formed topic.
+long long pubsub_subscribe_from(Client* c, const char* topic_name, SubFilter* filter, long long offset);
+// Queues the next stretch of a client's pending backlog (c->lock must be held). client_flush calls it
+// whenever the outbound queue has drained.
+void pubsub_replay_pump(Client* c);
+// Abandons a client's pending backlog for one topic, or all of them when topic_name is NULL (c->lock must be held)
+void pubsub_replay_cancel(Client* c, const char* topic_name);
+// Sends c the retained messages (see retained.h) of every topic its subscription to topic_name covers, subject to
+// that subscription's content filter. Call it right after a successful pubsub_subscribe (c->lock must be held).
+void pubsub_deliver_retained(Client* c, const char* topic_name);
+void pubsub_unsubscribe(conn_handle_t handle, const char* topic_name);
+void pubsub_unsubscribe_all(conn_handle_t handle);
+// Publishes message_len bytes of message, which may hold newlines and NULs when they come from a binary-framed
+// client. Text subscribers get them as spaces; binary-framed ones get the payload exactly.
+void pubsub_publish(const char* topic_name, const char* message, size_t message_len);
+// Publishes a tracked command (see tracker.h): recipients get "[topic cid=N] message" and every host it reaches is
+// recorded as expected to report. Returns the number of deliveries queued.
+int pubsub_publish_tracked(const char* topic_name, const char* message, size_t message_len, unsigned long long cid);
+// Lists the hosts a publish of message to topic_name would reach right now, content filters included, without
+// sending or logging anything. Returns the count; *hostnames and its strings are malloc'd and owned by the caller.
+int pubsub_collect_recipients(const char* topic_name, const char* message, char*** hostnames);
 void pubsub_print_status();
 
 #endif
@@ -0,0 +1,345 @@
+#include "qos.h"
+#include "hash.h"
+#include "timer.h"
+#include "frame.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One message in flight. A slot is free when seq is 0.
+typedef struct {
+    unsigned long long seq;
+    Message* msg;
+    time_t sent_at;
+    int attempts;
+} QosSlot;
+
+// A ring indexed by seq % capacity, so sending and acknowledging are O(1). Everything from base up to next is
+// either outstanding or already acked; base moves past acked slots as they are retired.
+// Deliveries that find the window full wait in the held ring, in order, and take the slots acks free up.
+typedef struct QosWindow {
+    QosSlot* slots;
+    int capacity;
+    unsigned long long base; // Oldest sequence number that may still be outstanding
+    unsigned long long next; // Sequence number of the next message
+    int pending;             // Slots in use
+    Message** held;          // Circular, oldest at held_head
+    int held_head;
+    int held_count;
+    int held_capacity;
+    size_t held_bytes;
+} QosWindow;
+
+// Unacknowledged messages left behind by a disconnected host, oldest first
+typedef struct {
+    char* hostname;
+    Message** msgs;
+    int count;
+    time_t parked_at;
+    int slot; // Position in the parked array
+} ParkedSession;
+
+static int window_capacity = 256;
+static int ack_timeout = 30;
+static int session_expiry = 300;
+
+static HashTable* parked_map;
+static ParkedSession** parked = NULL;
+static int parked_count = 0;
+static int parked_capacity = 0;
+static pthread_mutex_t parked_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Monitoring counters, updated without any lock
+static atomic_ulong stat_delivered;
+static atomic_ulong stat_acked;
+static atomic_ulong stat_redelivered;
+static atomic_ulong stat_held;
+static atomic_ulong stat_unknown_acks;
+static atomic_ulong stat_expired;
+
+void qos_init(int window, int ack_timeout_seconds, int session_expiry_seconds) {
+    if (window > 0) window_capacity = window;
+    if (ack_timeout_seconds > 0) ack_timeout = ack_timeout_seconds;
+    if (session_expiry_seconds >= 0) session_expiry = session_expiry_seconds;
+    parked_map = create_table();
+}
+
+// Queues a message under the given sequence number
+static void push_numbered(Client* c, unsigned long long seq, Message* msg) {
+    char prefix[OUTBOUND_PREFIX_MAX];
+    if (c->binary) {
+        char* end = frame_put_varint(frame_put_header(prefix, OP_SEQ, 0, frame_varint_len(seq)), seq);
+        outq_push_prefixed(&c->out, prefix, end - prefix, msg_binary(msg));
+        return;
+    }
+    int n = snprintf(prefix, sizeof(prefix), "MSG %llu ", seq);
+    outq_push_prefixed(&c->out, prefix, n, msg);
+}
+
+// Places msg in the next free slot and queues it. Returns 0 if the window is full.
+static int window_push(Client* c, Message* msg, time_t now) {
+    QosWindow* w = c->qos;
+    if (w->next - w->base >= (unsigned long long)w->capacity) return 0;
+
+    QosSlot* s = &w->slots[w->next % w->capacity];
+    s->seq = w->next++;
+    s->msg = msg_ref(msg);
+    s->sent_at = now;
+    s->attempts = 1;
+    // The first message in flight brings the client's deadline timer forward to its ack timeout
+    if (w->pending++ == 0) timer_add_before(&c->deadline, now + ack_timeout);
+
+    push_numbered(c, s->seq, msg);
+    return 1;
+}
+
+// Appends a reference to msg to the held ring, growing it as needed
+static void held_push(QosWindow* w, Message* msg) {
+    if (w->held_count == w->held_capacity) {
+        int capacity = w->held_capacity ? w->held_capacity * 2 : 16;
+        Message** grown = malloc(sizeof(Message*) * capacity);
+        for (int i = 0; i < w->held_count; i++) grown[i] = w->held[(w->held_head + i) % w->held_capacity];
+        free(w->held);
+        w->held = grown;
+        w->held_capacity = capacity;
+        w->held_head = 0;
+    }
+    w->held[(w->held_head + w->held_count++) % w->held_capacity] = msg_ref(msg);
+    w->held_bytes += msg->len;
+}
+
+// Takes the oldest held message; the caller inherits its reference
+static Message* held_pop(QosWindow* w) {
+    Message* msg = w->held[w->held_head];
+    w->held_head = (w->held_head + 1) % w->held_capacity;
+    w->held_count--;
+    w->held_bytes -= msg->len;
+    return msg;
+}
+
+// Sends msg if a slot is free and nothing older is waiting, else holds it
+static void window_send(Client* c, Message* msg, time_t now) {
+    if (c->qos->held_count > 0 || !window_push(c, msg, now)) held_push(c->qos, msg);
+}
+
+static void parked_remove(ParkedSession* p) {
+    del(parked_map, p->hostname);
+    ParkedSession* last = parked[--parked_count];
+    parked[p->slot] = last;
+    last->slot = p->slot;
+}
+
+static void parked_free(ParkedSession* p) {
+    for (int i = 0; i < p->count; i++) msg_unref(p->msgs[i]);
+    free(p->msgs);
+    free(p->hostname);
+    free(p);
+}
+
+int qos_enable(Client* c) {
+    if (c->qos) return 0;
+
+    QosWindow* w = calloc(1, sizeof(QosWindow));
+    w->slots = calloc(window_capacity, sizeof(QosSlot));
+    w->capacity = window_capacity;
+    w->base = w->next = 1;
+    c->qos = w;
+
+    pthread_mutex_lock(&parked_lock);
+    ParkedSession* p = (c->hostname[0] != '\0') ? get(parked_map, c->hostname) : NULL;
+    if (p) parked_remove(p);
+    pthread_mutex_unlock(&parked_lock);
+    if (p == NULL) return 0;
+
+    // Whatever does not fit in the window is held, and follows as the agent acks
+    time_t now = time(NULL);
+    int resent = p->count;
+    for (int i = 0; i < p->count; i++) window_send(c, p->msgs[i], now);
+    atomic_fetch_add_explicit(&stat_redelivered, resent, memory_order_relaxed);
+    parked_free(p);
+
+    if (!c->corked) client_flush(c);
+    return resent;
+}
+
+void qos_send(Client* c, Message* msg) {
+    QosWindow* w = c->qos;
+    window_send(c, msg, time(NULL));
+    if (w->held_count > 0) atomic_fetch_add_explicit(&stat_held, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stat_delivered, 1, memory_order_relaxed);
+}
+
+int qos_held(const Client* c, size_t* bytes) {
+    *bytes = c->qos ? c->qos->held_bytes : 0;
+    return c->qos ? c->qos->held_count : 0;
+}
+
+int qos_ack(Client* c, unsigned long long seq) {
+    QosWindow* w = c->qos;
+    QosSlot* s = (w && seq >= w->base && seq < w->next) ? &w->slots[seq % w->capacity] : NULL;
+    if (s == NULL || s->seq != seq) {
+        atomic_fetch_add_explicit(&stat_unknown_acks, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    msg_unref(s->msg);
+    s->msg = NULL;
+    s->seq = 0;
+    w->pending--;
+    while (w->base < w->next && w->slots[w->base % w->capacity].seq == 0) w->base++;
+    atomic_fetch_add_explicit(&stat_acked, 1, memory_order_relaxed);
+
+    // The freed slot goes to the oldest held message
+    if (w->held_count > 0) {
+        time_t now = time(NULL);
+        while (w->held_count > 0 && w->next - w->base < (unsigned long long)w->capacity) {
+            Message* msg = held_pop(w);
+            window_push(c, msg, now);
+            msg_unref(msg);
+        }
+        if (!c->corked) client_flush(c);
+    }
+    return 1;
+}
+
+time_t qos_redeliver_expired(Client* c, time_t now) {
+    QosWindow* w = c->qos;
+    if (w == NULL || w->pending == 0 || c->ssl == NULL || c->write_failed) return 0;
+
+    // Anything still queued has not even reached the agent yet, so there is nothing to time out
+    if (outq_pending(&c->out)) return now + ack_timeout;
+
+    int resent = 0;
+    time_t next_due = 0;
+    for (unsigned long long seq = w->base; seq < w->next; seq++) {
+        QosSlot* s = &w->slots[seq % w->capacity];
+        if (s->seq == 0) continue;
+
+        if (now - s->sent_at >= ack_timeout) {
+            s->sent_at = now;
+            s->attempts++;
+            push_numbered(c, s->seq, s->msg);
+            resent++;
+        }
+        if (next_due == 0 || s->sent_at + ack_timeout < next_due) next_due = s->sent_at + ack_timeout;
+    }
+
+    if (resent > 0) {
+        atomic_fetch_add_explicit(&stat_redelivered, resent, memory_order_relaxed);
+        if (!c->corked) client_flush(c);
+    }
+    return next_due;
+}
+
+void qos_detach(Client* c) {
+    QosWindow* w = c->qos;
+    if (w == NULL) return;
+    c->qos = NULL;
+
+    // Collect the outstanding messages in sequence order, then the held ones; the window's references move to the
+    // parked session
+    Message** msgs = malloc(sizeof(Message*) * (w->pending + w->held_count + 1));
+    int count = 0;
+    for (unsigned long long seq = w->base; seq < w->next; seq++) {
+        QosSlot* s = &w->slots[seq % w->capacity];
+        if (s->seq != 0) msgs[count++] = s->msg;
+    }
+    while (w->held_count > 0) msgs[count++] = held_pop(w);
+    free(w->held);
+    free(w->slots);
+    free(w);
+
+    if (count == 0 || c->hostname[0] == '\0' || session_expiry == 0) {
+        for (int i = 0; i < count; i++) msg_unref(msgs[i]);
+        atomic_fetch_add_explicit(&stat_expired, count, memory_order_relaxed);
+        free(msgs);
+        return;
+    }
+
+    Message** dropped = NULL;
+    int dropped_count = 0;
+
+    pthread_mutex_lock(&parked_lock);
+    ParkedSession* p = get(parked_map, c->hostname);
+    if (p == NULL) {
+        if (parked_count == parked_capacity) {
+            parked_capacity = parked_capacity ? parked_capacity * 2 : 64;
+            parked = realloc(parked, sizeof(ParkedSession*) * parked_capacity);
+        }
+        p = calloc(1, sizeof(ParkedSession));
+        p->hostname = strdup(c->hostname);
+        p->slot = parked_count;
+        parked[parked_count++] = p;
+        set(parked_map, p->hostname, p);
+    }
+
+    // A connection parks all it had in flight or held, which its outbound limits bound. If another connection of this
+    // host already left messages behind, keep the oldest ones, up to a window.
+    int room = (p->count == 0) ? count : window_capacity - p->count;
+    int keep = (count < room) ? count : (room > 0 ? room : 0);
+    p->msgs = realloc(p->msgs, sizeof(Message*) * (p->count + keep));
+    memcpy(&p->msgs[p->count], msgs, sizeof(Message*) * keep);
+    p->count += keep;
+    p->parked_at = time(NULL);
+    if (keep < count) {
+        dropped = &msgs[keep];
+        dropped_count = count - keep;
+    }
+    pthread_mutex_unlock(&parked_lock);
+
+    for (int i = 0; i < dropped_count; i++) msg_unref(dropped[i]);
+    atomic_fetch_add_explicit(&stat_expired, dropped_count, memory_order_relaxed);
+    free(msgs);
+}
+
+void qos_expire_sessions() {
+    time_t now = time(NULL);
+    ParkedSession** expired = NULL;
+    int expired_count = 0;
+
+    pthread_mutex_lock(&parked_lock);
+    for (int i = 0; i < parked_count; ) {
+        ParkedSession* p = parked[i];
+        if (now - p->parked_at < session_expiry) {
+            i++;
+            continue;
+        }
+        parked_remove(p); // Swaps the last session into slot i
+        expired = realloc(expired, sizeof(ParkedSession*) * (expired_count + 1));
+        expired[expired_count++] = p;
+    }
+    pthread_mutex_unlock(&parked_lock);
+
+    // Releasing the messages may unmap log segments, so it happens outside the lock
+    for (int i = 0; i < expired_count; i++) {
+        printf("\n[QoS] Dropping %d unacknowledged message(s) for %s, which did not reconnect.\nadmq> ",
+               expired[i]->count, expired[i]->hostname);
+        fflush(stdout);
+        atomic_fetch_add_explicit(&stat_expired, expired[i]->count, memory_order_relaxed);
+        parked_free(expired[i]);
+    }
+    free(expired);
+}
+
+int qos_unacked(const Client* c) {
+    return c->qos ? c->qos->pending : 0;
+}
+
+void qos_print_status() {
+    pthread_mutex_lock(&parked_lock);
+    int sessions = parked_count;
+    int parked_msgs = 0;
+    for (int i = 0; i < parked_count; i++) parked_msgs += parked[i]->count;
+    pthread_mutex_unlock(&parked_lock);
+
+    printf("\n=== QOS 1 DELIVERY ===\n");
+    printf("  delivered: %lu, acked: %lu, redelivered: %lu\n",
+           atomic_load(&stat_delivered), atomic_load(&stat_acked), atomic_load(&stat_redelivered));
+    printf("  held for a free slot: %lu, unknown acks: %lu, expired: %lu\n",
+           atomic_load(&stat_held), atomic_load(&stat_unknown_acks), atomic_load(&stat_expired));
+    printf("  parked: %d message(s) for %d disconnected host(s)\n", parked_msgs, sessions);
+    printf("======================\n\n");
+}
@@ -0,0 +1,46 @@
+#ifndef QOS_H
+#define QOS_H
+
+#include "client_manager.h"
+
+#include <time.h>
+
+// At-least-once delivery. A vault connection opts in with "QOS 1"; from then on every pub/sub delivery is sent
+// as "MSG <seq> [topic] payload" and stays in the client's window until the agent answers "ACK <seq>".
+// Unacknowledged messages are redelivered once the ack timeout passes, and when a host disconnects they are
+// parked under its hostname so its next connection that enables QoS 1 receives them again.
+// Every function that takes a Client expects c->lock to be held; the window needs no lock of its own.
+
+// Window size (messages in flight per client), ack timeout, and how long a disconnected host's messages are kept
+void qos_init(int window, int ack_timeout_seconds, int session_expiry_seconds);
+
+// Turns QoS 1 on for c. Returns how many parked messages from the host's previous connection were redelivered.
+int qos_enable(Client* c);
+
+// Queues msg with the next sequence number and keeps a reference until it is acknowledged. If the window is full,
+// msg is held, in order, until an ack frees a slot for it.
+void qos_send(Client* c, Message* msg);
+
+// Messages c holds for a free window slot, and their size in *bytes
+int qos_held(const Client* c, size_t* bytes);
+
+// Retires an acknowledged sequence number and sends the oldest held message in its place.
+// Returns 0 if it was not outstanding (unknown or already acked).
+int qos_ack(Client* c, unsigned long long seq);
+
+// Resends the messages that have waited longer than the ack timeout. Called when the client's deadline timer
+// fires; returns when the oldest message still in flight times out next, or 0 if none is.
+time_t qos_redeliver_expired(Client* c, time_t now);
+
+// Releases c's window on disconnect, parking whatever is still unacknowledged or held under its hostname
+void qos_detach(Client* c);
+
+// Drops parked messages whose host did not come back within the session expiry. Called by the heartbeat.
+void qos_expire_sessions();
+
+// Messages c has in flight
+int qos_unacked(const Client* c);
+
+void qos_print_status();
+
+#endif
@@ -1,4 +1,5 @@
 #include "rbac.h"
+#include "topic.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +8,7 @@
 #define MAX_ROLES 20
 #define MAX_TOPICS 20
 #define MAX_MAPPINGS 50
+#define MAX_TOPIC_POLICIES 50
 
 typedef struct {
     char name[64];
@@ -14,8 +16,14 @@ typedef struct {
     char unsub_topics[MAX_TOPICS][64];  int unsub_count;  int unsub_wildcard;
     char pub_topics[MAX_TOPICS][64];  int pub_count;  int pub_wildcard;
     char set_keys[MAX_TOPICS][64];    int set_count;  int set_wildcard;
+    int overflow;
 } Role;
 
+typedef struct {
+    char topic[64];
+    int overflow;
+} TopicPolicy;
+
 typedef struct {
     char pattern[128];
     char role_name[64];
@@ -27,6 +35,9 @@ static int role_count = 0;
 static Mapping mappings[MAX_MAPPINGS];
 static int mapping_count = 0;
 
+static TopicPolicy topic_policies[MAX_TOPIC_POLICIES];
+static int topic_policy_count = 0;
+
 static char* trim_whitespace(char* str) {
     char* end;
     while(isspace((unsigned char)*str)) str++;
@@ -64,6 +75,7 @@ void rbac_init(const char* filepath) {
     char line[512];
     int parsing_map = 0;
     Role* current_role = NULL;
+    TopicPolicy* current_topic = NULL;
 
     while (fgets(line, sizeof(line), file)) {
         char* trimmed = trim_whitespace(line);
@@ -71,6 +83,8 @@ void rbac_init(const char* filepath) {
 
         // Check for section headers
         if (trimmed[0] == '[') {
+            current_role = NULL;
+            current_topic = NULL;
             if (strncmp(trimmed, "[role:", 6) == 0) {
                 parsing_map = 0;
                 char* end = strchr(trimmed, ']');
@@ -79,10 +93,20 @@ void rbac_init(const char* filepath) {
                     current_role = &roles[role_count++];
                     memset(current_role, 0, sizeof(Role));
                     strncpy(current_role->name, trimmed + 6, 63);
+                    current_role->overflow = OVERFLOW_UNSET;
+                }
+            } else if (strncmp(trimmed, "[topic:", 7) == 0) {
+                parsing_map = 0;
+                char* end = strchr(trimmed, ']');
+                if (end && topic_policy_count < MAX_TOPIC_POLICIES) {
+                    *end = '\0';
+                    current_topic = &topic_policies[topic_policy_count++];
+                    memset(current_topic, 0, sizeof(TopicPolicy));
+                    strncpy(current_topic->topic, trimmed + 7, 63);
+                    current_topic->overflow = OVERFLOW_UNSET;
                 }
             } else if (strcmp(trimmed, "[map]") == 0) {
                 parsing_map = 1;
-                current_role = NULL;
             }
             continue;
         }
@@ -103,11 +127,14 @@ void rbac_init(const char* filepath) {
                 else if (strcmp(key, "UNSUBSCRIBE") == 0) parse_list(val, current_role->unsub_topics, &current_role->unsub_count, &current_role->unsub_wildcard);
                 else if (strcmp(key, "PUBLISH") == 0) parse_list(val, current_role->pub_topics, &current_role->pub_count, &current_role->pub_wildcard);
                 else if (strcmp(key, "SET") == 0) parse_list(val, current_role->set_keys, &current_role->set_count, &current_role->set_wildcard);
+                else if (strcmp(key, "OVERFLOW") == 0) current_role->overflow = rbac_parse_overflow_policy(val);
+            } else if (current_topic) {
+                if (strcmp(key, "OVERFLOW") == 0) current_topic->overflow = rbac_parse_overflow_policy(val);
             }
         }
     }
     fclose(file);
-    printf("[RBAC] Loaded %d roles and %d mappings from '%s'\n", role_count, mapping_count, filepath);
+    printf("[RBAC] Loaded %d roles, %d mappings and %d topic policies from '%s'\n", role_count, mapping_count, topic_policy_count, filepath);
 }
 
 // Checks if a string matches a pattern (supports ending with '*')
@@ -134,11 +161,13 @@ static Role* get_role(const char* hostname) {
     return NULL;
 }
 
+// Topic entries are filters: a role listing "site/+/status" may subscribe to "site/lab-3/status" or to
+// "site/+/status" itself, but not to "site/#", which would reach topics the role was never granted
 int rbac_can_subscribe(const char* hostname, const char* topic) {
     Role* r = get_role(hostname);
     if (!r) return 0;
     if (r->sub_wildcard) return 1;
-    for (int i=0; i<r->sub_count; i++) if (strcmp(r->sub_topics[i], topic) == 0) return 1;
+    for (int i=0; i<r->sub_count; i++) if (topic_filter_covers(r->sub_topics[i], topic)) return 1;
     return 0;
 }
 
@@ -146,15 +175,28 @@ int rbac_can_unsubscribe(const char* hostname, const char* topic) {
     Role* r = get_role(hostname);
     if (!r) return 0;
     if (r->unsub_wildcard) return 1;
-    for (int i=0; i<r->unsub_count; i++) if (strcmp(r->set_keys[i], topic) != 0) return 1;
+    for (int i=0; i<r->unsub_count; i++) if (topic_filter_covers(r->unsub_topics[i], topic)) return 1;
     return 0;
 }
 
+// Direct "@host" targets are granted by "@host" entries, or by "@prefix*" entries for any target
+// (including a glob) that starts with the prefix and therefore cannot reach any other host
+static int target_covers(const char* entry, const char* target) {
+    if (entry[0] != '@') return 0;
+    int len = strlen(entry);
+    if (entry[len - 1] == '*' && strcspn(entry, "*?[") == (size_t)(len - 1)) {
+        return strncmp(entry, target, len - 1) == 0;
+    }
+    return strcmp(entry, target) == 0;
+}
+
 int rbac_can_publish(const char* hostname, const char* topic) {
     Role* r = get_role(hostname);
     if (!r) return 0;
     if (r->pub_wildcard) return 1;
-    for (int i=0; i<r->pub_count; i++) if (strcmp(r->pub_topics[i], topic) == 0) return 1;
+    for (int i=0; i<r->pub_count; i++) {
+        if (topic[0] == '@' ? target_covers(r->pub_topics[i], topic) : topic_filter_covers(r->pub_topics[i], topic)) return 1;
+    }
     return 0;
 }
 
@@ -165,3 +207,20 @@ int rbac_can_set(const char* hostname, const char* key) {
     for (int i=0; i<r->set_count; i++) if (strcmp(r->set_keys[i], key) == 0) return 1;
     return 0;
 }
+
+int rbac_parse_overflow_policy(const char* name) {
+    if (strcmp(name, "drop-newest") == 0) return OVERFLOW_DROP_NEWEST;
+    if (strcmp(name, "drop-oldest") == 0) return OVERFLOW_DROP_OLDEST;
+    if (strcmp(name, "disconnect") == 0) return OVERFLOW_DISCONNECT;
+    return OVERFLOW_UNSET;
+}
+
+int rbac_overflow_policy(const char* hostname, const char* topic) {
+    for (int i = 0; i < topic_policy_count; i++) {
+        if (topic_policies[i].overflow != OVERFLOW_UNSET && strcmp(topic_policies[i].topic, topic) == 0) {
+            return topic_policies[i].overflow;
+        }
+    }
+    Role* r = get_role(hostname);
+    return r ? r->overflow : OVERFLOW_UNSET;
+}
@@ -4,10 +4,23 @@
 // Loads the RBAC configurations from the specified file
 void rbac_init(const char* filepath);
 
+// Slow-consumer policies, applied when a subscriber's outbound queue is over its limits
+#define OVERFLOW_UNSET -1
+#define OVERFLOW_DROP_NEWEST 0
+#define OVERFLOW_DROP_OLDEST 1
+#define OVERFLOW_DISCONNECT 2
+
 // Permission Checkers: Returns 1 if authorized, 0 if denied
 int rbac_can_subscribe(const char* hostname, const char* topic);
 int rbac_can_unsubscribe(const char* hostname, const char* topic);
 int rbac_can_publish(const char* hostname, const char* topic);
 int rbac_can_set(const char* hostname, const char* key);
 
+// Parses "drop-newest", "drop-oldest" or "disconnect". Returns OVERFLOW_UNSET for anything else.
+int rbac_parse_overflow_policy(const char* name);
+
+// Resolves the overflow policy for a subscriber on a topic: a [topic:NAME] section wins over the
+// subscriber's role. Returns OVERFLOW_UNSET if neither configures one.
+int rbac_overflow_policy(const char* hostname, const char* topic);
+
 #endif
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+
+#include "reactor.h"
+#include "client_manager.h"
+#include "worker.h"
+
+extern volatile sig_atomic_t keep_running;
+
+static int edge_triggered = 0;
+
+void reactor_set_edge_triggered(int enabled) {
+    edge_triggered = enabled;
+}
+
+int reactor_edge_triggered() {
+    return edge_triggered;
+}
+
+// Edge-triggered connections stay armed for both directions for their whole lifetime
+static uint32_t vault_events() {
+    return edge_triggered ? (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET) : (EPOLLIN | EPOLLONESHOT);
+}
+
+void reactor_rearm(int epoll_fd, int fd, uint64_t handle, int want_write) {
+    if (edge_triggered) return;
+
+    struct epoll_event ev;
+    ev.events = vault_events() | (want_write ? EPOLLOUT : 0);
+    ev.data.u64 = handle;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+// Helper function to make a file descriptor non-blocking
+static void set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags != -1) {
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+}
+
+// Helper function to create a listening socket
+static int create_listening_socket(int port, int reuseport) {
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)); // Allow port re-use during testing
+
+    // Every sharded reactor binds its own socket to the same port and the kernel load-balances new connections
+    if (reuseport && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("ERROR setting SO_REUSEPORT");
+        exit(1);
+    }
+
+    struct sockaddr_in serv_addr;
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port = htons(port);
+
+    if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+        perror("ERROR on binding");
+        exit(1);
+    }
+    listen(sockfd, SOMAXCONN); // Reconnect storms easily overflow a short backlog
+    set_nonblocking(sockfd);
+    return sockfd;
+}
+
+void reactor_init(Reactor* r, int id, int vault_port, int lobby_port, int reuseport, int inline_dispatch) {
+    r->id = id;
+    r->inline_dispatch = inline_dispatch;
+    r->vault_fd = create_listening_socket(vault_port, reuseport);
+    r->lobby_fd = create_listening_socket(lobby_port, reuseport);
+
+    r->epoll_fd = epoll_create1(0);
+    if (r->epoll_fd < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
+
+    // Listeners carry generation 0, which no client handle ever uses
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = HANDLE_MAKE(r->vault_fd, 0);
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->vault_fd, &ev);
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = HANDLE_MAKE(r->lobby_fd, 0);
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->lobby_fd, &ev);
+}
+
+static void accept_vault(Reactor* r) {
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept(r->vault_fd, (struct sockaddr*)&client_addr, &client_len);
+
+        if (client_fd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            break;
+        }
+
+        set_nonblocking(client_fd);
+        conn_handle_t handle = client_add(client_fd, CONN_VAULT, r->epoll_fd);
+
+        // Arm the FD with Epoll
+        struct epoll_event client_ev;
+        client_ev.events = vault_events();
+        client_ev.data.u64 = handle;
+        epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, client_fd, &client_ev);
+    }
+}
+
+static void accept_lobby(Reactor* r) {
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept(r->lobby_fd, (struct sockaddr*)&client_addr, &client_len);
+
+        if (client_fd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            break;
+        }
+
+        set_nonblocking(client_fd);
+
+        // Arm the FD with Epoll
+        struct epoll_event lobby_ev;
+        lobby_ev.events = EPOLLIN | EPOLLONESHOT;
+        lobby_ev.data.u64 = HANDLE_LOBBY_BIT | (uint32_t)client_fd; // Lobby requests have no Client entry
+        epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, client_fd, &lobby_ev);
+    }
+}
+
+void reactor_run(Reactor* r) {
+    struct epoll_event events[MAX_EVENTS];
+
+    while (keep_running) {
+        int nfds = epoll_wait(r->epoll_fd, events, MAX_EVENTS, 1000);
+
+        if (nfds < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            conn_handle_t handle = events[i].data.u64;
+
+            if (handle == HANDLE_MAKE(r->vault_fd, 0)) { // Activity on Vault port
+                accept_vault(r);
+            }
+            else if (handle == HANDLE_MAKE(r->lobby_fd, 0)) { // Activity on Lobby port
+                accept_lobby(r);
+            }
+            else if (r->inline_dispatch) {
+                // Sharded mode: this reactor owns the connection end to end
+                worker_process_event(handle, r->id);
+            }
+            else {
+                // The handle itself is the task, so dispatching allocates nothing
+                queue_write(&task_queue, (void*)(uintptr_t)handle);
+            }
+        }
+    }
+}
+
+void reactor_close(Reactor* r) {
+    close(r->vault_fd);
+    close(r->lobby_fd);
+    close(r->epoll_fd);
+}
@@ -0,0 +1,38 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define MAX_EVENTS 64
+
+// A reactor owns an epoll set and the listening sockets registered on it.
+// In pooled mode a single reactor hands readiness events to the worker pool through task_queue;
+// in sharded mode every reactor accepts on its own SO_REUSEPORT listeners and services its connections inline.
+typedef struct {
+    int id;
+    int epoll_fd;
+    int vault_fd;
+    int lobby_fd;
+    int inline_dispatch;
+    pthread_t tid;
+} Reactor;
+
+// Creates the epoll set and listeners for a reactor. Exits the process if a port cannot be bound.
+void reactor_init(Reactor* r, int id, int vault_port, int lobby_port, int reuseport, int inline_dispatch);
+
+// Runs the event loop on the calling thread until keep_running is cleared
+void reactor_run(Reactor* r);
+
+// Closes the reactor's listeners and epoll set
+void reactor_close(Reactor* r);
+
+// Selects EPOLLET registrations for vault connections instead of EPOLLONESHOT + re-arm (set before any reactor runs)
+void reactor_set_edge_triggered(int enabled);
+int reactor_edge_triggered();
+
+// Re-arms a one-shot vault registration, adding EPOLLOUT when output is waiting for the socket to drain.
+// A no-op in edge-triggered mode, where both directions stay registered.
+void reactor_rearm(int epoll_fd, int fd, uint64_t handle, int want_write);
+
+#endif
@@ -0,0 +1,205 @@
+#include "retained.h"
+#include "db.h"
+#include "hash.h"
+#include "topic.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RETAINED_INITIAL_CAPACITY 64
+
+// One topic with a retained message. Every entry is indexed; only resident ones hold a formatted frame
+// and sit on the LRU list.
+typedef struct RetainedEntry {
+    char* topic;
+    int slot;                       // Position in the entries array
+    Message* msg;                   // NULL while evicted, with the payload only in the database
+    struct RetainedEntry* lru_prev; // Towards the most recently used
+    struct RetainedEntry* lru_next;
+} RetainedEntry;
+
+// A retained message picked up by retained_foreach, delivered once the lock is released
+typedef struct {
+    char* topic;
+    Message* msg;
+} RetainedHit;
+
+static HashTable* retained_map;
+static RetainedEntry** entries = NULL;
+static int entry_count = 0;
+static int entry_capacity = 0;
+
+static RetainedEntry* lru_head = NULL; // Most recently used
+static RetainedEntry* lru_tail = NULL;
+static size_t resident_bytes = 0;
+static size_t budget_bytes = 16 * 1024 * 1024;
+
+static pthread_mutex_t retained_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t entry_cost(const Message* msg) {
+    return sizeof(Message) + msg->len + 1;
+}
+
+static void lru_unlink(RetainedEntry* e) {
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+    else lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+    else lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(RetainedEntry* e) {
+    e->lru_prev = NULL;
+    e->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = e;
+    lru_head = e;
+    if (lru_tail == NULL) lru_tail = e;
+}
+
+// Drops an entry's frame from memory; its payload stays in the database
+static void entry_evict(RetainedEntry* e) {
+    lru_unlink(e);
+    resident_bytes -= entry_cost(e->msg);
+    msg_unref(e->msg);
+    e->msg = NULL;
+}
+
+// Makes msg the entry's resident frame and evicts the least recently used frames until the budget holds
+// (retained_lock must be held). A frame larger than the whole budget is not kept in memory at all.
+static void entry_set_resident(RetainedEntry* e, Message* msg) {
+    if (e->msg) entry_evict(e);
+    if (entry_cost(msg) > budget_bytes) {
+        msg_unref(msg);
+        return;
+    }
+
+    e->msg = msg;
+    resident_bytes += entry_cost(msg);
+    lru_push_front(e);
+    while (resident_bytes > budget_bytes && lru_tail != e) entry_evict(lru_tail);
+}
+
+static RetainedEntry* entry_add(const char* topic) {
+    if (entry_count == entry_capacity) {
+        entry_capacity = entry_capacity ? entry_capacity * 2 : RETAINED_INITIAL_CAPACITY;
+        entries = realloc(entries, sizeof(RetainedEntry*) * entry_capacity);
+    }
+
+    RetainedEntry* e = calloc(1, sizeof(RetainedEntry));
+    e->topic = strdup(topic);
+    e->slot = entry_count;
+    entries[entry_count++] = e;
+    set(retained_map, topic, e);
+    return e;
+}
+
+static void entry_remove(RetainedEntry* e) {
+    if (e->msg) entry_evict(e);
+    del(retained_map, e->topic);
+
+    RetainedEntry* last = entries[--entry_count];
+    entries[e->slot] = last;
+    last->slot = e->slot;
+
+    free(e->topic);
+    free(e);
+}
+
+static void load_row(void* ctx, const char* topic, const char* payload, size_t payload_len) {
+    RetainedEntry* e = get(retained_map, topic);
+    if (e == NULL) e = entry_add(topic);
+    entry_set_resident(e, msg_alloc_publish(topic, "retained", payload, payload_len));
+}
+
+void retained_init(size_t max_bytes) {
+    if (max_bytes > 0) budget_bytes = max_bytes;
+    retained_map = create_table();
+
+    // Rows arrive oldest first, so the most recently retained messages are the ones left resident
+    pthread_mutex_lock(&retained_lock);
+    db_load_retained(NULL, load_row, NULL);
+    if (entry_count > 0) {
+        printf("[Retained] Loaded %d retained message(s), %zu bytes resident.\n", entry_count, resident_bytes);
+    }
+    pthread_mutex_unlock(&retained_lock);
+}
+
+void retained_store(const char* topic, const char* payload, size_t payload_len) {
+    pthread_mutex_lock(&retained_lock);
+    RetainedEntry* e = get(retained_map, topic);
+
+    // The database is written under the same lock so it always ends up agreeing with memory
+    if (payload_len == 0) {
+        if (e) {
+            db_delete_retained(topic);
+            entry_remove(e);
+        }
+    } else {
+        db_set_retained(topic, payload, payload_len);
+        if (e == NULL) e = entry_add(topic);
+        entry_set_resident(e, msg_alloc_publish(topic, "retained", payload, payload_len));
+    }
+    pthread_mutex_unlock(&retained_lock);
+}
+
+static void load_frame(void* ctx, const char* topic, const char* payload, size_t payload_len) {
+    *(Message**)ctx = msg_alloc_publish(topic, "retained", payload, payload_len);
+}
+
+// Returns a referenced frame for an entry, reloading it from the database after an eviction (retained_lock must be held)
+static Message* entry_acquire(RetainedEntry* e) {
+    if (e->msg) {
+        lru_unlink(e);
+        lru_push_front(e);
+        return msg_ref(e->msg);
+    }
+
+    Message* msg = NULL;
+    db_load_retained(e->topic, load_frame, &msg);
+    if (msg) entry_set_resident(e, msg_ref(msg));
+    return msg;
+}
+
+static void hit_add(RetainedHit** hits, int* count, RetainedEntry* e) {
+    Message* msg = entry_acquire(e);
+    if (msg == NULL) return;
+    *hits = realloc(*hits, sizeof(RetainedHit) * (*count + 1));
+    (*hits)[*count] = (RetainedHit){ strdup(e->topic), msg };
+    (*count)++;
+}
+
+void retained_foreach(const char* filter, void (*fn)(void* ctx, const char* topic, Message* msg), void* ctx) {
+    RetainedHit* hits = NULL;
+    int count = 0;
+
+    pthread_mutex_lock(&retained_lock);
+    if (!topic_has_wildcard(filter)) {
+        RetainedEntry* e = get(retained_map, filter);
+        if (e) hit_add(&hits, &count, e);
+    } else {
+        for (int i = 0; i < entry_count; i++) {
+            if (topic_filter_covers(filter, entries[i]->topic)) hit_add(&hits, &count, entries[i]);
+        }
+    }
+    pthread_mutex_unlock(&retained_lock);
+
+    for (int i = 0; i < count; i++) {
+        fn(ctx, hits[i].topic, hits[i].msg);
+        msg_unref(hits[i].msg);
+        free(hits[i].topic);
+    }
+    free(hits);
+}
+
+void retained_print_status() {
+    pthread_mutex_lock(&retained_lock);
+    printf("\n=== RETAINED MESSAGES ===\n");
+    printf("  %d topic(s), %zu of %zu bytes resident\n", entry_count, resident_bytes, budget_bytes);
+    for (int i = 0; i < entry_count; i++) {
+        printf("  [%s]%s\n", entries[i]->topic, entries[i]->msg ? "" : " (on disk)");
+    }
+    printf("=========================\n\n");
+    pthread_mutex_unlock(&retained_lock);
+}
@@ -0,0 +1,25 @@
+#ifndef RETAINED_H
+#define RETAINED_H
+
+#include "outbound.h"
+
+#include <stddef.h>
+
+// Retained last-value messages: a "PUBLISH --retain" keeps its payload as the topic's current value, and every
+// later subscriber receives it right away as "[topic retained] payload". Every retained message is persisted
+// to SQLite. Only the most recently used ones stay formatted in memory, within max_bytes; the rest are
+// reloaded from the database on demand.
+
+// Loads the retained messages of an earlier run (db_init must have been called)
+void retained_init(size_t max_bytes);
+
+// Makes payload_len bytes of payload the retained message of a plain topic, or clears it when there are none
+void retained_store(const char* topic, const char* payload, size_t payload_len);
+
+// Calls fn for the retained message of every topic covered by filter, which may be a plain topic or a
+// wildcard filter. Runs without the store's lock held; msg is only guaranteed to live for the call.
+void retained_foreach(const char* filter, void (*fn)(void* ctx, const char* topic, Message* msg), void* ctx);
+
+void retained_print_status();
+
+#endif
@@ -0,0 +1,298 @@
+#include "rollout.h"
+#include "client_manager.h"
+#include "hash.h"
+#include "pubsub.h"
+#include "tracker.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ROLLOUT_RUNNING 0
+#define ROLLOUT_HALTED 1
+#define ROLLOUT_DONE 2
+
+// Host states beyond the tracker's TRACK_PENDING, TRACK_SUCCEEDED and TRACK_FAILED
+#define HOST_WAITING 3     // Not released yet
+#define HOST_TIMED_OUT 4   // Released, but never reported within the host timeout
+#define HOST_UNREACHABLE 5 // Disconnected by the time its wave went out
+
+#define ROLLOUT_HISTORY 16 // Finished rollouts kept for ROLLOUT STATUS
+
+typedef struct {
+    int id;
+    unsigned long long cid; // The tracked command the agents report against
+    char topic[64];
+    Message* msg;           // "[topic cid=N] message", formatted once and shared by every wave
+
+    char** hosts;           // Every recipient, in release order
+    int* states;
+    time_t* released_at;
+    int host_count;
+    int released;           // hosts[0..released) have been released
+
+    int wave;
+    int concurrency;
+    int max_failure_pct;
+    int state;
+
+    int succeeded;
+    int failed;    // Reported an error or timed out
+    int unreachable;
+    int baseline_released; // Where the failure threshold starts counting (moved forward by a resume)
+    int baseline_failed;
+} Rollout;
+
+static Rollout** rollouts = NULL;
+static int rollout_count = 0;
+static int next_id = 1;
+
+static int default_wave = 100;
+static int default_concurrency = 100;
+static int default_max_failure_pct = 10;
+static int host_timeout = 300;
+
+static pthread_mutex_t rollout_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rollout_wakeup = PTHREAD_COND_INITIALIZER;
+
+static const char* state_name(int state) {
+    if (state == ROLLOUT_RUNNING) return "running";
+    if (state == ROLLOUT_HALTED) return "halted";
+    return "done";
+}
+
+static void rollout_free(Rollout* r) {
+    for (int i = 0; i < r->host_count; i++) free(r->hosts[i]);
+    free(r->hosts);
+    free(r->states);
+    free(r->released_at);
+    msg_unref(r->msg);
+    free(r);
+}
+
+// Releases the next wave (rollout_lock must be held). Hosts that are gone by now do not count against concurrency.
+static void release_wave(Rollout* r, time_t now) {
+    int end = r->released + r->wave;
+    if (end > r->host_count) end = r->host_count;
+
+    char** expected = malloc(sizeof(char*) * (end - r->released));
+    int expected_count = 0;
+    for (int i = r->released; i < end; i++) {
+        Client* c = client_get_and_lock_by_hostname(r->hosts[i]);
+        int sent = c && client_deliver(c, r->msg, r->topic);
+        client_unlock(c);
+
+        if (sent) {
+            r->states[i] = TRACK_PENDING;
+            r->released_at[i] = now;
+            expected[expected_count++] = strdup(r->hosts[i]);
+        } else {
+            r->states[i] = HOST_UNREACHABLE;
+            r->unreachable++;
+        }
+    }
+    r->released = end;
+    tracker_expect(r->cid, expected, expected_count);
+    free(expected);
+}
+
+// Picks up new reports, applies the host timeout and the failure threshold, and releases as many waves as the
+// concurrency allows (rollout_lock must be held)
+static void rollout_advance(Rollout* r, time_t now) {
+    int* pending = malloc(sizeof(int) * (r->released + 1));
+    char** pending_hosts = malloc(sizeof(char*) * (r->released + 1));
+    int pending_count = 0;
+    for (int i = 0; i < r->released; i++) {
+        if (r->states[i] != TRACK_PENDING) continue;
+        pending[pending_count] = i;
+        pending_hosts[pending_count++] = r->hosts[i];
+    }
+
+    int* reported = malloc(sizeof(int) * (pending_count + 1));
+    tracker_host_states(r->cid, pending_hosts, pending_count, reported);
+
+    int in_flight = 0;
+    for (int k = 0; k < pending_count; k++) {
+        int i = pending[k];
+        if (reported[k] == TRACK_PENDING && now - r->released_at[i] >= host_timeout) reported[k] = HOST_TIMED_OUT;
+
+        r->states[i] = reported[k];
+        if (reported[k] == TRACK_SUCCEEDED) r->succeeded++;
+        else if (reported[k] == TRACK_PENDING) in_flight++;
+        else r->failed++;
+    }
+    free(reported);
+    free(pending_hosts);
+    free(pending);
+
+    int released = r->released - r->baseline_released;
+    int failed = r->failed - r->baseline_failed;
+    if (r->state == ROLLOUT_RUNNING && released > 0 && failed * 100 > r->max_failure_pct * released) {
+        r->state = ROLLOUT_HALTED;
+        printf("\n[Rollout] #%d on '%s' halted: %d of %d released host(s) failed (limit %d%%).\nadmq> ",
+               r->id, r->topic, failed, released, r->max_failure_pct);
+        fflush(stdout);
+    }
+
+    while (r->state == ROLLOUT_RUNNING && r->released < r->host_count && in_flight + r->wave <= r->concurrency) {
+        int before = r->released;
+        release_wave(r, now);
+        for (int i = before; i < r->released; i++) in_flight += (r->states[i] == TRACK_PENDING);
+    }
+
+    if (r->state == ROLLOUT_RUNNING && r->released == r->host_count && in_flight == 0) {
+        r->state = ROLLOUT_DONE;
+        printf("\n[Rollout] #%d on '%s' finished: %d succeeded, %d failed, %d unreachable.\nadmq> ",
+               r->id, r->topic, r->succeeded, r->failed, r->unreachable);
+        fflush(stdout);
+    }
+}
+
+static void* rollout_thread_loop(void* arg) {
+    pthread_mutex_lock(&rollout_lock);
+    while (1) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += 1;
+        pthread_cond_timedwait(&rollout_wakeup, &rollout_lock, &until);
+
+        time_t now = time(NULL);
+        for (int i = 0; i < rollout_count; i++) {
+            if (rollouts[i]->state != ROLLOUT_DONE) rollout_advance(rollouts[i], now); // Halted ones still take reports
+        }
+    }
+    return NULL;
+}
+
+void rollout_init(int wave, int concurrency, int max_failure_pct, int host_timeout_seconds) {
+    if (wave > 0) default_wave = wave;
+    if (concurrency > 0) default_concurrency = concurrency;
+    if (max_failure_pct >= 0) default_max_failure_pct = max_failure_pct;
+    if (host_timeout_seconds > 0) host_timeout = host_timeout_seconds;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, rollout_thread_loop, NULL) != 0) {
+        perror("Failed to start rollout thread");
+        return;
+    }
+    pthread_detach(tid);
+}
+
+// Drops the oldest finished rollout once enough are kept (rollout_lock must be held)
+static void prune_finished() {
+    int finished = 0;
+    for (int i = 0; i < rollout_count; i++) finished += (rollouts[i]->state == ROLLOUT_DONE);
+    if (finished < ROLLOUT_HISTORY) return;
+
+    for (int i = 0; i < rollout_count; i++) {
+        if (rollouts[i]->state != ROLLOUT_DONE) continue;
+        rollout_free(rollouts[i]);
+        memmove(&rollouts[i], &rollouts[i + 1], sizeof(Rollout*) * (rollout_count - i - 1));
+        rollout_count--;
+        return;
+    }
+}
+
+int rollout_start(const char* topic_name, const char* message, int wave, int concurrency, int max_failure_pct) {
+    char** recipients;
+    int count = pubsub_collect_recipients(topic_name, message, &recipients);
+
+    // A host with several connections is released once
+    Rollout* r = calloc(1, sizeof(Rollout));
+    r->hosts = malloc(sizeof(char*) * (count + 1));
+    HashTable* seen = create_table();
+    for (int i = 0; i < count; i++) {
+        if (get(seen, recipients[i])) {
+            free(recipients[i]);
+            continue;
+        }
+        set(seen, recipients[i], r);
+        r->hosts[r->host_count++] = recipients[i];
+    }
+    free_table(seen);
+    free(recipients);
+
+    if (r->host_count == 0) {
+        free(r->hosts);
+        free(r);
+        return 0;
+    }
+
+    r->states = malloc(sizeof(int) * r->host_count);
+    for (int i = 0; i < r->host_count; i++) r->states[i] = HOST_WAITING;
+    r->released_at = calloc(r->host_count, sizeof(time_t));
+    strncpy(r->topic, topic_name, sizeof(r->topic) - 1);
+    r->wave = (wave > 0) ? wave : default_wave;
+    // A custom wave size without a concurrency runs one wave at a time
+    r->concurrency = (concurrency > 0) ? concurrency : (wave > 0) ? r->wave : default_concurrency;
+    if (r->concurrency < r->wave) r->concurrency = r->wave; // Otherwise no wave could ever go out
+    r->max_failure_pct = (max_failure_pct >= 0) ? max_failure_pct : default_max_failure_pct;
+    r->state = ROLLOUT_RUNNING;
+
+    r->cid = tracker_begin(topic_name, message);
+    r->msg = msg_alloc(strlen(topic_name) + strlen(message) + 32);
+    r->msg->len = sprintf(r->msg->data, "[%s cid=%llu] %s\n", topic_name, r->cid, message);
+    r->msg->topic_len = strlen(topic_name);
+
+    pthread_mutex_lock(&rollout_lock);
+    prune_finished();
+    r->id = next_id++;
+    rollouts = realloc(rollouts, sizeof(Rollout*) * (rollout_count + 1));
+    rollouts[rollout_count++] = r;
+    pthread_cond_signal(&rollout_wakeup); // The first wave goes out right away, from the rollout thread
+    pthread_mutex_unlock(&rollout_lock);
+
+    return r->id;
+}
+
+// Finds a rollout by id (rollout_lock must be held)
+static Rollout* rollout_find(int id) {
+    for (int i = 0; i < rollout_count; i++) {
+        if (rollouts[i]->id == id) return rollouts[i];
+    }
+    return NULL;
+}
+
+int rollout_halt(int id) {
+    pthread_mutex_lock(&rollout_lock);
+    Rollout* r = rollout_find(id);
+    int ok = r && r->state == ROLLOUT_RUNNING;
+    if (ok) r->state = ROLLOUT_HALTED;
+    pthread_mutex_unlock(&rollout_lock);
+    return ok;
+}
+
+int rollout_resume(int id) {
+    pthread_mutex_lock(&rollout_lock);
+    Rollout* r = rollout_find(id);
+    int ok = r && r->state == ROLLOUT_HALTED;
+    if (ok) {
+        r->state = ROLLOUT_RUNNING;
+        r->baseline_released = r->released;
+        r->baseline_failed = r->failed;
+        pthread_cond_signal(&rollout_wakeup);
+    }
+    pthread_mutex_unlock(&rollout_lock);
+    return ok;
+}
+
+void rollout_print_status() {
+    printf("\n=== ROLLOUTS ===\n");
+    pthread_mutex_lock(&rollout_lock);
+    for (int i = 0; i < rollout_count; i++) {
+        Rollout* r = rollouts[i];
+        int pending = 0;
+        for (int j = 0; j < r->released; j++) pending += (r->states[j] == TRACK_PENDING);
+
+        printf("  #%d [%s] command #%llu, %s: %d/%d released, %d running, %d succeeded, %d failed",
+               r->id, r->topic, r->cid, state_name(r->state), r->released, r->host_count, pending,
+               r->succeeded, r->failed);
+        if (r->unreachable > 0) printf(", %d unreachable", r->unreachable);
+        printf(" (wave %d, concurrency %d, max failures %d%%)\n", r->wave, r->concurrency, r->max_failure_pct);
+    }
+    if (rollout_count == 0) printf("  No rollouts.\n");
+    pthread_mutex_unlock(&rollout_lock);
+    printf("================\n");
+}
@@ -0,0 +1,25 @@
+#ifndef ROLLOUT_H
+#define ROLLOUT_H
+
+// Staged rollouts: instead of reaching every subscriber at once, a command is released to the hosts subscribed
+// at the start in waves. A new wave goes out once enough earlier hosts have reported back on agent-status (see
+// tracker.h) that no more than `concurrency` are still running. The rollout halts by itself when more than
+// max_failure_pct percent of the hosts released so far have failed or not reported within the host timeout.
+// A background thread drives every rollout once a second; starting one never blocks the caller.
+
+// Defaults for rollouts that do not set their own, and how long a released host may take to report
+void rollout_init(int wave, int concurrency, int max_failure_pct, int host_timeout_seconds);
+
+// Starts rolling message out to the current recipients of topic_name. A size of 0 (or a max_failure_pct below 0)
+// takes the default, except that a custom wave with no concurrency releases one wave at a time.
+// Returns the rollout id, or 0 if there is nobody to roll out to.
+int rollout_start(const char* topic_name, const char* message, int wave, int concurrency, int max_failure_pct);
+
+// Stops releasing new waves, or lets a halted rollout go on (its failure threshold then counts from that point).
+// Returns 0 if the rollout is unknown or already finished.
+int rollout_halt(int id);
+int rollout_resume(int id);
+
+void rollout_print_status();
+
+#endif
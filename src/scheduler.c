@@ -0,0 +1,264 @@
+#include "scheduler.h"
+#include "db.h"
+#include "pubsub.h"
+#include "timer.h"
+#include "tracker.h"
+#include "ts_queue.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    Timer timer;  // First, so the timer callback can recover the entry
+    long long id; // Row id in scheduled_publishes
+    time_t fire_at;
+    char* sender; // Empty for the admin CLI
+    char* topic;
+    char* message;
+    size_t message_len;
+    int cancelled; // Cancelled after its timer had already fired; the callback drops it
+} ScheduledPublish;
+
+static ScheduledPublish** pending = NULL; // Unordered; SCHEDULED sorts a copy
+static int pending_count = 0;
+static int pending_capacity = 0;
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Entries whose timer fired, waiting for the publisher thread. The timer thread also drives every client's
+// deadline, so it only hands them over; the fanout and the database writes happen here.
+static ts_queue_t fired;
+
+static void entry_free(ScheduledPublish* s) {
+    free(s->sender);
+    free(s->topic);
+    free(s->message);
+    free(s);
+}
+
+// Unlinks s from the pending list (sched_lock must be held)
+static void pending_remove(ScheduledPublish* s) {
+    for (int i = 0; i < pending_count; i++) {
+        if (pending[i] != s) continue;
+        pending[i] = pending[--pending_count];
+        return;
+    }
+}
+
+static void scheduled_fire(Timer* t) {
+    ScheduledPublish* s = (ScheduledPublish*)t;
+
+    pthread_mutex_lock(&sched_lock);
+    pending_remove(s);
+    pthread_mutex_unlock(&sched_lock);
+
+    queue_write(&fired, s);
+}
+
+// Sends one fired entry (a cancel that came too late to disarm its timer has already marked it)
+static void scheduled_publish(ScheduledPublish* s) {
+    if (!s->cancelled) {
+        if (s->sender[0] == '\0') {
+            // Admin publishes are tracked like the ones typed in directly, so RESULTS follows them too
+            unsigned long long cid = tracker_begin(s->topic, s->message);
+            int reached = pubsub_publish_tracked(s->topic, s->message, s->message_len, cid);
+            printf("\n[Scheduler] #%lld fired on '%s' as command #%llu (%d host%s).\nadmq> ", s->id, s->topic, cid,
+                   reached, reached == 1 ? "" : "s");
+            fflush(stdout);
+        } else {
+            db_log_message(s->sender, s->topic, s->message);
+            pubsub_publish(s->topic, s->message, s->message_len);
+        }
+    }
+
+    // Only forgotten once it is out, so a crash in between sends it again after the restart rather than never
+    db_delete_scheduled(s->id);
+    entry_free(s);
+}
+
+// Files a new entry and arms its timer (sched_lock must be held)
+static void pending_add(long long id, time_t fire_at, const char* sender, const char* topic_name,
+                        const char* message, size_t message_len) {
+    ScheduledPublish* s = calloc(1, sizeof(ScheduledPublish));
+    s->timer.fn = scheduled_fire;
+    s->id = id;
+    s->fire_at = fire_at;
+    s->sender = strdup(sender ? sender : "");
+    s->topic = strdup(topic_name);
+    s->message = malloc(message_len + 1);
+    memcpy(s->message, message, message_len);
+    s->message[message_len] = '\0';
+    s->message_len = message_len;
+
+    if (pending_count == pending_capacity) {
+        pending_capacity = pending_capacity ? pending_capacity * 2 : 16;
+        pending = realloc(pending, sizeof(ScheduledPublish*) * pending_capacity);
+    }
+    pending[pending_count++] = s;
+    timer_add_at(&s->timer, fire_at);
+}
+
+static void load_row(void* ctx, long long id, long long fire_at, const char* sender, const char* topic,
+                     const char* message, size_t message_len) {
+    pending_add(id, (time_t)fire_at, sender, topic, message, message_len);
+    (*(int*)ctx)++;
+}
+
+static void* publisher_thread_loop(void* arg) {
+    (void)arg;
+    void* s;
+    while (queue_read(&fired, &s)) scheduled_publish(s);
+    return NULL;
+}
+
+void scheduler_init() {
+    queue_init(&fired);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, publisher_thread_loop, NULL) != 0) {
+        perror("Failed to start scheduler thread");
+        return;
+    }
+    pthread_detach(tid);
+
+    int loaded = 0;
+    pthread_mutex_lock(&sched_lock);
+    db_load_scheduled(load_row, &loaded);
+    pthread_mutex_unlock(&sched_lock);
+
+    if (loaded > 0) printf("Restored %d scheduled publish(es).\n", loaded);
+}
+
+long long scheduler_add(time_t fire_at, const char* sender, const char* topic_name, const char* message,
+                        size_t message_len) {
+    long long id = db_add_scheduled(fire_at, sender ? sender : "", topic_name, message, message_len);
+    if (id == 0) return 0;
+
+    pthread_mutex_lock(&sched_lock);
+    pending_add(id, fire_at, sender, topic_name, message, message_len);
+    pthread_mutex_unlock(&sched_lock);
+    return id;
+}
+
+int scheduler_cancel(long long id) {
+    pthread_mutex_lock(&sched_lock);
+    ScheduledPublish* s = NULL;
+    for (int i = 0; i < pending_count; i++) {
+        if (pending[i]->id == id && !pending[i]->cancelled) s = pending[i];
+    }
+
+    if (s && timer_cancel(&s->timer)) {
+        pending_remove(s);
+        db_delete_scheduled(s->id);
+        entry_free(s);
+    } else if (s) {
+        s->cancelled = 1; // Already firing: its callback is waiting on sched_lock, and the publisher will drop it
+    }
+    pthread_mutex_unlock(&sched_lock);
+    return s != NULL;
+}
+
+time_t scheduler_parse_at(const char* spec) {
+    int len = strlen(spec);
+    if (len > 0 && (int)strspn(spec, "0123456789") == len) return (time_t)strtoll(spec, NULL, 10);
+
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    int year, month, day, hour, minute, second = 0, end = 0;
+
+    if (sscanf(spec, "%d:%d%n", &hour, &minute, &end) == 2 && end == len) {
+        if (hour < 0 || hour > 23 || minute < 0 || minute > 59) return -1;
+        tm.tm_hour = hour;
+        tm.tm_min = minute;
+        tm.tm_sec = 0;
+        tm.tm_isdst = -1;
+        time_t when = mktime(&tm);
+        if (when <= now) {
+            tm.tm_mday++; // Already past today, so tomorrow; mktime normalises the date
+            tm.tm_isdst = -1;
+            when = mktime(&tm);
+        }
+        return when;
+    }
+
+    int fields = sscanf(spec, "%d-%d-%dT%d:%d%n:%d%n", &year, &month, &day, &hour, &minute, &end, &second, &end);
+    if ((fields == 5 || fields == 6) && end == len) {
+        if (month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 || hour > 23 || minute < 0 || minute > 59 ||
+            second < 0 || second > 60) {
+            return -1;
+        }
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = year - 1900;
+        tm.tm_mon = month - 1;
+        tm.tm_mday = day;
+        tm.tm_hour = hour;
+        tm.tm_min = minute;
+        tm.tm_sec = second;
+        tm.tm_isdst = -1;
+        return mktime(&tm);
+    }
+    return -1;
+}
+
+long scheduler_parse_duration(const char* spec) {
+    if (!isdigit((unsigned char)spec[0])) return -1;
+
+    long total = 0;
+    while (*spec) {
+        char* end;
+        long n = strtol(spec, &end, 10);
+        if (end == spec) return -1;
+
+        long unit;
+        switch (*end) {
+            case '\0': unit = 1; break; // A bare number is seconds
+            case 's': unit = 1; break;
+            case 'm': unit = 60; break;
+            case 'h': unit = 3600; break;
+            case 'd': unit = 86400; break;
+            default: return -1;
+        }
+        total += n * unit;
+        spec = (*end) ? end + 1 : end;
+    }
+    return total;
+}
+
+static int by_fire_time(const void* a, const void* b) {
+    const ScheduledPublish* x = *(ScheduledPublish* const*)a;
+    const ScheduledPublish* y = *(ScheduledPublish* const*)b;
+    if (x->fire_at != y->fire_at) return (x->fire_at < y->fire_at) ? -1 : 1;
+    return (x->id < y->id) ? -1 : (x->id > y->id);
+}
+
+void scheduler_print_status() {
+    printf("\n=== SCHEDULED PUBLISHES ===\n");
+    pthread_mutex_lock(&sched_lock);
+    ScheduledPublish** sorted = malloc(sizeof(ScheduledPublish*) * (pending_count + 1));
+    memcpy(sorted, pending, sizeof(ScheduledPublish*) * pending_count);
+    qsort(sorted, pending_count, sizeof(ScheduledPublish*), by_fire_time);
+
+    time_t now = time(NULL);
+    int shown = 0;
+    for (int i = 0; i < pending_count; i++) {
+        ScheduledPublish* s = sorted[i];
+        if (s->cancelled) continue;
+
+        char when[32];
+        struct tm tm;
+        localtime_r(&s->fire_at, &tm);
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+        long in = (s->fire_at > now) ? (long)(s->fire_at - now) : 0;
+
+        printf("  #%lld at %s (in %lds) -> '%s' from %s: %.48s%s\n", s->id, when, in, s->topic,
+               s->sender[0] ? s->sender : "CLI", s->message, strlen(s->message) > 48 ? "..." : "");
+        shown++;
+    }
+    if (shown == 0) printf("  Nothing scheduled.\n");
+    free(sorted);
+    pthread_mutex_unlock(&sched_lock);
+    printf("  Timers armed: %d\n", timer_pending());
+    printf("===========================\n");
+}
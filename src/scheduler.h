@@ -0,0 +1,35 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include <time.h>
+
+// Scheduled and delayed publishes ("PUBLISH --at <time> ..." / "PUBLISH --in <duration> ..."). Each one is stored in
+// the database and armed on the timer wheel (see timer.h), so thousands can be pending at little cost and they
+// survive a restart; any whose time passed while the broker was down fire right after it comes back. A publish is
+// removed from the database only once it has gone out, so a crash at the wrong moment sends it twice rather than
+// never. Due publishes go out on a scheduler thread of their own, not on the timer thread.
+
+// Starts the scheduler thread, then loads and arms the publishes left over from the last run. Needs the database
+// and the timer thread.
+void scheduler_init();
+
+// Schedules message_len bytes of message for topic_name at fire_at. sender is the publishing host, or NULL for the
+// admin CLI, whose publishes are tracked as commands when they fire. Returns the schedule id, or 0 if it could not
+// be stored.
+long long scheduler_add(time_t fire_at, const char* sender, const char* topic_name, const char* message,
+                        size_t message_len);
+
+// Returns 0 if there is no such pending publish
+int scheduler_cancel(long long id);
+
+// Parses an absolute time: unix seconds, "HH:MM" (the next time the local clock reads it) or
+// "YYYY-MM-DDTHH:MM[:SS]" in local time. Returns -1 if it is malformed.
+time_t scheduler_parse_at(const char* spec);
+
+// Parses a duration such as "90", "90s", "15m", "2h", "1d" or "1h30m". Returns -1 if it is malformed.
+long scheduler_parse_duration(const char* spec);
+
+void scheduler_print_status();
+
+#endif
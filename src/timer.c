@@ -0,0 +1,199 @@
+#include "timer.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_SPAN (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) // Ticks the wheel covers without re-filing
+
+// Level 0 holds the timers due within the next 64 ticks, one slot per tick; each level above covers 64 times
+// the span of the one below, and its slots are cascaded down one at a time as the lower level wraps around.
+static Timer* wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint64_t next_tick; // The next tick to be processed; every armed timer expires at or after it
+static int armed_count = 0;
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The batch that fell due on the current tick. fired[fired_next..fired_count) have yet to run, and running is the
+// one whose callback is executing (NULL between callbacks).
+static Timer** fired = NULL;
+static int fired_count = 0;
+static int fired_next = 0;
+static int fired_capacity = 0;
+static Timer* running = NULL;
+static pthread_cond_t callback_done = PTHREAD_COND_INITIALIZER;
+static pthread_t timer_thread;
+
+static void slot_push(Timer** slot, Timer* t) {
+    t->prev = NULL;
+    t->next = *slot;
+    t->slot = slot;
+    if (*slot) (*slot)->prev = t;
+    *slot = t;
+}
+
+// Files t in the slot its expiry falls into relative to next_tick (timer_lock must be held)
+static void wheel_insert(Timer* t) {
+    uint64_t expires = (t->expires < next_tick) ? next_tick : t->expires;
+    uint64_t delta = expires - next_tick;
+    if (delta >= WHEEL_SPAN) expires = next_tick + WHEEL_SPAN - 1; // Re-filed when its top-level slot cascades
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (level + 1)))) level++;
+    slot_push(&wheel[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK], t);
+}
+
+// Unlinks t from whichever slot holds it (timer_lock must be held)
+static void wheel_remove(Timer* t) {
+    if (t->prev) t->prev->next = t->next;
+    else *t->slot = t->next;
+    if (t->next) t->next->prev = t->prev;
+}
+
+// Moves one slot of a higher level down to where its timers now belong. Returns the slot index, which is 0 when
+// the level has wrapped and the next one up must cascade as well (timer_lock must be held).
+static int cascade(int level) {
+    int index = (next_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    Timer* t = wheel[level][index];
+    wheel[level][index] = NULL;
+    while (t) {
+        Timer* next = t->next;
+        wheel_insert(t);
+        t = next;
+    }
+    return index;
+}
+
+// Processes every tick up to now and collects the timers that fired into the fired batch. It is an array rather
+// than a list because another thread may re-arm or cancel one before its callback runs (timer_lock must be held).
+static void wheel_advance(uint64_t now) {
+    fired_count = 0;
+    fired_next = 0;
+    while (next_tick <= now) {
+        int index = next_tick & WHEEL_MASK;
+        for (int level = 1; index == 0 && level < WHEEL_LEVELS; level++) index = cascade(level);
+
+        Timer* t = wheel[0][next_tick & WHEEL_MASK];
+        wheel[0][next_tick & WHEEL_MASK] = NULL;
+        while (t) {
+            Timer* next = t->next;
+            if (t->expires > next_tick) {
+                wheel_insert(t); // Parked beyond the wheel's span and not due yet
+            } else {
+                t->armed = 0;
+                armed_count--;
+                if (fired_count == fired_capacity) {
+                    fired_capacity = fired_capacity ? fired_capacity * 2 : 64;
+                    fired = realloc(fired, sizeof(Timer*) * fired_capacity);
+                }
+                fired[fired_count++] = t;
+            }
+            t = next;
+        }
+        next_tick++;
+    }
+}
+
+// Files t to fire at when, moving it if it is already armed (timer_lock must be held)
+static void timer_arm(Timer* t, time_t when) {
+    if (t->armed) wheel_remove(t);
+    else armed_count++;
+    t->expires = (when > 0) ? (uint64_t)when : 0;
+    t->armed = 1;
+    wheel_insert(t);
+}
+
+void timer_add_at(Timer* t, time_t when) {
+    pthread_mutex_lock(&timer_lock);
+    timer_arm(t, when);
+    pthread_mutex_unlock(&timer_lock);
+}
+
+void timer_add_in(Timer* t, int seconds) {
+    timer_add_at(t, time(NULL) + seconds);
+}
+
+void timer_add_before(Timer* t, time_t when) {
+    pthread_mutex_lock(&timer_lock);
+    if (!t->armed || t->expires > (uint64_t)(when > 0 ? when : 0)) timer_arm(t, when);
+    pthread_mutex_unlock(&timer_lock);
+}
+
+// Takes t off the wheel, or out of the batch waiting to run. Returns 1 if it was pending (timer_lock must be held).
+static int timer_disarm(Timer* t) {
+    if (t->armed) {
+        wheel_remove(t);
+        t->armed = 0;
+        armed_count--;
+        return 1;
+    }
+    for (int i = fired_next; i < fired_count; i++) {
+        if (fired[i] != t) continue;
+        fired[i] = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+int timer_cancel(Timer* t) {
+    pthread_mutex_lock(&timer_lock);
+    int was_pending = timer_disarm(t);
+    pthread_mutex_unlock(&timer_lock);
+    return was_pending;
+}
+
+void timer_cancel_sync(Timer* t) {
+    pthread_mutex_lock(&timer_lock);
+    timer_disarm(t);
+    // The callback itself may be the caller, in which case there is nothing to wait for
+    while (running == t && !pthread_equal(pthread_self(), timer_thread)) {
+        pthread_cond_wait(&callback_done, &timer_lock);
+        timer_disarm(t); // It may have re-armed itself on the way out
+    }
+    pthread_mutex_unlock(&timer_lock);
+}
+
+int timer_pending() {
+    pthread_mutex_lock(&timer_lock);
+    int count = armed_count;
+    pthread_mutex_unlock(&timer_lock);
+    return count;
+}
+
+static void* timer_thread_loop(void* arg) {
+    while (1) {
+        sleep(1);
+
+        pthread_mutex_lock(&timer_lock);
+        wheel_advance(time(NULL));
+
+        // Callbacks run unlocked, so they can arm timers and take their own locks freely
+        while (fired_next < fired_count) {
+            Timer* t = fired[fired_next++];
+            if (t == NULL) continue; // Cancelled after it fell due
+
+            running = t;
+            pthread_mutex_unlock(&timer_lock);
+            t->fn(t);
+            pthread_mutex_lock(&timer_lock);
+            running = NULL;
+            pthread_cond_broadcast(&callback_done);
+        }
+        pthread_mutex_unlock(&timer_lock);
+    }
+    return NULL;
+}
+
+void timer_init() {
+    next_tick = time(NULL);
+
+    if (pthread_create(&timer_thread, NULL, timer_thread_loop, NULL) != 0) {
+        perror("Failed to start timer thread");
+        return;
+    }
+    pthread_detach(timer_thread);
+}
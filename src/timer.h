@@ -0,0 +1,42 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include <time.h>
+
+// A hierarchical timing wheel with one-second ticks, driven by a single timer thread. Four levels of 64 slots
+// cover about 194 days directly (anything later waits in the top level and is re-filed as it comes closer).
+// Arming and cancelling are O(1), and each tick only touches the timers that are due, plus an occasional cascade
+// of one slot down a level, however many timers are pending.
+//
+// Timers are intrusive: embed a Timer in the object it belongs to and recover the object in the callback.
+typedef struct Timer {
+    struct Timer* next;
+    struct Timer* prev;
+    struct Timer** slot;        // The wheel slot this timer is filed in
+    uint64_t expires;           // Unix time, in seconds, at which the timer fires
+    int armed;                  // Filed in the wheel (cleared once it falls due)
+    void (*fn)(struct Timer* t); // Runs on the timer thread with no lock held; it may re-arm its own timer
+} Timer;
+
+// Starts the timer thread
+void timer_init();
+
+// Arms (or re-arms) t to fire at the given unix time; a time already past fires on the next tick
+void timer_add_at(Timer* t, time_t when);
+void timer_add_in(Timer* t, int seconds);
+
+// Arms t to fire at when, unless it is already armed to fire earlier
+void timer_add_before(Timer* t, time_t when);
+
+// Disarms t. Returns 1 if it was still pending, or 0 if it was not armed or its callback is running right now.
+int timer_cancel(Timer* t);
+
+// Disarms t and, if its callback is running on the timer thread, waits for it to return, so the memory holding t
+// can be freed afterwards. Must not be called with a lock the callback takes, except from the callback itself.
+void timer_cancel_sync(Timer* t);
+
+// Number of timers currently armed
+int timer_pending();
+
+#endif
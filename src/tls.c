@@ -43,6 +43,10 @@ void tls_init(const char* cert_path, const char* key_path, const char* ca_path)
 
     SSL_CTX_set_verify(server_ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
 
+    // Outbound queues flush from non-blocking sockets: let SSL_write report partial progress
+    // and accept a retried write from a different buffer address holding the same bytes.
+    SSL_CTX_set_mode(server_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
 }
 
 void tls_cleanup() {
@@ -0,0 +1,58 @@
+#include "topic.h"
+
+#include <string.h>
+
+// Length of the level starting at s
+static int level_len(const char* s) {
+    const char* slash = strchr(s, '/');
+    return slash ? (int)(slash - s) : (int)strlen(s);
+}
+
+// Start of the level after the one of length len, or NULL if it was the last
+static const char* next_level(const char* s, int len) {
+    return (s[len] == '/') ? s + len + 1 : NULL;
+}
+
+int topic_has_wildcard(const char* name) {
+    return strpbrk(name, "+#") != NULL;
+}
+
+int topic_is_valid_filter(const char* name) {
+    if (name[0] == '\0') return 0;
+
+    for (const char* level = name; level != NULL; ) {
+        int len = level_len(level);
+        const char* next = next_level(level, len);
+
+        if (memchr(level, '+', len) || memchr(level, '#', len)) {
+            if (len != 1) return 0;                    // Wildcards must occupy a whole level
+            if (level[0] == '#' && next != NULL) return 0; // '#' only at the end
+        }
+        level = next;
+    }
+    return 1;
+}
+
+int topic_filter_covers(const char* filter, const char* topic) {
+    const char* f = filter;
+    const char* t = topic;
+
+    while (1) {
+        int flen = level_len(f);
+        if (flen == 1 && f[0] == '#') return 1;
+
+        int tlen = level_len(t);
+        if (flen == 1 && f[0] == '+') {
+            if (tlen == 1 && t[0] == '#') return 0; // One level never covers many
+        } else if (flen != tlen || memcmp(f, t, flen) != 0) {
+            return 0; // A literal level only covers itself
+        }
+
+        const char* f_next = next_level(f, flen);
+        const char* t_next = next_level(t, tlen);
+        if (f_next == NULL) return t_next == NULL;
+        if (t_next == NULL) return strcmp(f_next, "#") == 0; // "a/#" also matches "a"
+        f = f_next;
+        t = t_next;
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef TOPIC_H
+#define TOPIC_H
+
+// Topic names are '/'-separated levels, e.g. "site/lab-3/CMD-GRP-1". Subscriptions may use the
+// wildcards '+' (exactly one level) and '#' (any number of trailing levels, including none);
+// each must make up a whole level, and '#' may only appear last.
+
+int topic_has_wildcard(const char* name);
+
+// Returns 1 if name is a well-formed subscription filter (plain topic names are valid filters too)
+int topic_is_valid_filter(const char* name);
+
+// Returns 1 if every topic matched by `topic` is also matched by `filter`.
+// With a plain topic name this is an ordinary match, so it serves both publishers and subscribers.
+int topic_filter_covers(const char* filter, const char* topic);
+
+#endif
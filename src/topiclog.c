@@ -0,0 +1,577 @@
+#include "topiclog.h"
+#include "hash.h"
+#include "topic.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SEGMENT_INDEX_INITIAL_CAPACITY 256
+#define SEGMENT_SUFFIX ".log"
+#define RECORD_RAW 0x80000000u // Index flag for a record whose payload is stored raw (see topiclog.h)
+
+// One segment file, named after the offset of its first record. Only the newest segment of a log is writable;
+// the others are sealed, trimmed to their written length and only ever read.
+typedef struct {
+    _Atomic int refs;     // The log holds one while the segment is retained; every view of its records holds another
+    long long base;       // Offset of the first record
+    int fd;               // Open only while the segment is writable
+    char* map;
+    size_t map_len;
+    size_t len;           // Bytes written
+    uint32_t* index;      // Where each record starts, with RECORD_RAW set on raw ones
+    int count;
+    int capacity;
+    time_t last_append;
+    char path[512];
+} Segment;
+
+struct TopicLog {
+    char* topic;
+    char dir[384];
+    pthread_mutex_t lock;
+    Segment** segments;   // Oldest first
+    int segment_count;
+    int segment_capacity;
+    long long next_offset;
+    size_t total_bytes;
+};
+
+static char log_root[128] = "topic_log";
+static size_t segment_size = 16 * 1024 * 1024;
+static long retention_age = 0;
+static size_t retention_size = 0;
+
+static char** durable_filters = NULL;
+static int durable_filter_count = 0;
+
+// Logs are opened once and never freed, so a pointer cached by the topic registry stays valid.
+// log_index finds a log by topic name; the array is what retention walks.
+static HashTable* log_index = NULL;
+static TopicLog** logs = NULL;
+static int log_count = 0;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char* trim_whitespace(char* str) {
+    char* end;
+    while(isspace((unsigned char)*str)) str++;
+    if(*str == 0) return str;
+
+    end = str + strlen(str) - 1;
+    while(end > str && isspace((unsigned char)*end)) end--;
+    end[1] = '\0';
+    return str;
+}
+
+// Topic names may hold '/' and other characters that do not belong in a path, so they are %-escaped.
+// Returns 0 if the escaped name does not fit: cutting it short could give two topics the same directory.
+static int encode_name(const char* topic, char* out, size_t out_size) {
+    size_t n = 0;
+    for (const char* p = topic; *p; p++) {
+        unsigned char ch = *p;
+        if (n + 4 > out_size) return 0; // Room for an escape and the terminator
+        if (isalnum(ch) || ch == '-' || ch == '_' || (ch == '.' && p != topic)) out[n++] = ch;
+        else n += snprintf(&out[n], out_size - n, "%%%02X", ch);
+    }
+    out[n] = '\0';
+    return 1;
+}
+
+static void decode_name(const char* name, char* out, size_t out_size) {
+    size_t n = 0;
+    for (const char* p = name; *p && n + 1 < out_size; p++) {
+        unsigned int ch;
+        if (*p == '%' && sscanf(p + 1, "%2X", &ch) == 1) {
+            out[n++] = (char)ch;
+            p += 2;
+        } else {
+            out[n++] = *p;
+        }
+    }
+    out[n] = '\0';
+}
+
+static void segment_unref(void* ptr) {
+    Segment* seg = ptr;
+    if (atomic_fetch_sub_explicit(&seg->refs, 1, memory_order_acq_rel) == 1) {
+        munmap(seg->map, seg->map_len);
+        if (seg->fd >= 0) close(seg->fd);
+        free(seg->index);
+        free(seg);
+    }
+}
+
+static void segment_index_push(Segment* seg, uint32_t pos) {
+    if (seg->count == seg->capacity) {
+        seg->capacity = seg->capacity ? seg->capacity * 2 : SEGMENT_INDEX_INITIAL_CAPACITY;
+        seg->index = realloc(seg->index, sizeof(uint32_t) * seg->capacity);
+    }
+    seg->index[seg->count++] = pos;
+}
+
+static size_t record_start(const Segment* seg, int i) {
+    return seg->index[i] & ~RECORD_RAW;
+}
+
+// End of record i
+static size_t record_end(const Segment* seg, int i) {
+    return (i + 1 < seg->count) ? record_start(seg, i + 1) : seg->len;
+}
+
+// Checks the record at pos in a segment being reopened: "[topic off=N ...] payload\n", where a plain payload holds
+// no NUL and ends at the first newline, and a raw one is as long as its "len=L" says. Returns where the record ends,
+// or 0 at the zero fill after the last append or at a record cut short by a crash. *claimed_end is set to where a
+// raw record claims to end, even a torn one.
+static size_t record_scan(const char* map, size_t pos, size_t file_len, size_t topic_len, int* raw,
+                          size_t* claimed_end) {
+    const char* rec = map + pos;
+    size_t avail = file_len - pos;
+    size_t h = 1 + topic_len + 5;
+    *raw = 0;
+    if (h > avail || rec[0] != '[' || memcmp(rec + 1 + topic_len, " off=", 5) != 0) return 0;
+    while (h < avail && isdigit((unsigned char)rec[h])) h++;
+
+    if (h + 5 < avail && memcmp(rec + h, " len=", 5) == 0) {
+        size_t payload_len = 0;
+        for (h += 5; h < avail && isdigit((unsigned char)rec[h]); h++) payload_len = payload_len * 10 + (rec[h] - '0');
+        const char* close = memchr(rec + h, ']', avail - h); // Broker-made attributes hold no ']'
+        if (close == NULL || payload_len > avail) return 0;
+        size_t end = (close - rec) + 2 + payload_len + 1;
+        *claimed_end = pos + end;
+        if (end > avail || close[1] != ' ' || rec[end - 1] != '\n') return 0;
+        *raw = 1;
+        return pos + end;
+    }
+
+    const char* nl = memchr(rec, '\n', avail);
+    if (nl == NULL || memchr(rec, '\0', nl - rec) != NULL) return 0;
+    return pos + (nl - rec) + 1;
+}
+
+// Trims a segment to what was written and makes it read-only from now on
+static void segment_seal(Segment* seg) {
+    if (seg->fd < 0) return;
+    if (ftruncate(seg->fd, seg->len) < 0) perror("[TopicLog] ftruncate");
+    close(seg->fd);
+    seg->fd = -1;
+}
+
+static Segment* segment_map(const char* path, long long base, int fd, size_t map_len, int writable) {
+    char* map = mmap(NULL, map_len, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        printf("[TopicLog] ERROR: Could not map %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    Segment* seg = calloc(1, sizeof(Segment));
+    atomic_init(&seg->refs, 1);
+    seg->base = base;
+    seg->fd = fd;
+    seg->map = map;
+    seg->map_len = map_len;
+    seg->last_append = time(NULL);
+    snprintf(seg->path, sizeof(seg->path), "%s", path);
+    return seg;
+}
+
+// Creates the writable segment that starts at base. The file is sparse, so unused room costs no disk.
+static Segment* segment_create(TopicLog* log, long long base, size_t size) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%020lld%s", log->dir, base, SEGMENT_SUFFIX);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) < 0) {
+        printf("[TopicLog] ERROR: Could not create %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    Segment* seg = segment_map(path, base, fd, size, 1);
+    if (seg == NULL) close(fd);
+    return seg;
+}
+
+// Maps a segment left by an earlier run and rebuilds its record index. Records are walked up to the zero fill after
+// the last append, and a record cut short by a crash is dropped.
+static Segment* segment_load(const char* path, long long base, int writable, size_t topic_len) {
+    int fd = open(path, O_RDWR);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    size_t file_len = st.st_size;
+    size_t map_len = file_len;
+    if (writable && map_len < segment_size) {
+        map_len = segment_size;
+        if (ftruncate(fd, map_len) < 0) {
+            writable = 0;
+            map_len = file_len;
+        }
+    }
+    if (map_len == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    Segment* seg = segment_map(path, base, fd, map_len, writable);
+    if (seg == NULL) {
+        close(fd);
+        return NULL;
+    }
+    seg->last_append = st.st_mtime;
+
+    size_t pos = 0;
+    size_t claimed_end = 0;
+    while (pos < file_len) {
+        int raw;
+        size_t end = record_scan(seg->map, pos, file_len, topic_len, &raw, &claimed_end);
+        if (end == 0) break;
+        segment_index_push(seg, pos | (raw ? RECORD_RAW : 0));
+        pos = end;
+    }
+    seg->len = pos;
+
+    if (writable) {
+        // A torn record would otherwise sit in front of the next append: clear up to the zero fill, or to where
+        // a torn raw record meant to end if that is further (its payload may hold zeros of its own)
+        const char* zero = memchr(&seg->map[pos], '\0', file_len - pos);
+        size_t torn_end = zero ? (size_t)(zero - seg->map) : file_len;
+        if (claimed_end > torn_end) torn_end = (claimed_end < file_len) ? claimed_end : file_len;
+        memset(&seg->map[pos], 0, torn_end - pos);
+    } else {
+        segment_seal(seg);
+    }
+    return seg;
+}
+
+static void log_add_segment(TopicLog* log, Segment* seg) {
+    if (log->segment_count == log->segment_capacity) {
+        log->segment_capacity = log->segment_capacity ? log->segment_capacity * 2 : 8;
+        log->segments = realloc(log->segments, sizeof(Segment*) * log->segment_capacity);
+    }
+    log->segments[log->segment_count++] = seg;
+    log->total_bytes += seg->len;
+    log->next_offset = seg->base + seg->count;
+}
+
+static int compare_bases(const void* a, const void* b) {
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// Opens (or creates) the log directory of a topic and loads its segments, oldest first.
+// Returns NULL if the topic's name is too long to make a directory of.
+static TopicLog* log_open(const char* topic) {
+    char name[240];
+    if (!encode_name(topic, name, sizeof(name))) {
+        printf("[TopicLog] Warning: Topic '%.64s...' has too long a name for a log; it is not durable.\n", topic);
+        return NULL;
+    }
+
+    TopicLog* log = calloc(1, sizeof(TopicLog));
+    log->topic = strdup(topic);
+    pthread_mutex_init(&log->lock, NULL);
+    snprintf(log->dir, sizeof(log->dir), "%s/%s", log_root, name);
+    if (mkdir(log->dir, 0755) < 0 && errno != EEXIST) {
+        printf("[TopicLog] ERROR: Could not create %s: %s\n", log->dir, strerror(errno));
+    }
+
+    long long* bases = NULL;
+    int base_count = 0;
+    DIR* dir = opendir(log->dir);
+    struct dirent* entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        char* end;
+        long long base = strtoll(entry->d_name, &end, 10);
+        if (end == entry->d_name || strcmp(end, SEGMENT_SUFFIX) != 0) continue;
+        bases = realloc(bases, sizeof(long long) * (base_count + 1));
+        bases[base_count++] = base;
+    }
+    if (dir) closedir(dir);
+    if (base_count > 1) qsort(bases, base_count, sizeof(long long), compare_bases);
+
+    for (int i = 0; i < base_count; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%020lld%s", log->dir, bases[i], SEGMENT_SUFFIX);
+
+        // The newest segment keeps taking appends, which also carries the next offset across restarts
+        Segment* seg = segment_load(path, bases[i], i == base_count - 1, strlen(topic));
+        if (seg == NULL) continue;
+        if (seg->count == 0 && i < base_count - 1) {
+            unlink(path);
+            segment_unref(seg);
+            continue;
+        }
+        log_add_segment(log, seg);
+    }
+    free(bases);
+
+    if (log->segment_count > 0) {
+        printf("[TopicLog] Reopened '%s': offsets %lld-%lld in %d segment(s).\n", topic,
+               log->segments[0]->base, log->next_offset - 1, log->segment_count);
+    }
+    return log;
+}
+
+void topiclog_init(const char* dir, const char* durable_topics, size_t segment_bytes,
+                   long retention_seconds, size_t retention_bytes) {
+    snprintf(log_root, sizeof(log_root), "%s", dir);
+    if (segment_bytes > 0 && segment_bytes < RECORD_RAW) segment_size = segment_bytes;
+    retention_age = retention_seconds;
+    retention_size = retention_bytes;
+
+    char* list = strdup(durable_topics);
+    char* saveptr;
+    for (char* tok = strtok_r(list, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        char* filter = trim_whitespace(tok);
+        if (filter[0] == '\0') continue;
+        if (!topic_is_valid_filter(filter)) {
+            printf("[TopicLog] Warning: Ignoring invalid durable topic '%s'.\n", filter);
+            continue;
+        }
+        durable_filters = realloc(durable_filters, sizeof(char*) * (durable_filter_count + 1));
+        durable_filters[durable_filter_count++] = strdup(filter);
+    }
+    free(list);
+    if (durable_filter_count == 0) return;
+    log_index = create_table();
+
+    if (mkdir(log_root, 0755) < 0 && errno != EEXIST) {
+        printf("[TopicLog] ERROR: Could not create %s: %s\n", log_root, strerror(errno));
+        return;
+    }
+
+    // Open every log that is still durable now, so retention also runs on topics nobody has touched yet
+    DIR* root = opendir(log_root);
+    struct dirent* entry;
+    while (root && (entry = readdir(root)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char topic[256];
+        decode_name(entry->d_name, topic, sizeof(topic));
+        if (topiclog_is_durable(topic)) topiclog_get(topic);
+    }
+    if (root) closedir(root);
+}
+
+int topiclog_is_durable(const char* topic) {
+    for (int i = 0; i < durable_filter_count; i++) {
+        if (topic_filter_covers(durable_filters[i], topic)) return 1;
+    }
+    return 0;
+}
+
+TopicLog* topiclog_get(const char* topic) {
+    if (topic_has_wildcard(topic) || !topiclog_is_durable(topic)) return NULL;
+
+    pthread_mutex_lock(&registry_lock);
+    TopicLog* log = get(log_index, topic);
+    if (log == NULL && (log = log_open(topic)) != NULL) {
+        set(log_index, log->topic, log);
+        logs = realloc(logs, sizeof(TopicLog*) * (log_count + 1));
+        logs[log_count++] = log;
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return log;
+}
+
+void topiclog_lock(TopicLog* log) {
+    pthread_mutex_lock(&log->lock);
+}
+
+void topiclog_unlock(TopicLog* log) {
+    pthread_mutex_unlock(&log->lock);
+}
+
+long long topiclog_next_offset(TopicLog* log) {
+    return log->next_offset;
+}
+
+void topiclog_bounds(TopicLog* log, long long* first, long long* next) {
+    pthread_mutex_lock(&log->lock);
+    *next = log->next_offset;
+    *first = (log->segment_count > 0) ? log->segments[0]->base : log->next_offset;
+    pthread_mutex_unlock(&log->lock);
+}
+
+Message* topiclog_append(TopicLog* log, const char* topic, const char* attrs, const char* payload,
+                         size_t payload_len) {
+    // A payload that would not fit on one text line is stored raw, with its length to find its end by
+    int raw = memchr(payload, '\n', payload_len) || memchr(payload, '\0', payload_len);
+    char offset[96];
+    int offset_len = snprintf(offset, sizeof(offset), "%lld", log->next_offset);
+    if (raw) offset_len += snprintf(offset + offset_len, sizeof(offset) - offset_len, " len=%zu", payload_len);
+    if (attrs) offset_len += snprintf(offset + offset_len, sizeof(offset) - offset_len, " %s", attrs);
+    size_t frame_len = strlen(topic) + offset_len + payload_len + 9; // "[" topic " off=" offset "] " payload "\n"
+
+    Segment* seg = (log->segment_count > 0) ? log->segments[log->segment_count - 1] : NULL;
+    if (seg == NULL || seg->fd < 0 || seg->len + frame_len + 1 > seg->map_len) {
+        if (seg) segment_seal(seg);
+        size_t size = (frame_len + 1 > segment_size) ? frame_len + 1 : segment_size;
+        seg = segment_create(log, log->next_offset, size);
+        if (seg == NULL) return NULL;
+        log_add_segment(log, seg);
+    }
+
+    // Formatted in place: the mapping is the log and, through the returned view, the live frame as well
+    char* frame = &seg->map[seg->len];
+    int header_len = sprintf(frame, "[%s off=%s] ", topic, offset);
+    memcpy(frame + header_len, payload, payload_len);
+    frame[header_len + payload_len] = '\n';
+    segment_index_push(seg, seg->len | (raw ? RECORD_RAW : 0));
+    seg->len += frame_len;
+    seg->last_append = time(NULL);
+    log->total_bytes += frame_len;
+    long long record_offset = log->next_offset++;
+
+    if (raw) {
+        // Subscribers get the frame they would without a log: flattened as text, exact as OP_DELIVER
+        char live_attrs[96];
+        snprintf(live_attrs, sizeof(live_attrs), "off=%lld%s%s", record_offset, attrs ? " " : "", attrs ? attrs : "");
+        return msg_alloc_publish(topic, live_attrs, payload, payload_len);
+    }
+
+    atomic_fetch_add_explicit(&seg->refs, 1, memory_order_relaxed);
+    Message* msg = msg_view(frame, frame_len, segment_unref, seg);
+    msg->topic_len = strlen(topic);
+    return msg;
+}
+
+// Renders raw record i as the frame a live subscriber got, without its "len=L" (log->lock must be held)
+static Message* record_render(TopicLog* log, const Segment* seg, int i) {
+    const char* rec = &seg->map[record_start(seg, i)];
+    const char* rec_end = &seg->map[record_end(seg, i)];
+    const char* attrs = rec + 1 + strlen(log->topic) + 1;           // "off=N len=L ..."
+    const char* close = memchr(attrs, ']', rec_end - attrs);
+    const char* len_at = attrs + 4 + strspn(attrs + 4, "0123456789"); // " len=L"
+    const char* rest = len_at + 5 + strspn(len_at + 5, "0123456789");
+
+    char live_attrs[96];
+    snprintf(live_attrs, sizeof(live_attrs), "%.*s%.*s", (int)(len_at - attrs), attrs, (int)(close - rest), rest);
+    return msg_alloc_publish(log->topic, live_attrs, close + 2, rec_end - 1 - (close + 2));
+}
+
+// Finds the segment holding *offset, moving *offset forward past records that are gone (log->lock must be held)
+static Segment* log_locate(TopicLog* log, long long* offset) {
+    int lo = 0, hi = log->segment_count - 1, found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (log->segments[mid]->base <= *offset) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    for (int i = (found < 0) ? 0 : found; i < log->segment_count; i++) {
+        Segment* seg = log->segments[i];
+        if (*offset < seg->base) *offset = seg->base;
+        if (*offset < seg->base + seg->count) return seg;
+    }
+    return NULL;
+}
+
+Message* topiclog_read(TopicLog* log, long long* offset, int max_records, size_t max_bytes) {
+    pthread_mutex_lock(&log->lock);
+    Segment* seg = log_locate(log, offset);
+    if (seg == NULL) {
+        pthread_mutex_unlock(&log->lock);
+        return NULL;
+    }
+
+    int first = *offset - seg->base;
+    if (seg->index[first] & RECORD_RAW) {
+        // A raw record is not a line of text, so it goes out on its own as a fresh rendering
+        Message* msg = record_render(log, seg, first);
+        *offset = seg->base + first + 1;
+        pthread_mutex_unlock(&log->lock);
+        return msg;
+    }
+
+    // A run never crosses a segment boundary or a raw record, so it is always one contiguous span of lines
+    int last = first + 1;
+    size_t start = record_start(seg, first);
+    while (last < seg->count && !(seg->index[last] & RECORD_RAW) && last - first < max_records &&
+           record_end(seg, last) - start <= max_bytes) {
+        last++;
+    }
+    size_t end = record_end(seg, last - 1);
+
+    atomic_fetch_add_explicit(&seg->refs, 1, memory_order_relaxed);
+    *offset = seg->base + last;
+    pthread_mutex_unlock(&log->lock);
+
+    Message* msg = msg_view(&seg->map[start], end - start, segment_unref, seg);
+    msg->topic_len = strlen(log->topic); // Every record in the run is on the log's own topic
+    return msg;
+}
+
+// Drops the oldest segment. Views still being sent keep its mapping alive after the file is gone.
+static void log_drop_oldest(TopicLog* log) {
+    Segment* seg = log->segments[0];
+    unlink(seg->path);
+    log->total_bytes -= seg->len;
+    log->segment_count--;
+    memmove(&log->segments[0], &log->segments[1], sizeof(Segment*) * log->segment_count);
+    segment_unref(seg);
+}
+
+static void log_maintain(TopicLog* log, time_t now) {
+    pthread_mutex_lock(&log->lock);
+    if (log->segment_count == 0) {
+        pthread_mutex_unlock(&log->lock);
+        return;
+    }
+
+    // An idle segment that has aged out is rolled over, so it can be dropped like any other
+    Segment* active = log->segments[log->segment_count - 1];
+    if (retention_age > 0 && active->count > 0 && now - active->last_append > retention_age) {
+        Segment* seg = segment_create(log, log->next_offset, segment_size);
+        if (seg) {
+            segment_seal(active);
+            log_add_segment(log, seg);
+        }
+    }
+
+    // The newest segment always stays, so offsets keep counting up across restarts
+    while (log->segment_count > 1) {
+        Segment* oldest = log->segments[0];
+        int too_big = retention_size > 0 && log->total_bytes > retention_size;
+        int too_old = retention_age > 0 && now - oldest->last_append > retention_age;
+        if (!too_big && !too_old) break;
+        printf("[TopicLog] Retention dropped '%s' offsets %lld-%lld.\n", log->topic,
+               oldest->base, oldest->base + oldest->count - 1);
+        log_drop_oldest(log);
+    }
+
+    active = log->segments[log->segment_count - 1];
+    if (active->fd >= 0 && active->len > 0) msync(active->map, active->len, MS_ASYNC);
+    pthread_mutex_unlock(&log->lock);
+}
+
+void topiclog_maintain() {
+    // Work on a copy of the registry so no log lock is ever taken under registry_lock
+    pthread_mutex_lock(&registry_lock);
+    int count = log_count;
+    TopicLog** copy = malloc(sizeof(TopicLog*) * (count + 1));
+    memcpy(copy, logs, sizeof(TopicLog*) * count);
+    pthread_mutex_unlock(&registry_lock);
+
+    time_t now = time(NULL);
+    for (int i = 0; i < count; i++) log_maintain(copy[i], now);
+    free(copy);
+}
@@ -0,0 +1,55 @@
+#ifndef TOPICLOG_H
+#define TOPICLOG_H
+
+#include "outbound.h"
+
+#include <stddef.h>
+
+// Durable topics: every publish is appended to an on-disk log made of memory-mapped segment files, so a
+// subscriber that was offline can pick up where it left off with "SUBSCRIBE <topic> FROM <offset>".
+// A record is the exact frame live subscribers receive, "[topic off=N] payload\n", which lets a backlog be
+// streamed straight out of the mapping without copying or re-formatting it. A payload holding a newline or a NUL
+// (only binary-framed clients can send one) is stored raw as "[topic off=N len=L] payload\n" instead; such a record
+// is rendered on its own when it is sent.
+typedef struct TopicLog TopicLog;
+
+// Applies the durability settings and reopens the logs an earlier run left in dir. durable_topics is a
+// comma-separated list of topic filters ('+' and '#' allowed); when it is empty nothing is logged.
+// A retention limit of 0 disables that limit.
+void topiclog_init(const char* dir, const char* durable_topics, size_t segment_bytes,
+                   long retention_seconds, size_t retention_bytes);
+
+// Returns 1 if publishes to this topic are logged
+int topiclog_is_durable(const char* topic);
+
+// Returns the log of a durable topic, opening it on first use, or NULL if the topic is not durable (or its name is
+// too long to map to a log directory). Opening scans, maps and recovers segment files, so never call it with
+// pubsub_lock held.
+TopicLog* topiclog_get(const char* topic);
+
+// Appends are serialized by the log lock. Holding it across an append and the work that must agree with the
+// offset order (taking the subscriber snapshot, registering a caught-up subscriber) keeps the two consistent.
+void topiclog_lock(TopicLog* log);
+void topiclog_unlock(TopicLog* log);
+
+// Appends a publish (the log lock must be held), with extra attributes after the offset when attrs is not NULL:
+// "[topic off=N attrs] payload". Returns the record as a view of the mapped segment (a fresh rendering for a raw
+// record) with one reference owned by the caller, or NULL if it could not be written.
+Message* topiclog_append(TopicLog* log, const char* topic, const char* attrs, const char* payload,
+                         size_t payload_len);
+
+// The offset the next append will get (the log lock must be held)
+long long topiclog_next_offset(TopicLog* log);
+
+// Reports the oldest retained offset and the next offset to be written
+void topiclog_bounds(TopicLog* log, long long* first, long long* next);
+
+// Returns a view of consecutive records starting at *offset (a raw record always comes alone): at most max_records of them, and beyond the first
+// no more than max_bytes in total. An offset that retention already removed skips ahead to the oldest record kept.
+// Advances *offset past the records returned, and returns NULL once it has reached the end of the log.
+Message* topiclog_read(TopicLog* log, long long* offset, int max_records, size_t max_bytes);
+
+// Applies retention by age and size and schedules written pages for writeback. Called by the heartbeat.
+void topiclog_maintain();
+
+#endif
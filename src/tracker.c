@@ -0,0 +1,263 @@
+#include "tracker.h"
+#include "hash.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Longest stretch of the payload kept to describe a command
+#define COMMAND_LABEL_MAX 48
+
+typedef struct {
+    char* hostname;
+    int state;
+    int expected;   // The command was delivered to this host (a host may report before the fanout has finished)
+    int latency_ms; // From publish to report
+} HostResult;
+
+typedef struct {
+    unsigned long long cid;
+    char topic[64];
+    char label[COMMAND_LABEL_MAX + 1];
+    struct timespec started;
+    time_t deadline;
+    int closed; // The deadline has passed and been logged
+
+    HashTable* host_map; // hostname -> HostResult
+    HostResult** hosts;
+    int host_count;
+    int host_capacity;
+
+    int expected;
+    int succeeded;
+    int failed;
+    int unexpected; // Reports from hosts the command was not delivered to
+} Command;
+
+static Command** commands = NULL; // Ring indexed by cid % history
+static int history = 64;
+static int deadline = 300;
+static unsigned long long next_cid = 1;
+static pthread_mutex_t tracker_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void tracker_init(int history_size, int deadline_seconds) {
+    if (history_size > 0) history = history_size;
+    if (deadline_seconds > 0) deadline = deadline_seconds;
+    commands = calloc(history, sizeof(Command*));
+}
+
+static void command_free(Command* cmd) {
+    for (int i = 0; i < cmd->host_count; i++) {
+        free(cmd->hosts[i]->hostname);
+        free(cmd->hosts[i]);
+    }
+    free_table(cmd->host_map);
+    free(cmd->hosts);
+    free(cmd);
+}
+
+// Returns the command with this id if it is still kept (tracker_lock must be held)
+static Command* command_find(unsigned long long cid) {
+    Command* cmd = commands[cid % history];
+    return (cmd && cmd->cid == cid) ? cmd : NULL;
+}
+
+// Returns the host's entry, adding it when new; takes ownership of hostname (tracker_lock must be held)
+static HostResult* host_get(Command* cmd, char* hostname) {
+    HostResult* h = get(cmd->host_map, hostname);
+    if (h) {
+        free(hostname);
+        return h;
+    }
+
+    if (cmd->host_count == cmd->host_capacity) {
+        cmd->host_capacity = cmd->host_capacity ? cmd->host_capacity * 2 : 16;
+        cmd->hosts = realloc(cmd->hosts, sizeof(HostResult*) * cmd->host_capacity);
+    }
+    h = calloc(1, sizeof(HostResult));
+    h->hostname = hostname;
+    cmd->hosts[cmd->host_count++] = h;
+    set(cmd->host_map, hostname, h);
+    return h;
+}
+
+static int elapsed_ms(const struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int)((now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000);
+}
+
+unsigned long long tracker_begin(const char* topic, const char* payload) {
+    Command* cmd = calloc(1, sizeof(Command));
+    strncpy(cmd->topic, topic, sizeof(cmd->topic) - 1);
+    strncpy(cmd->label, payload, COMMAND_LABEL_MAX);
+    clock_gettime(CLOCK_MONOTONIC, &cmd->started);
+    cmd->deadline = time(NULL) + deadline;
+    cmd->host_map = create_table();
+
+    pthread_mutex_lock(&tracker_lock);
+    cmd->cid = next_cid++;
+    Command* evicted = commands[cmd->cid % history];
+    commands[cmd->cid % history] = cmd;
+    pthread_mutex_unlock(&tracker_lock);
+
+    if (evicted) command_free(evicted);
+    return cmd->cid;
+}
+
+void tracker_expect(unsigned long long cid, char** hostnames, int count) {
+    pthread_mutex_lock(&tracker_lock);
+    Command* cmd = command_find(cid);
+    for (int i = 0; i < count; i++) {
+        if (cmd == NULL) {
+            free(hostnames[i]);
+            continue;
+        }
+        HostResult* h = host_get(cmd, hostnames[i]);
+        if (h->expected) continue; // Several connections of one host count once
+        h->expected = 1;
+        cmd->expected++;
+        if (h->state != TRACK_PENDING) cmd->unexpected--; // Its report simply beat the fanout
+    }
+    pthread_mutex_unlock(&tracker_lock);
+}
+
+int tracker_report(const char* hostname, const char* payload) {
+    unsigned long long cid;
+    int consumed = 0;
+    if (sscanf(payload, "cid=%llu %n", &cid, &consumed) != 1 || consumed == 0) return 0;
+
+    const char* status = &payload[consumed];
+    int state;
+    if (strncmp(status, "SUCCESS", 7) == 0) state = TRACK_SUCCEEDED;
+    else if (strncmp(status, "ERROR", 5) == 0) state = TRACK_FAILED;
+    else return 0;
+
+    pthread_mutex_lock(&tracker_lock);
+    Command* cmd = command_find(cid);
+    if (cmd) {
+        HostResult* h = host_get(cmd, strdup(hostname));
+        if (h->state == TRACK_PENDING) { // A redelivered command may be reported twice; the first report counts
+            h->state = state;
+            h->latency_ms = elapsed_ms(&cmd->started);
+            if (state == TRACK_SUCCEEDED) cmd->succeeded++;
+            else cmd->failed++;
+            if (!h->expected) cmd->unexpected++;
+        }
+    }
+    pthread_mutex_unlock(&tracker_lock);
+    return 1;
+}
+
+void tracker_host_states(unsigned long long cid, char** hostnames, int count, int* states) {
+    pthread_mutex_lock(&tracker_lock);
+    Command* cmd = command_find(cid);
+    for (int i = 0; i < count; i++) {
+        HostResult* h = cmd ? get(cmd->host_map, hostnames[i]) : NULL;
+        states[i] = h ? h->state : TRACK_PENDING;
+    }
+    pthread_mutex_unlock(&tracker_lock);
+}
+
+static int command_pending(const Command* cmd) {
+    return cmd->expected - (cmd->succeeded + cmd->failed - cmd->unexpected);
+}
+
+void tracker_check_deadlines() {
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&tracker_lock);
+    for (int i = 0; commands && i < history; i++) {
+        Command* cmd = commands[i];
+        if (cmd == NULL || cmd->closed || now < cmd->deadline) continue;
+        cmd->closed = 1;
+        printf("\n[Tracker] Command #%llu on '%s' closed: %d of %d succeeded, %d failed, %d missing.\nadmq> ",
+               cmd->cid, cmd->topic, cmd->succeeded, cmd->expected, cmd->failed, command_pending(cmd));
+        fflush(stdout);
+    }
+    pthread_mutex_unlock(&tracker_lock);
+}
+
+void tracker_print_summary() {
+    printf("\n=== COMMANDS ===\n");
+    int count = 0;
+
+    time_t now = time(NULL);
+    pthread_mutex_lock(&tracker_lock);
+    // Oldest first: only the last `history` ids can still be kept
+    unsigned long long first = (next_cid > (unsigned long long)history) ? next_cid - history : 1;
+    for (unsigned long long cid = first; cid < next_cid; cid++) {
+        Command* cmd = command_find(cid);
+        if (cmd == NULL) continue;
+        printf("  #%llu [%s] %s: %d/%d succeeded, %d failed, %d %s\n", cmd->cid, cmd->topic, cmd->label,
+               cmd->succeeded, cmd->expected, cmd->failed, command_pending(cmd), (now >= cmd->deadline) ? "missing" : "pending");
+        count++;
+    }
+    pthread_mutex_unlock(&tracker_lock);
+
+    if (count == 0) printf("  No commands tracked.\n");
+    printf("================\n");
+}
+
+static int compare_ints(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of a sorted array
+static int percentile(const int* sorted, int n, int pct) {
+    int rank = (n * pct + 99) / 100;
+    return sorted[(rank > 0 ? rank : 1) - 1];
+}
+
+int tracker_print_command(unsigned long long cid) {
+    pthread_mutex_lock(&tracker_lock);
+    Command* cmd = command_find(cid);
+    if (cmd == NULL) {
+        pthread_mutex_unlock(&tracker_lock);
+        return 0;
+    }
+
+    time_t now = time(NULL);
+    int pending = command_pending(cmd);
+    printf("\n=== COMMAND #%llu ===\n", cmd->cid);
+    printf("  [%s] %s\n", cmd->topic, cmd->label);
+    printf("  expected: %d, succeeded: %d, failed: %d, %s: %d", cmd->expected, cmd->succeeded, cmd->failed,
+           (now >= cmd->deadline) ? "missing" : "pending", pending);
+    if (cmd->unexpected > 0) printf(", unexpected reports: %d", cmd->unexpected);
+    printf("\n");
+    if (now < cmd->deadline) printf("  deadline in %lds\n", (long)(cmd->deadline - now));
+
+    int reported = cmd->succeeded + cmd->failed;
+    if (reported > 0) {
+        int* sorted = malloc(sizeof(int) * reported);
+        int n = 0;
+        for (int i = 0; i < cmd->host_count; i++) {
+            if (cmd->hosts[i]->state != TRACK_PENDING) sorted[n++] = cmd->hosts[i]->latency_ms;
+        }
+        qsort(sorted, n, sizeof(int), compare_ints);
+        printf("  latency ms: p50 %d, p90 %d, p99 %d, max %d\n", percentile(sorted, n, 50),
+               percentile(sorted, n, 90), percentile(sorted, n, 99), sorted[n - 1]);
+        free(sorted);
+    }
+
+    if (cmd->failed > 0) {
+        printf("  failed:");
+        for (int i = 0; i < cmd->host_count; i++) {
+            if (cmd->hosts[i]->state == TRACK_FAILED) printf(" %s", cmd->hosts[i]->hostname);
+        }
+        printf("\n");
+    }
+    if (pending > 0) {
+        printf("  %s:", (now >= cmd->deadline) ? "missing" : "pending");
+        for (int i = 0; i < cmd->host_count; i++) {
+            if (cmd->hosts[i]->expected && cmd->hosts[i]->state == TRACK_PENDING) printf(" %s", cmd->hosts[i]->hostname);
+        }
+        printf("\n");
+    }
+    printf("====================\n");
+    pthread_mutex_unlock(&tracker_lock);
+    return 1;
+}
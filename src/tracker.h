@@ -0,0 +1,39 @@
+#ifndef TRACKER_H
+#define TRACKER_H
+
+// Command tracking: every publish from the admin CLI gets a correlation id, which subscribers receive as
+// "[topic cid=N] payload". Agents start their report with it ("PUBLISH agent-status cid=N SUCCESS: ...") and the
+// broker keeps a live aggregate per command: how many hosts were sent it, how many succeeded or failed, how many
+// are still pending, and the report latency percentiles. Once a command's deadline passes, the hosts that never
+// reported are listed as missing. Only the most recent commands are kept, so lookups never touch the database.
+
+// What a host has reported for a command
+#define TRACK_PENDING 0
+#define TRACK_SUCCEEDED 1
+#define TRACK_FAILED 2
+
+// Keeps the last `history` commands; a command's deadline is deadline_seconds after it was published
+void tracker_init(int history, int deadline_seconds);
+
+// Opens a new command and returns its correlation id (never 0)
+unsigned long long tracker_begin(const char* topic, const char* payload);
+
+// Records the hosts a command was delivered to. Takes ownership of the malloc'd hostname strings (not the array).
+void tracker_expect(unsigned long long cid, char** hostnames, int count);
+
+// Records a host's report if payload starts with "cid=N " followed by "SUCCESS" or "ERROR". Returns 1 if it did.
+int tracker_report(const char* hostname, const char* payload);
+
+// Fills states[i] with what hostnames[i] has reported for the command (TRACK_PENDING if nothing, or if the
+// command is no longer kept)
+void tracker_host_states(unsigned long long cid, char** hostnames, int count, int* states);
+
+// Logs each command whose deadline has just passed, with its final tally. Called by the heartbeat.
+void tracker_check_deadlines();
+
+// One line per command kept
+void tracker_print_summary();
+// The full aggregate of one command, with the failed and pending (or missing) hosts. Returns 0 if it is unknown.
+int tracker_print_command(unsigned long long cid);
+
+#endif
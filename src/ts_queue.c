@@ -1,62 +1,156 @@
 #include "ts_queue.h"
 #include <stdlib.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define QUEUE_SPIN_LIMIT 64
+
+static void futex_wait(_Atomic uint32_t* addr, uint32_t expected) {
+  syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t* addr, int count) {
+  syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
 
 void queue_init(ts_queue_t* q) {
-  q->head = 0;
-  q->tail = 0;
-  q->count = 0;
-  q->shutdown = 0;
-  pthread_mutex_init(&q->lock, NULL);
-  pthread_cond_init(&q->not_empty, NULL);
-  pthread_cond_init(&q->not_full, NULL);
+  queue_init_capacity(q, QUEUE_DEFAULT_CAPACITY);
 }
 
-void queue_write(ts_queue_t* q, void* data_ptr) {
-  pthread_mutex_lock(&q->lock);
+void queue_init_capacity(ts_queue_t* q, size_t capacity) {
+  size_t size = 2;
+  while (size < capacity) size <<= 1;
 
-  while (q->count == QUEUE_MAX_SIZE) {
-    pthread_cond_wait(&q->not_full, &q->lock);
+  q->buffer = malloc(sizeof(ts_queue_cell_t) * size);
+  q->mask = size - 1;
+  for (size_t i = 0; i < size; i++) {
+    atomic_store_explicit(&q->buffer[i].sequence, i, memory_order_relaxed);
+    q->buffer[i].data = NULL;
   }
+  atomic_store(&q->enqueue_pos, 0);
+  atomic_store(&q->dequeue_pos, 0);
+  atomic_store(&q->wake_seq, 0);
+  atomic_store(&q->sleepers, 0);
+  atomic_store(&q->shutdown, 0);
+}
 
-  q->buffer[q->tail] = data_ptr;
-  q->tail = (q->tail + 1) % QUEUE_MAX_SIZE;
-  q->count++;
+static int try_enqueue(ts_queue_t* q, void* data_ptr) {
+  size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+  ts_queue_cell_t* cell;
 
-  pthread_cond_signal(&q->not_empty);
-  pthread_mutex_unlock(&q->lock);
+  while (1) {
+    cell = &q->buffer[pos & q->mask];
+    size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return 0; // Full
+    } else {
+      pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    }
+  }
+
+  cell->data = data_ptr;
+  atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+  return 1;
 }
 
-int queue_read(ts_queue_t* q, void** data_ptr) {
-  pthread_mutex_lock(&q->lock);
+static int try_dequeue(ts_queue_t* q, void** data_ptr) {
+  size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+  ts_queue_cell_t* cell;
+
+  while (1) {
+    cell = &q->buffer[pos & q->mask];
+    size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return 0; // Empty
+    } else {
+      pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    }
+  }
 
-  while (q->count == 0 && !q->shutdown) {
-    pthread_cond_wait(&q->not_empty, &q->lock);
+  *data_ptr = cell->data;
+  atomic_store_explicit(&cell->sequence, pos + q->mask + 1, memory_order_release);
+  return 1;
+}
+
+void queue_write(ts_queue_t* q, void* data_ptr) {
+  // A full ring only yields the producer; it never sleeps on a lock held by a consumer
+  while (!try_enqueue(q, data_ptr)) {
+    if (atomic_load(&q->shutdown)) return;
+    sched_yield();
   }
 
-  if (q->count == 0 && q->shutdown) {
-    pthread_mutex_unlock(&q->lock);
-    return 0; // Queue empty and shutting down
+  // Pairs with the sleepers increment in wait_for_data(): either the consumer sees our item or we see the sleeper
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&q->sleepers) > 0) {
+    atomic_fetch_add(&q->wake_seq, 1);
+    futex_wake(&q->wake_seq, 1);
+  }
+}
+
+// Spins briefly, then parks on the futex until a producer publishes something.
+// Returns 1 with an item in *data_ptr, or 0 once the queue is empty and shut down.
+static int wait_for_data(ts_queue_t* q, void** data_ptr) {
+  while (1) {
+    for (int spin = 0; spin < QUEUE_SPIN_LIMIT; spin++) {
+      if (try_dequeue(q, data_ptr)) return 1;
+    }
+
+    // The wake sequence must be sampled before announcing ourselves, so a wake-up racing with us is never lost
+    uint32_t seen = atomic_load(&q->wake_seq);
+    atomic_fetch_add(&q->sleepers, 1);
+
+    if (try_dequeue(q, data_ptr)) {
+      atomic_fetch_sub(&q->sleepers, 1);
+      return 1;
+    }
+    if (atomic_load(&q->shutdown)) {
+      atomic_fetch_sub(&q->sleepers, 1);
+      return 0; // Queue empty and shutting down
+    }
+
+    futex_wait(&q->wake_seq, seen);
+    atomic_fetch_sub(&q->sleepers, 1);
   }
+}
 
-  *data_ptr = q->buffer[q->head];
-  q->head = (q->head + 1) % QUEUE_MAX_SIZE;
-  q->count--;
+int queue_read(ts_queue_t* q, void** data_ptr) {
+  return wait_for_data(q, data_ptr);
+}
+
+int queue_read_batch(ts_queue_t* q, void** data_ptrs, int max_items) {
+  if (max_items <= 0 || !wait_for_data(q, &data_ptrs[0])) return 0;
 
-  pthread_cond_signal(&q->not_full);
-  pthread_mutex_unlock(&q->lock);
-  return 1; // Success
+  int count = 1;
+  while (count < max_items && try_dequeue(q, &data_ptrs[count])) {
+    count++;
+  }
+  return count;
 }
 
 void queue_shutdown(ts_queue_t* q) {
-  pthread_mutex_lock(&q->lock);
-  q->shutdown = 1;
-  pthread_cond_broadcast(&q->not_empty); // Wake all waiting readers
-  pthread_cond_broadcast(&q->not_full);  // Wake all waiting writers (if any)
-  pthread_mutex_unlock(&q->lock);
+  atomic_store(&q->shutdown, 1);
+  atomic_fetch_add(&q->wake_seq, 1);
+  futex_wake(&q->wake_seq, INT_MAX); // Wake all parked readers
 }
 
 void queue_destroy(ts_queue_t* q) {
-  pthread_mutex_destroy(&q->lock);
-  pthread_cond_destroy(&q->not_empty);
-  pthread_cond_destroy(&q->not_full);
+  free(q->buffer);
+  q->buffer = NULL;
 }
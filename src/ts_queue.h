@@ -1,26 +1,39 @@
 #ifndef TS_QUEUE_H
 #define TS_QUEUE_H
 
-#include <pthread.h>
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
 
-#define QUEUE_MAX_SIZE 100
+#define QUEUE_DEFAULT_CAPACITY 4096
 
-// The generic Thread-Safe Queue structure
+// One slot of the ring. The sequence number tells producers and consumers whose turn the slot is.
 typedef struct {
-  void* buffer[QUEUE_MAX_SIZE]; // void* allows holding ANY struct pointer
-  int head;
-  int tail;
-  int count;
-  int shutdown;
-  pthread_mutex_t lock;
-  pthread_cond_t not_empty;
-  pthread_cond_t not_full;
+  _Atomic size_t sequence;
+  void* data;
+} ts_queue_cell_t;
+
+// The generic Thread-Safe Queue structure: a bounded lock-free multi-producer/multi-consumer ring.
+// Consumers only park on a futex when the ring is empty; producers never take a lock.
+typedef struct {
+  ts_queue_cell_t* buffer; // void* slots allow holding ANY struct pointer
+  size_t mask;             // capacity - 1 (capacity is always a power of two)
+  alignas(64) _Atomic size_t enqueue_pos;
+  alignas(64) _Atomic size_t dequeue_pos;
+  alignas(64) _Atomic uint32_t wake_seq; // Futex word bumped by producers when consumers are parked
+  _Atomic int sleepers;
+  _Atomic int shutdown;
 } ts_queue_t;
 
 // Public API Functions
 void queue_init(ts_queue_t* q);
+void queue_init_capacity(ts_queue_t* q, size_t capacity); // Capacity is rounded up to a power of two
 void queue_write(ts_queue_t* q, void* data_ptr);
 int  queue_read(ts_queue_t* q, void** data_ptr);
+// Blocks until at least one item is available, then takes up to max_items without blocking again.
+// Returns the number of items read, or 0 once the queue is empty and shut down.
+int  queue_read_batch(ts_queue_t* q, void** data_ptrs, int max_items);
 void queue_shutdown(ts_queue_t* q);
 void queue_destroy(ts_queue_t* q);
 
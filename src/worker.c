@@ -6,6 +6,8 @@
 #include <openssl/err.h>
 #include <sys/epoll.h>
 #include <errno.h>
+#include <stdint.h>
+#include <limits.h>
 
 #include "rbac.h"
 #include "db.h"
@@ -13,214 +15,597 @@
 #include "tls.h"
 #include "auth.h"
 #include "worker.h"
+#include "reactor.h"
 #include "client_manager.h"
 #include "pubsub.h"
+#include "topic.h"
+#include "retained.h"
+#include "qos.h"
+#include "tracker.h"
+#include "scheduler.h"
+#include "epoch.h"
+#include "frame.h"
+#include "command.h"
+
+// A command as parsed from either framing. The strings point into the client's input buffer and stay valid until
+// the command has run.
+typedef struct {
+    const char* topic;    // Topic, or the key for SET/GET
+    const char* payload;  // Rest of the command ("" if none), logged with it
+    size_t payload_len;   // A PUBLISH payload that came in a frame may hold NULs, so it goes by this length
+    const char* filter;   // SUBSCRIBE: content filter expression ("" if none)
+    long long from;       // SUBSCRIBE: replay from this offset, or -1
+    uint64_t number;      // ACK: sequence number; QOS: level
+    int retain;           // PUBLISH --retain
+    time_t fire_at;       // PUBLISH --at/--in: when to publish, else 0
+} Command;
+
+static void reply_invalid(Client* c) {
+    client_send_str(c, "ERROR: Invalid command.\n");
+}
 
-extern int epoll_fd;
+// Reads a string field that names a topic or key, which cannot be empty
+static int get_topic(const char** p, const char* end, const char** topic) {
+    size_t len;
+    return frame_get_str(p, end, topic, &len) && len > 0;
+}
 
-void* worker_thread(void* arg) {
-    int my_id = *((int*)arg);
+static int decode_set(const Frame* f, Command* cmd) {
+    const char* p = f->body;
+    const char* end = f->body + f->body_len;
+    return get_topic(&p, end, &cmd->topic) && frame_get_str(&p, end, &cmd->payload, &cmd->payload_len);
+}
 
-    while (1) {
-        Task* task;
-        if (!queue_read(&task_queue, (void**)&task)) break;
+static int run_set(Client** cp, conn_handle_t handle, const Command* cmd) {
+    (void)handle;
+    Client* c = *cp;
+    char response[512];
+    if (!rbac_can_set(c->hostname, cmd->topic)) {
+        client_send_str(c, "ERROR: Access denied.\n");
+        return 1;
+    }
+    db_set_device_state(c->hostname, cmd->topic, cmd->payload);
+    client_state_set(c, cmd->topic, cmd->payload); // Keeps subscription filters on this key current
+    snprintf(response, sizeof(response), "SUCCESS: State '%s' updated.\n", cmd->topic);
+    client_send_str(c, response);
+    return 1;
+}
 
-        if (task->conn_type == CONN_VAULT) {
+// GET and UNSUBSCRIBE frames carry just the topic
+static int decode_topic(const Frame* f, Command* cmd) {
+    const char* p = f->body;
+    return get_topic(&p, f->body + f->body_len, &cmd->topic);
+}
 
-            // Retrieve the Client pointer & automatically lock its individual mutex
-            Client* c = client_get_and_lock_by_fd(task->client_fd);
-            if (!c) {
-                free(task);
-                continue;
+static int run_get(Client** cp, conn_handle_t handle, const Command* cmd) {
+    (void)handle;
+    Client* c = *cp;
+    char response[512];
+    char value[256] = {0};
+    if (db_get_device_state(c->hostname, cmd->topic, value, sizeof(value))) {
+        snprintf(response, sizeof(response), "VALUE: %s=%s\n", cmd->topic, value);
+    } else {
+        snprintf(response, sizeof(response), "ERROR: Key '%s' not found.\n", cmd->topic);
+    }
+    db_log_message(c->hostname, cmd->topic, cmd->payload);
+    client_send_str(c, response);
+    return 1;
+}
+
+// PING and PONG frames have an empty body
+static int decode_empty(const Frame* f, Command* cmd) {
+    (void)f;
+    (void)cmd;
+    return 1;
+}
+
+static int run_ping(Client** cp, conn_handle_t handle, const Command* cmd) {
+    (void)handle;
+    (void)cmd;
+    static const char pong_frame[] = { OP_PONG, 0, 0 };
+    Client* c = *cp;
+    if (c->binary) client_send(c, pong_frame, sizeof(pong_frame));
+    else client_send(c, "PONG\n", 5);
+    return 1;
+}
+
+static int run_pong(Client** cp, conn_handle_t handle, const Command* cmd) {
+    (void)cp;
+    (void)handle;
+    (void)cmd;
+    return 1;
+}
+
+// ACK and QOS frames carry a single number
+static int decode_number(const Frame* f, Command* cmd) {
+    const char* p = f->body;
+    return frame_get_varint(&p, f->body + f->body_len, &cmd->number);
+}
+
+static int parse_ack(Client* c, CommandLine* line, Command* cmd) {
+    (void)c;
+    cmd->number = strtoull(line->topic, NULL, 10);
+    return 1;
+}
+
+// Acknowledges a QoS 1 delivery; like PONG it gets no reply
+static int run_ack(Client** cp, conn_handle_t handle, const Command* cmd) {
+    (void)handle;
+    qos_ack(*cp, cmd->number);
+    return 1;
+}
+
+static int parse_qos(Client* c, CommandLine* line, Command* cmd) {
+    (void)c;
+    cmd->number = (strcmp(line->topic, "1") == 0) ? 1 : 0;
+    return 1;
+}
+
+static int run_qos(Client** cp, conn_handle_t handle, const Command* cmd) {
+    (void)handle;
+    Client* c = *cp;
+    char response[512];
+    if (cmd->number != 1) {
+        client_send_str(c, "ERROR: Unsupported QoS level.\n");
+        return 1;
+    }
+    int resent = qos_enable(c);
+    snprintf(response, sizeof(response), "SUCCESS: QoS 1 enabled (%d redelivered).\n", resent);
+    client_send_str(c, response);
+    return 1;
+}
+
+// "FROM <offset>" asks for a durable topic's backlog first; anything else after the topic is a content filter
+static int parse_subscribe(Client* c, CommandLine* line, Command* cmd) {
+    (void)c;
+    int from_len = 0;
+    cmd->filter = line->rest;
+    if (sscanf(line->rest, "FROM %lld %n", &cmd->from, &from_len) == 1 && cmd->from >= 0) {
+        cmd->filter = &line->rest[from_len];
+    } else {
+        cmd->from = -1;
+    }
+    return 1;
+}
+
+static int decode_subscribe(const Frame* f, Command* cmd) {
+    const char* p = f->body;
+    const char* end = f->body + f->body_len;
+    size_t len;
+    uint64_t n = 0;
+    int ok = get_topic(&p, end, &cmd->topic) && frame_get_varint(&p, end, &n) &&
+             frame_get_str(&p, end, &cmd->filter, &len);
+    cmd->from = (n > 0) ? (long long)(n - 1) : -1;
+    cmd->payload = cmd->filter;
+    return ok;
+}
+
+static int run_subscribe(Client** cp, conn_handle_t handle, const Command* cmd) {
+    Client* c = *cp;
+    const char* topic = cmd->topic;
+    char response[512];
+    if (!rbac_can_subscribe(c->hostname, topic)) {
+        client_send_str(c, "ERROR: Access denied.\n");
+        return 1;
+    }
+
+    // A content filter is compiled once here rather than on every publish
+    SubFilter* filter = NULL;
+    if (cmd->filter[0] != '\0' && (filter = filter_compile(cmd->filter)) == NULL) {
+        client_send_str(c, "ERROR: Invalid subscription filter.\n");
+        return 1;
+    }
+    db_log_message(c->hostname, topic, cmd->payload);
+
+    if (cmd->from >= 0) {
+        long long start = pubsub_subscribe_from(c, topic, filter, cmd->from);
+        if (start == -2) {
+            client_send_str(c, "ERROR: Invalid topic.\n");
+            return 1;
+        }
+        if (start == -1) snprintf(response, sizeof(response), "Subscribed to %s (not durable, no replay)\n", topic);
+        else snprintf(response, sizeof(response), "Subscribed to %s from offset %lld\n", topic, start);
+        client_send_str(c, response); // Queued ahead of the backlog, which streams once this reply is flushed
+        return 1;
+    }
+
+    if (!pubsub_subscribe(handle, topic, filter)) {
+        client_send_str(c, "ERROR: Invalid topic filter.\n");
+        return 1;
+    }
+
+    snprintf(response, sizeof(response), "Subscribed to %s\n", topic);
+    client_send_str(c, response);
+    pubsub_deliver_retained(c, topic); // The current value, if any, without waiting for the next publish
+    return 1;
+}
+
+static int run_unsubscribe(Client** cp, conn_handle_t handle, const Command* cmd) {
+    Client* c = *cp;
+    char response[512];
+    if (!rbac_can_unsubscribe(c->hostname, cmd->topic)) {
+        client_send_str(c, "ERROR: Access denied.\n");
+        return 1;
+    }
+    pubsub_unsubscribe(handle, cmd->topic);
+    pubsub_replay_cancel(c, cmd->topic);
+    snprintf(response, sizeof(response), "Unsubscribed from %s\n", cmd->topic);
+    client_send_str(c, response);
+    return 1;
+}
+
+// "PUBLISH --retain <topic> [payload]" also keeps the payload as the topic's retained message (none clears it)
+// "PUBLISH --at <time> <topic> <payload>" and "PUBLISH --in <duration> <topic> <payload>" publish it later.
+// Options start with "--", so every other word is a topic; "PUBLISH -- <topic> <payload>" publishes to a topic that
+// starts with "--" itself.
+static int parse_publish(Client* c, CommandLine* line, Command* cmd) {
+    char* p = line->rest;
+    size_t len;
+    if (strcmp(line->topic, "--at") == 0 || strcmp(line->topic, "--in") == 0) {
+        int absolute = (line->topic[2] == 'a');
+        char* spec = command_word(&p, &len);
+        cmd->topic = command_word(&p, &len);
+        if (cmd->topic == NULL || *p == '\0') {
+            reply_invalid(c);
+            return 0;
+        }
+        cmd->payload = p;
+
+        long delay = absolute ? 0 : scheduler_parse_duration(spec);
+        cmd->fire_at = absolute ? scheduler_parse_at(spec) : (delay >= 0) ? time(NULL) + delay : -1;
+        if (cmd->fire_at <= 0) {
+            client_send_str(c, absolute ? "ERROR: Invalid time.\n" : "ERROR: Invalid duration.\n");
+            return 0;
+        }
+    } else if (strcmp(line->topic, "--retain") == 0 || strcmp(line->topic, "--") == 0) {
+        cmd->retain = (strcmp(line->topic, "--retain") == 0);
+        cmd->topic = command_word(&p, &len);
+        if (cmd->topic == NULL || (!cmd->retain && *p == '\0')) {
+            reply_invalid(c);
+            return 0;
+        }
+        cmd->payload = p;
+    }
+    return 1;
+}
+
+static int decode_publish(const Frame* f, Command* cmd) {
+    const char* p = f->body;
+    const char* end = f->body + f->body_len;
+    uint64_t n = 0;
+    if (!get_topic(&p, end, &cmd->topic) || !frame_get_bytes(&p, end, &cmd->payload, &cmd->payload_len)) return 0;
+    cmd->retain = (f->flags & FRAME_RETAIN) != 0;
+    if (f->flags & FRAME_AT) {
+        if (!frame_get_varint(&p, end, &n) || n == 0) return 0;
+        cmd->fire_at = (time_t)n;
+    }
+    return 1;
+}
+
+static int run_publish(Client** cp, conn_handle_t handle, const Command* cmd) {
+    Client* c = *cp;
+    const char* topic = cmd->topic;
+    const char* payload = cmd->payload;
+    char response[512];
+    if (topic_has_wildcard(topic)) {
+        client_send_str(c, "ERROR: Cannot publish to a wildcard topic.\n");
+        return 1;
+    }
+    if (cmd->retain && topic[0] == '@') {
+        client_send_str(c, "ERROR: Direct targets cannot retain messages.\n");
+        return 1;
+    }
+    if (!rbac_can_publish(c->hostname, topic)) {
+        client_send_str(c, "ERROR: Access denied.\n");
+        return 1;
+    }
+    if (cmd->fire_at > 0) {
+        // Logged when it fires; the wheel holds it until then
+        long long id = scheduler_add(cmd->fire_at, c->hostname, topic, payload, cmd->payload_len);
+        if (id) snprintf(response, sizeof(response), "Scheduled publish #%lld to %s\n", id, topic);
+        else snprintf(response, sizeof(response), "ERROR: Could not schedule the publish.\n");
+        client_send_str(c, response);
+        return 1;
+    }
+
+    db_log_message(c->hostname, topic, payload);
+    tracker_report(c->hostname, payload); // A report that echoes a command's "cid=N" counts towards its results
+
+    if (cmd->retain) {
+        // Stored before the fanout, so a subscriber joining meanwhile gets this message one way or the other
+        retained_store(topic, payload, cmd->payload_len);
+        if (cmd->payload_len == 0) {
+            snprintf(response, sizeof(response), "Cleared retained message on %s\n", topic);
+            client_send_str(c, response);
+            return 1;
+        }
+    }
+
+    // We must explicitly drop the client's mutex lock here to prevent thread deadlocks
+    // when pubsub searches over other active users' SSL pipes that may be writing.
+    client_unlock(c);
+    pubsub_publish(topic, payload, cmd->payload_len);
+    c = *cp = client_get_and_lock(handle);
+    if (!c) return 0;
+
+    snprintf(response, sizeof(response), "Published to %s\n", topic);
+    client_send_str(c, response);
+    return 1;
+}
+
+// Answered in text; from the next byte on, both sides speak the protocol asked for
+static int parse_hello(Client* c, CommandLine* line, Command* cmd) {
+    (void)cmd;
+    if (strcmp(line->topic, "BINARY") == 0) {
+        client_send_str(c, FRAME_HELLO "\n");
+        c->binary = 1;
+    } else if (strcmp(line->topic, "TEXT") == 0) {
+        client_send_str(c, "HELLO TEXT\n");
+    } else {
+        client_send_str(c, "ERROR: Unsupported protocol.\n");
+    }
+    return 0;
+}
+
+typedef struct {
+    // Text protocol: works out what the words after the verb mean, beyond the plain topic and payload. Returns 0 if
+    // it has answered the client itself and there is nothing to run. NULL if the topic and payload are all there is.
+    int (*parse)(Client* c, CommandLine* line, Command* cmd);
+    // Binary protocol: decodes the frame body. Returns 0 if a field is missing or malformed. NULL for text-only verbs.
+    int (*decode)(const Frame* f, Command* cmd);
+    // Runs the command. Returns 0 if the client vanished while its lock was dropped.
+    int (*run)(Client** cp, conn_handle_t handle, const Command* cmd);
+} Handler;
+
+// Indexed by the OP_* code that both framings resolve a command to (see command.c for the verbs)
+static const Handler handlers[VERB_HELLO + 1] = {
+    [OP_SET] = { NULL, decode_set, run_set },
+    [OP_GET] = { NULL, decode_topic, run_get },
+    [OP_PING] = { NULL, decode_empty, run_ping },
+    [OP_PONG] = { NULL, decode_empty, run_pong },
+    [OP_ACK] = { parse_ack, decode_number, run_ack },
+    [OP_QOS] = { parse_qos, decode_number, run_qos },
+    [OP_SUBSCRIBE] = { parse_subscribe, decode_subscribe, run_subscribe },
+    [OP_UNSUBSCRIBE] = { NULL, decode_topic, run_unsubscribe },
+    [OP_PUBLISH] = { parse_publish, decode_publish, run_publish },
+    [VERB_HELLO] = { parse_hello, NULL, NULL },
+};
+
+#define HANDLER_COUNT (sizeof(handlers) / sizeof(handlers[0]))
+
+// Handles a single command line, tokenized in place. Returns 0 if the client vanished while its lock was dropped.
+static int process_line(Client** cp, conn_handle_t handle, char* text) {
+    CommandLine line;
+    int op = command_parse_line(text, &line);
+    if (op < 0) {
+        reply_invalid(*cp);
+        return 1;
+    }
+
+    const Handler* h = &handlers[op];
+    Command cmd = { .topic = line.topic, .payload = line.rest, .filter = "", .from = -1 };
+    if (h->parse && !h->parse(*cp, &line, &cmd)) return 1;
+    cmd.payload_len = strlen(cmd.payload);
+    return h->run(cp, handle, &cmd);
+}
+
+// Decodes a binary frame into the same commands as the text protocol. The strings are used in place.
+// Returns 0 if the client vanished while its lock was dropped.
+static int process_frame(Client** cp, conn_handle_t handle, const Frame* f) {
+    const Handler* h = ((size_t)f->opcode < HANDLER_COUNT) ? &handlers[f->opcode] : NULL;
+    Command cmd = { .topic = "", .payload = "", .filter = "", .from = -1 };
+
+    // A field that does not add up is answered like a line that does not parse; the framing itself is intact
+    if (h == NULL || h->decode == NULL || !h->decode(f, &cmd)) {
+        reply_invalid(*cp);
+        return 1;
+    }
+    return h->run(cp, handle, &cmd);
+}
+
+// Runs every complete command currently in the client's buffer, in whichever framing it speaks (a HELLO switches
+// framing mid-buffer). Returns 0 if the client vanished.
+static int process_buffered_lines(Client** cp, conn_handle_t handle) {
+    // Commands are run in place. Publishing drops the client lock, and if the client is removed meanwhile its
+    // buffer is only freed once this epoch section has ended.
+    epoch_enter();
+    int alive = 1;
+    while (alive) {
+        Client* c = *cp;
+        if (c->binary) {
+            size_t avail;
+            const char* data = linebuf_peek(&c->in, &avail);
+            Frame f;
+            long n = frame_parse(data, avail, linebuf_limit() - 1, &f); // The buffer keeps one byte spare
+            if (n == 0) break;
+            if (n < 0) {
+                // There is no telling where the next frame starts, so the connection cannot continue
+                printf("Warning: Client %d sent a malformed frame. Disconnecting.\n", c->fd);
+                c->write_failed = 1;
+                break;
             }
+            linebuf_consume(&c->in, n);
+            alive = process_frame(cp, handle, &f);
+        } else {
+            size_t len;
+            char* line = linebuf_next_line(&c->in, &len);
+            if (line == NULL) break;
+            if (len > 0) alive = process_line(cp, handle, line);
+        }
+    }
+    epoch_exit();
+    return alive;
+}
+
+static void handle_handshake(Client* c, conn_handle_t handle, int my_id) {
+    ERR_clear_error(); // SSL_get_error() reads the per-thread error queue, which may hold stale entries
+    int ret = SSL_accept(c->ssl);
+    if (ret <= 0) {
+        int err = SSL_get_error(c->ssl, ret);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            // Handshake is pending, re-arm safely
+            reactor_rearm(c->epoll_fd, c->fd, handle, err == SSL_ERROR_WANT_WRITE);
+            client_unlock(c);
+        } else {
+            printf("[Worker %d] ERROR: TLS Handshake failed on fd %d (Err: %d).\n", my_id, c->fd, err);
+            client_unlock(c);
+            client_remove(handle);
+        }
+        return;
+    }
 
-            if (c->ssl == NULL) {
-                c->ssl = SSL_new(tls_get_context());
-                SSL_set_fd(c->ssl, c->fd);
+    char client_cn[256] = {0};
+    if (auth_verify_mtls(c->fd, c->ssl, client_cn, sizeof(client_cn))) {
+        c->auth_status = AUTH_SUCCESS;
+        c->state = STATE_IDLE;
+        client_unlock(c);
+
+        // Handle external mapping outside the client lock to prevent any lock contention
+        client_set_hostname(handle, client_cn);
+
+        // Agents usually pipeline their first commands behind the handshake, so read them right away.
+        // This also picks up application data that arrived before an edge-triggered registration could report it.
+        worker_process_event(handle, my_id);
+    } else {
+        printf("[Worker %d] ERROR: mTLS Identity Verification failed for %s.\n", my_id, client_cn);
+        client_unlock(c);
+        client_remove(handle);
+    }
+}
+
+// Drains everything the kernel and OpenSSL have buffered straight into the client's line buffer.
+// Edge-triggered connections must read until WANT_READ or the edge is lost; level-triggered ones
+// stop after a fair budget and let the re-armed registration bring them back.
+static void drain_input(Client** cp, conn_handle_t handle, int my_id, int* peer_closed) {
+    Client* c = *cp;
+    int budget = reactor_edge_triggered() ? -1 : WORKER_READ_BUDGET;
+
+    while (budget != 0) {
+        char* tail;
+        size_t space = linebuf_reserve(&c->in, &tail);
+        if (space == 0) {
+            // Make room by running the complete lines we already have
+            if (!process_buffered_lines(cp, handle)) return;
+            c = *cp;
+            if (c->write_failed) return;
+            space = linebuf_reserve(&c->in, &tail);
+            if (space == 0 && c->binary) {
+                // Cannot happen with a valid frame, whose size is checked against the limit from its header
+                c->write_failed = 1;
+                return;
+            }
+            if (space == 0) {
+                printf("Warning: Client %d sent a line longer than %zu bytes. Dropping it.\n", c->fd, c->in.capacity);
+                linebuf_discard_partial(&c->in);
+                continue;
             }
+        }
 
-            if (c->auth_status != AUTH_SUCCESS) {
-
-                int ret = SSL_accept(c->ssl);
-                if (ret <= 0) {
-                    int err = SSL_get_error(c->ssl, ret);
-                    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
-                        // Handshake is pending, re-arm safely
-                        struct epoll_event ev;
-                        ev.events = EPOLLIN | EPOLLONESHOT;
-                        ev.data.fd = c->fd;
-                        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
-
-                        client_unlock(c);
-                        free(task);
-                        continue;
-                    } else {
-                        printf("[Worker %d] ERROR: TLS Handshake failed on fd %d (Err: %d).\n", my_id, c->fd, err);
-                        client_unlock(c);
-                        client_remove(task->client_fd);
-                        free(task);
-                        continue;
-                    }
-                } else {
-                    char client_cn[256] = {0};
-                    if (auth_verify_mtls(c->fd, c->ssl, client_cn, sizeof(client_cn))) {
-                        c->auth_status = AUTH_SUCCESS;
-                        c->state = STATE_IDLE;
-                        client_unlock(c);
-
-                        // Handle external mapping outside the client lock to prevent any lock contention
-                        client_set_hostname(task->client_fd, client_cn);
-
-                        struct epoll_event ev;
-                        ev.events = EPOLLIN | EPOLLONESHOT;
-                        ev.data.fd = task->client_fd;
-                        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, task->client_fd, &ev);
-                    } else {
-                        printf("[Worker %d] ERROR: mTLS Identity Verification failed for %s.\n", my_id, client_cn);
-                        client_unlock(c);
-                        client_remove(task->client_fd);
-                    }
-                    free(task);
-                    continue;
-                }
-            } else {
-                char temp_buf[1024];
-                int bytes_read = SSL_read(c->ssl, temp_buf, sizeof(temp_buf) - 1);
-
-                if (bytes_read <= 0) {
-                    int err = SSL_get_error(c->ssl, bytes_read);
-                    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
-                        struct epoll_event ev;
-                        ev.events = EPOLLIN | EPOLLONESHOT;
-                        ev.data.fd = c->fd;
-                        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
-
-                        client_unlock(c);
-                        free(task);
-                        continue;
-
-                    } else {
-                        printf("[Worker %d] Client disconnected or SSL Error: %d\n", my_id, err);
-                        client_unlock(c);
-                        pubsub_unsubscribe_all(task->client_fd);
-                        client_remove(task->client_fd);
-                        free(task);
-                        continue;
-                    }
-                }
-
-                temp_buf[bytes_read] = '\0';
-                c->last_activity = time(NULL);
-                client_buffer_append(c, temp_buf, bytes_read);
-
-                char complete_message[1024];
-                int should_disconnect = 0;
-
-                while (client_buffer_extract_line(c, complete_message, sizeof(complete_message))) {
-                    complete_message[strcspn(complete_message, "\r")] = 0;
-                    if (strlen(complete_message) == 0) continue;
-
-                    char command[32] = {0};
-                    char topic[64] = {0};
-                    char payload[800] = {0};
-                    int parsed_items = sscanf(complete_message, "%31s %63s %799[^\n]", command, topic, payload);
-                    char response[512];
-
-                    if (parsed_items == 3 && strcmp(command, "SET") == 0) {
-                        if (!rbac_can_set(c->hostname, topic)) {
-                            SSL_write(c->ssl, "ERROR: Access denied.\n", 22);
-                            continue;
-                        }
-                        db_set_device_state(c->hostname, topic, payload);
-                        snprintf(response, sizeof(response), "SUCCESS: State '%s' updated.\n", topic);
-                        SSL_write(c->ssl, response, strlen(response));
-
-                    } else if (parsed_items == 2 && strcmp(command, "GET") == 0) {
-                        char value[256] = {0};
-                        if (db_get_device_state(c->hostname, topic, value, sizeof(value))) {
-                            snprintf(response, sizeof(response), "VALUE: %s=%s\n", topic, value);
-                        } else {
-                            snprintf(response, sizeof(response), "ERROR: Key '%s' not found.\n", topic);
-                        }
-                        db_log_message(c->hostname, topic, payload);
-                        SSL_write(c->ssl, response, strlen(response));
-
-                    } else if (parsed_items >= 1 && strcmp(command, "PING") == 0) {
-                        SSL_write(c->ssl, "PONG\n", 5);
-
-                    } else if (parsed_items >= 1 && strcmp(command, "PONG") == 0) {
-                        continue;
-
-                    } else if (parsed_items >= 2 && strcmp(command, "SUBSCRIBE") == 0) {
-                        if (!rbac_can_subscribe(c->hostname, topic)) {
-                            SSL_write(c->ssl, "ERROR: Access denied.\n", 22);
-                            continue;
-                        }
-                        db_log_message(c->hostname, topic, payload);
-                        pubsub_subscribe(c->fd, topic);
-
-                        snprintf(response, sizeof(response), "Subscribed to %s\n", topic);
-                        SSL_write(c->ssl, response, strlen(response));
-
-                    } else if (parsed_items >= 2 && strcmp(command, "UNSUBSCRIBE") == 0) {
-                        if (!rbac_can_unsubscribe(c->hostname, topic)) {
-                            SSL_write(c->ssl, "ERROR: Access denied.\n", 22);
-                            continue;
-                        }
-                        pubsub_unsubscribe(c->fd, topic);
-                        snprintf(response, sizeof(response), "Unsubscribed from %s\n", topic);
-                        SSL_write(c->ssl, response, strlen(response));
-
-                    } else if (parsed_items == 3 && strcmp(command, "PUBLISH") == 0) {
-                        if (!rbac_can_publish(c->hostname, topic)) {
-                            SSL_write(c->ssl, "ERROR: Access denied.\n", 22);
-                            continue;
-                        }
-                        db_log_message(c->hostname, topic, payload);
-
-                        // We must explicitly drop the client's mutex lock here to prevent thread deadlocks
-                        // when pubsub searches over other active users' SSL pipes that may be writing.
-                        client_unlock(c);
-                        pubsub_publish(topic, payload);
-                        c = client_get_and_lock_by_fd(task->client_fd);
-                        if (!c) { should_disconnect = 1; break; }
-
-                        snprintf(response, sizeof(response), "Published to %s\n", topic);
-                        SSL_write(c->ssl, response, strlen(response));
-
-                    } else {
-                        snprintf(response, sizeof(response), "ERROR: Invalid command.\n");
-                        SSL_write(c->ssl, response, strlen(response));
-                    }
-                }
-
-                if (should_disconnect) {
-                    client_unlock(c);
-                    pubsub_unsubscribe_all(task->client_fd);
-                    client_remove(task->client_fd);
-                } else {
-                    struct epoll_event ev;
-                    ev.events = EPOLLIN | EPOLLONESHOT;
-                    ev.data.fd = c->fd;
-                    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
-                    client_unlock(c);
-                }
+        ERR_clear_error();
+        int bytes_read = SSL_read(c->ssl, tail, space > INT_MAX ? INT_MAX : (int)space);
+        if (bytes_read <= 0) {
+            int err = SSL_get_error(c->ssl, bytes_read);
+            if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+                printf("[Worker %d] Client disconnected or SSL Error: %d\n", my_id, err);
+                *peer_closed = 1;
             }
+            return;
+        }
 
-        } else if (task->conn_type == CONN_LOBBY) {
+        linebuf_commit(&c->in, bytes_read);
+        if (budget > 0) budget = (bytes_read >= budget) ? 0 : budget - bytes_read;
+    }
+}
 
-            char temp_buf[4096];
-            int bytes_read = read(task->client_fd, temp_buf, sizeof(temp_buf) - 1);
+static void handle_readable(Client* c, conn_handle_t handle, int my_id) {
+    int peer_closed = 0;
 
-            if (bytes_read > 0) {
-               temp_buf[bytes_read] = '\0';
-               process_enrollment(task->client_fd, temp_buf);
-            }
+    // Another worker owns this connection's input right now (it dropped the lock to publish).
+    // Leave it a note instead of reading concurrently, so the client's commands keep their order.
+    if (c->in_worker) {
+        c->rerun = 1;
+        client_unlock(c);
+        return;
+    }
+
+    // Responses (and fanout from other publishers) queue up while we work and leave together at the end
+    c->in_worker = 1;
+    c->corked = 1;
+
+    do {
+        c->rerun = 0;
+        if (!c->write_failed) drain_input(&c, handle, my_id, &peer_closed);
+
+        if (c) {
+            c->last_activity = time(NULL);
+            // Run every complete line from this burst in one pass (lines received before a close still count)
+            if (!process_buffered_lines(&c, handle)) c = NULL;
+        }
+    } while (c && c->rerun && !peer_closed && !c->write_failed);
+
+    if (c) {
+        c->in_worker = 0;
+        c->corked = 0;
+        client_flush(c);
+    }
+
+    if (c == NULL || peer_closed || c->write_failed) {
+        client_unlock(c);
+        pubsub_unsubscribe_all(handle);
+        client_remove(handle);
+    } else {
+        reactor_rearm(c->epoll_fd, c->fd, handle, outq_pending(&c->out));
+        client_unlock(c);
+    }
+}
+
+void worker_process_event(conn_handle_t handle, int my_id) {
+    int client_fd = HANDLE_FD(handle);
+
+    if (!(handle & HANDLE_LOBBY_BIT)) {
+
+        // Retrieve the Client pointer & automatically lock its individual mutex (stale generations return NULL)
+        Client* c = client_get_and_lock(handle);
+        if (!c) {
+            return;
+        }
 
-            close(task->client_fd);
+        if (c->ssl == NULL) {
+            c->ssl = SSL_new(tls_get_context());
+            SSL_set_fd(c->ssl, c->fd);
         }
 
-        free(task);
+        if (c->auth_status != AUTH_SUCCESS) {
+            handle_handshake(c, handle, my_id);
+        } else {
+            handle_readable(c, handle, my_id);
+        }
+
+    } else {
+
+        char temp_buf[4096];
+        int bytes_read = read(client_fd, temp_buf, sizeof(temp_buf) - 1);
+
+        if (bytes_read > 0) {
+           temp_buf[bytes_read] = '\0';
+           process_enrollment(client_fd, temp_buf);
+        }
+
+        close(client_fd);
+    }
+}
+
+void* worker_thread(void* arg) {
+    int my_id = *((int*)arg);
+    void* batch[WORKER_BATCH_SIZE];
+
+    while (1) {
+        int count = queue_read_batch(&task_queue, batch, WORKER_BATCH_SIZE);
+        if (count == 0) break;
+
+        for (int i = 0; i < count; i++) {
+            worker_process_event((conn_handle_t)(uintptr_t)batch[i], my_id);
+        }
     }
     return NULL;
 }
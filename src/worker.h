@@ -2,14 +2,17 @@
 #define WORKER_H
 
 #include "ts_queue.h"
+#include "client_manager.h"
+
+#define WORKER_BATCH_SIZE 16
+#define WORKER_READ_BUDGET (64 * 1024) // Bytes a level-triggered connection may read per dispatch
 
 // The shared task queue
 extern ts_queue_t task_queue;
 
-typedef struct {
-    int client_fd;
-    int conn_type;
-} Task;
+// Services one readiness event for a connection handle. Called by pool workers, or inline by a sharded reactor.
+// Tasks on the queue are the handles themselves, cast to void*.
+void worker_process_event(conn_handle_t handle, int my_id);
 
 void* worker_thread(void* arg);
 